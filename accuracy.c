@@ -24,6 +24,7 @@
 #include <float.h>
 #include "lvq_pak.h"
 #include "datafile.h"
+#include "bmu_rout.h"
 
 static char *usage[] = {
   "accuracy - computes the recognition accuracy by the nearest-neighbor rule\n",
@@ -47,6 +48,7 @@ int compute_accuracy(struct teach_params *teach, struct file_info *of)
   struct entries *data = teach->data;
   struct entries *codes = teach->codes;
   WINNER_FUNCTION *find_winner = teach->winner;
+  struct winner_batch *batch;
   struct data_entry *datatmp;
   eptr p;
 
@@ -76,10 +78,13 @@ int compute_accuracy(struct teach_params *teach, struct file_info *of)
   /* Number of data vectors */
   noc = data->flags.totlen_known ? data->num_entries : 0;
 
+  /* find the winners all at once if the data is in memory */
+  batch = batch_winners(codes, data, find_winner);
+
   /* Scan all input entries */
   while (datatmp != NULL) {
 
-    find_winner(codes, datatmp, &winner, 1);
+    batch_winner(batch, codes, datatmp, &winner, find_winner);
     
     /* If classification was correct */
     datalabel = get_entry_label(datatmp);
@@ -111,6 +116,7 @@ int compute_accuracy(struct teach_params *teach, struct file_info *of)
       if (noc)
 	mprint((long) noc--);
   }
+  free_winner_batch(batch);
   ifverbose(1)
     {
       mprint((long) 0);
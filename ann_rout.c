@@ -0,0 +1,554 @@
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  ann_rout.c                                                          *
+ *   - approximate nearest neighbour search for large codebooks with    *
+ *     inverted lists over coarse centroids (IVF)                       *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "lvq_pak.h"
+#include "datafile.h"
+#include "vec_rout.h"
+#include "bmu_rout.h"
+#include "ann_rout.h"
+
+/* The codebook vectors are clustered with k-means into about sqrt(noc)
+   lists. A sample is compared to the centroids of the lists first and
+   then to the vectors of the few nearest lists only, so the winner is
+   not always the exact one; more lists searched means better recall.
+   The index is read from the file <codebook file>.ivf when there is one
+   made for the same codebook (see annindex), otherwise it is built when
+   first needed. Like the search trees, the index is thrown away when
+   the codebook changes and during training the codebook is scanned. */
+
+static long adapt_count = 0, last_count = 0;
+static int num_probes = 0;
+
+/* ann_probes - set the number of lists searched if probes > 0. Returns
+   the number in use. */
+
+int ann_probes(int probes)
+{
+  char *s;
+
+  if (probes > 0)
+    num_probes = probes;
+
+  if (num_probes <= 0)
+    {
+      s = getenv("LVQSOM_ANN_PROBES");
+      num_probes = ((s != NULL) && (atoi(s) > 0)) ? atoi(s) : ANN_PROBES;
+    }
+
+  return num_probes;
+}
+
+/* codebook_hash - checksum of a flat codebook, to tell whether an index
+   file was made for it */
+
+unsigned long codebook_hash(struct entries *codes)
+{
+  unsigned long h = 2166136261UL;
+  unsigned char *b;
+  long i, n;
+
+  for (i = 0; i < codes->num_entries; i++)
+    for (b = (unsigned char *) block_row(codes, i),
+	   n = codes->dimension * sizeof(float); n > 0; n--)
+      h = (h ^ *b++) * 16777619UL;
+
+  return h;
+}
+
+static struct ivf_index *new_ivf_index(int dim, long noc, long nlist)
+{
+  struct ivf_index *ivf;
+
+  ivf = calloc(1, sizeof(struct ivf_index));
+  if (ivf != NULL)
+    {
+      ivf->dim = dim;
+      ivf->noc = noc;
+      ivf->nlist = nlist;
+      ivf->cent = malloc((nlist * dim > 0 ? nlist * dim : 1) * sizeof(float));
+      ivf->list = malloc((noc > 0 ? noc : 1) * sizeof(long));
+      ivf->start = malloc((nlist + 1) * sizeof(long));
+      ivf->members = malloc((noc > 0 ? noc : 1) * sizeof(long));
+      ivf->vecs = malloc((noc * dim > 0 ? noc * dim : 1) * sizeof(float));
+    }
+  if ((ivf == NULL) || (ivf->cent == NULL) || (ivf->list == NULL) ||
+      (ivf->start == NULL) || (ivf->members == NULL) || (ivf->vecs == NULL))
+    {
+      fprintf(stderr, "new_ivf_index: can't allocate memory\n");
+      free_ivf_index(ivf);
+      ERROR(ERR_NOMEM);
+      return NULL;
+    }
+
+  ivf->stamp = adapt_count;
+  return ivf;
+}
+
+void free_ivf_index(void *index)
+{
+  struct ivf_index *ivf = index;
+
+  if (ivf)
+    {
+      ofree(ivf->cent);
+      ofree(ivf->list);
+      ofree(ivf->start);
+      ofree(ivf->members);
+      ofree(ivf->vecs);
+      ofree(ivf->probe);
+      free(ivf);
+    }
+}
+
+/* make_lists - collect the members of the lists from list[]. The
+   vectors are copied in the order of the lists, so that each list is
+   read from consecutive memory. */
+
+static void make_lists(struct ivf_index *ivf, struct entries *codes)
+{
+  long i, l;
+
+  for (l = 0; l <= ivf->nlist; l++)
+    ivf->start[l] = 0;
+  for (i = 0; i < ivf->noc; i++)
+    ivf->start[ivf->list[i] + 1]++;
+  for (l = 0; l < ivf->nlist; l++)
+    ivf->start[l + 1] += ivf->start[l];
+  for (i = 0; i < ivf->noc; i++)
+    ivf->members[ivf->start[ivf->list[i]]++] = i;
+  for (l = ivf->nlist; l > 0; l--)
+    ivf->start[l] = ivf->start[l - 1];
+  ivf->start[0] = 0;
+
+  for (i = 0; i < ivf->noc; i++)
+    memcpy(ivf->vecs + i * ivf->dim, block_row(codes, ivf->members[i]),
+	   ivf->dim * sizeof(float));
+}
+
+/* assign - find the nearest centroid of each codebook vector with the
+   batched search. Returns non-zero on error. */
+
+static int assign(struct ivf_index *ivf, struct entries *cents,
+		  struct data_entry **vectors, struct winner_info *win)
+{
+  struct code_panels *cp;
+  long i, l;
+  int error;
+
+  for (l = 0; l < ivf->nlist; l++)
+    memcpy(block_row(cents, l), ivf->cent + l * ivf->dim,
+	   ivf->dim * sizeof(float));
+
+  if ((cp = make_code_panels(cents)) == NULL)
+    return 1;
+  error = find_winners_block(cp, cents, vectors, ivf->noc, win, NULL,
+			     find_winner_euc);
+  free_code_panels(cp);
+
+  for (i = 0; i < ivf->noc; i++)
+    ivf->list[i] = (win[i].index >= 0) ? win[i].index : 0;
+
+  return error;
+}
+
+/* build_ivf_index - divide the codebook into nlist lists with k-means.
+   If nlist <= 0, sqrt(noc) lists are made. Returns NULL on error. */
+
+struct ivf_index *build_ivf_index(struct entries *codes, long nlist)
+{
+  struct ivf_index *ivf;
+  struct entries *cents = NULL;
+  struct data_entry **vectors = NULL;
+  struct winner_info *win = NULL;
+  long noc = codes->num_entries, i, l, *count = NULL;
+  int dim = codes->dimension, d, iter;
+  double *sum = NULL;
+  float *c;
+
+  if (codes->block == NULL)
+    {
+      fprintf(stderr, "build_ivf_index: codebook is not flat\n");
+      return NULL;
+    }
+
+  if (nlist <= 0)
+    nlist = (long) sqrt((double) noc);
+  if (nlist > noc)
+    nlist = noc;
+  if (nlist < 1)
+    nlist = 1;
+
+  if ((ivf = new_ivf_index(dim, noc, nlist)) == NULL)
+    return NULL;
+  ivf->hash = codebook_hash(codes);
+
+  vectors = malloc((noc > 0 ? noc : 1) * sizeof(struct data_entry *));
+  win = malloc((noc > 0 ? noc : 1) * sizeof(struct winner_info));
+  sum = malloc(nlist * dim * sizeof(double));
+  count = malloc(nlist * sizeof(long));
+  if ((cents = alloc_entries()) != NULL)
+    {
+      cents->dimension = dim;
+      if (alloc_block_entries(cents, nlist) == NULL)
+	{
+	  close_entries(cents);
+	  cents = NULL;
+	}
+    }
+  if ((vectors == NULL) || (win == NULL) || (sum == NULL) ||
+      (count == NULL) || (cents == NULL))
+    {
+      fprintf(stderr, "build_ivf_index: can't allocate memory\n");
+      ERROR(ERR_NOMEM);
+      goto error;
+    }
+
+  /* start from vectors spread evenly over the codebook */
+  for (l = 0; l < nlist; l++)
+    memcpy(ivf->cent + l * dim, block_row(codes, l * noc / nlist),
+	   dim * sizeof(float));
+  for (i = 0; i < noc; i++)
+    vectors[i] = &codes->units[i];
+
+  for (iter = 0; ; iter++)
+    {
+      if (assign(ivf, cents, vectors, win))
+	goto error;
+      if (iter == ANN_ITER)
+	break;
+
+      memset(sum, 0, nlist * dim * sizeof(double));
+      memset(count, 0, nlist * sizeof(long));
+      for (i = 0; i < noc; i++)
+	{
+	  l = ivf->list[i];
+	  count[l]++;
+	  for (c = block_row(codes, i), d = 0; d < dim; d++)
+	    sum[l * dim + d] += c[d];
+	}
+      /* empty lists keep their centroids */
+      for (l = 0; l < nlist; l++)
+	if (count[l] > 0)
+	  for (d = 0; d < dim; d++)
+	    ivf->cent[l * dim + d] = sum[l * dim + d] / count[l];
+    }
+
+  make_lists(ivf, codes);
+
+  ifverbose(2)
+    fprintf(stderr, "built index of %ld lists for %ld vectors\n", nlist, noc);
+
+  close_entries(cents);
+  free(vectors);
+  free(win);
+  free(sum);
+  free(count);
+  return ivf;
+
+ error:
+  if (cents)
+    close_entries(cents);
+  ofree(vectors);
+  ofree(win);
+  ofree(sum);
+  ofree(count);
+  free_ivf_index(ivf);
+  return NULL;
+}
+
+/* save_ivf_index - write the index to a file: a header line, the
+   centroids one per line and the list of each codebook vector one per
+   line. Returns non-zero on error. */
+
+int save_ivf_index(struct ivf_index *ivf, char *name)
+{
+  FILE *fp;
+  long i, l;
+  int d;
+
+  if ((fp = fopen(name, "w")) == NULL)
+    {
+      fprintf(stderr, "save_ivf_index: can't open file '%s'\n", name);
+      return 1;
+    }
+
+  fprintf(fp, "ivf %d %ld %ld %lx\n", ivf->dim, ivf->noc, ivf->nlist,
+	  ivf->hash);
+  for (l = 0; l < ivf->nlist; l++)
+    for (d = 0; d < ivf->dim; d++)
+      fprintf(fp, "%.9g%c", ivf->cent[l * ivf->dim + d],
+	      (d == ivf->dim - 1) ? '\n' : ' ');
+  for (i = 0; i < ivf->noc; i++)
+    fprintf(fp, "%ld\n", ivf->list[i]);
+
+  if (ferror(fp) | fclose(fp))
+    {
+      fprintf(stderr, "save_ivf_index: can't write file '%s'\n", name);
+      return 1;
+    }
+  return 0;
+}
+
+/* load_ivf_index - read the index made for the codebook. Returns NULL
+   if there is no such file or it was made for another codebook. */
+
+struct ivf_index *load_ivf_index(struct entries *codes, char *name)
+{
+  struct ivf_index *ivf;
+  FILE *fp;
+  long noc, nlist, i;
+  int dim;
+  unsigned long hash;
+
+  if ((codes->block == NULL) || ((fp = fopen(name, "r")) == NULL))
+    return NULL;
+
+  if (fscanf(fp, "ivf %d %ld %ld %lx", &dim, &noc, &nlist, &hash) != 4)
+    {
+      fprintf(stderr, "load_ivf_index: file '%s' is not an index\n", name);
+      fclose(fp);
+      return NULL;
+    }
+
+  if ((dim != codes->dimension) || (noc != codes->num_entries) ||
+      (nlist < 1) || (nlist > noc) || (hash != codebook_hash(codes)))
+    {
+      ifverbose(1)
+	fprintf(stderr, "index '%s' is not made for this codebook, ignored\n",
+		name);
+      fclose(fp);
+      return NULL;
+    }
+
+  if ((ivf = new_ivf_index(dim, noc, nlist)) == NULL)
+    {
+      fclose(fp);
+      return NULL;
+    }
+  ivf->hash = hash;
+
+  for (i = 0; i < nlist * dim; i++)
+    if (fscanf(fp, "%g", &ivf->cent[i]) != 1)
+      break;
+  if (i == nlist * dim)
+    for (i = 0; i < noc; i++)
+      if ((fscanf(fp, "%ld", &ivf->list[i]) != 1) ||
+	  (ivf->list[i] < 0) || (ivf->list[i] >= nlist))
+	break;
+  fclose(fp);
+
+  if (i < noc)
+    {
+      fprintf(stderr, "load_ivf_index: file '%s' is broken\n", name);
+      free_ivf_index(ivf);
+      return NULL;
+    }
+
+  make_lists(ivf, codes);
+
+  ifverbose(2)
+    fprintf(stderr, "index read from %s\n", name);
+  return ivf;
+}
+
+/* get_index - returns the index of the codebook, reading or building it
+   if needed. Returns NULL if the codebook should be scanned. */
+
+static struct ivf_index *get_index(struct entries *codes)
+{
+  struct ivf_index *ivf = NULL;
+  char *name;
+
+  if ((codes->block == NULL) || (codes->num_entries < ANN_MIN_SIZE))
+    return NULL;
+
+  if (codes->index != NULL)
+    {
+      if (codes->free_index != free_ivf_index)
+	return NULL; /* some other index is in use */
+
+      ivf = codes->index;
+      if (ivf->stamp == adapt_count)
+	return ivf;
+
+      /* the codebook has changed */
+      free_ivf_index(ivf);
+      codes->index = NULL;
+      codes->free_index = NULL;
+    }
+
+  /* don't build while the codebook is being adapted */
+  if (last_count != adapt_count)
+    {
+      last_count = adapt_count;
+      return NULL;
+    }
+
+  ivf = NULL;
+  if ((codes->fi != NULL) && (codes->fi->name != NULL))
+    {
+      name = malloc(strlen(codes->fi->name) + strlen(ANN_SUFFIX) + 1);
+      if (name != NULL)
+	{
+	  sprintf(name, "%s%s", codes->fi->name, ANN_SUFFIX);
+	  ivf = load_ivf_index(codes, name);
+	  free(name);
+	}
+    }
+  if (ivf == NULL)
+    ivf = build_ivf_index(codes, 0);
+
+  if (ivf != NULL)
+    {
+      codes->index = ivf;
+      codes->free_index = free_ivf_index;
+    }
+  return ivf;
+}
+
+/* scan_codebook - find the knn nearest codebook vectors the exact
+   way */
+
+static int scan_codebook(struct entries *codes, struct data_entry *sample,
+			 struct winner_info *win, int knn)
+{
+  if (knn == 1)
+    return find_winner_euc(codes, sample, win, 1);
+  return find_winner_knn(codes, sample, win, knn);
+}
+
+/* find_winner_ann - find the knn nearest codebook vectors from the
+   lists of the nearest centroids. Empty lists are not counted as
+   searched. Masked samples and small codebooks are scanned with
+   find_winner_euc and find_winner_knn, and so is the sample if no
+   vector was found in the lists. */
+
+int find_winner_ann(struct entries *codes, struct data_entry *sample,
+		    struct winner_info *win, int knn)
+{
+  struct vec_kernels *k = current_kernels();
+  struct ivf_index *ivf;
+  struct winner_info *probe;
+  int dim = codes->dimension, probes, np, n, j;
+  long l, m, index, best;
+  float difference, bound, diff, *c, *x = sample->points;
+
+  if (knn < 1)
+    knn = 1;
+
+  if ((sample->mask != NULL) || ((ivf = get_index(codes)) == NULL))
+    return scan_codebook(codes, sample, win, knn);
+
+  probes = ann_probes(0);
+  if (probes > ivf->nlist)
+    probes = ivf->nlist;
+
+  /* the heap of the nearest centroids is kept with the index */
+  if (probes > ivf->num_probe)
+    {
+      probe = realloc(ivf->probe, probes * sizeof(struct winner_info));
+      if (probe == NULL)
+	{
+	  fprintf(stderr, "find_winner_ann: can't allocate memory\n");
+	  ERROR(ERR_NOMEM);
+	  return 0;
+	}
+      ivf->probe = probe;
+      ivf->num_probe = probes;
+    }
+  probe = ivf->probe;
+
+  /* the nearest centroids that have vectors in their lists */
+  for (np = 0, l = 0; l < ivf->nlist; l++)
+    {
+      if (ivf->start[l] == ivf->start[l + 1])
+	continue;
+      difference = k->dist2(ivf->cent + l * dim, x, dim);
+      if ((np < probes) || (difference <= probe[0].diff))
+	heap_winner(probe, &np, probes, difference, l, NULL);
+    }
+
+  /* the vectors in their lists */
+  bound = FLT_MAX;
+  best = -1;
+  n = 0;
+  for (j = 0; j < np; j++)
+    for (l = probe[j].index, m = ivf->start[l]; m < ivf->start[l + 1]; m++)
+      {
+	index = ivf->members[m];
+	difference = k->dist2b(ivf->vecs + m * dim, x, dim, bound);
+	if (knn == 1)
+	  {
+	    if ((difference < bound) ||
+		((difference == bound) && (index < best)))
+	      {
+		bound = difference;
+		best = index;
+	      }
+	  }
+	else if (difference <= bound)
+	  {
+	    heap_winner(win, &n, knn, difference, index,
+			&codes->units[index]);
+	    if (n == knn)
+	      bound = win[0].diff;
+	  }
+      }
+
+  /* nothing found, for example if all distances were NaN */
+  if (((knn == 1) && (best < 0)) || ((knn > 1) && (n == 0)))
+    return scan_codebook(codes, sample, win, knn);
+
+  if (knn == 1)
+    {
+      win->index = best;
+      win->winner = &codes->units[best];
+      /* the distance as find_winner_euc would give it */
+      for (difference = 0.0, c = block_row(codes, best), j = 0; j < dim; j++)
+	{
+	  diff = c[j] - x[j];
+	  difference += diff * diff;
+	}
+      win->diff = difference;
+      return 1;
+    }
+
+  sort_winners(win, n, knn);
+  return knn;
+}
+
+/* adapt_vector_ann - adapt_vector that lets the search know that the
+   codebook has changed */
+
+void adapt_vector_ann(struct data_entry *codetmp, struct data_entry *sample,
+		      int dim, float alpha)
+{
+  adapt_count++;
+  adapt_vector(codetmp, sample, dim, alpha);
+}
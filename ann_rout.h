@@ -0,0 +1,79 @@
+#ifndef ANN_ROUT_H
+#define ANN_ROUT_H
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  ann_rout.h                                                          *
+ *   - header file for ann_rout.c: approximate winner search            *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include "lvq_pak.h"
+
+
+/* codebooks smaller than this are always scanned */
+
+#ifndef ANN_MIN_SIZE
+#define ANN_MIN_SIZE 1024
+#endif /* ANN_MIN_SIZE */
+
+/* default number of lists searched, can be changed with the environment
+   variable LVQSOM_ANN_PROBES */
+
+#ifndef ANN_PROBES
+#define ANN_PROBES 8
+#endif /* ANN_PROBES */
+
+/* rounds of k-means when the coarse centroids are computed */
+
+#ifndef ANN_ITER
+#define ANN_ITER 10
+#endif /* ANN_ITER */
+
+/* suffix of the index file, saved next to the codebook file */
+
+#define ANN_SUFFIX ".ivf"
+
+/* inverted lists: the codebook vectors are divided among nlist coarse
+   centroids, and only the lists of the nearest centroids are searched */
+
+struct ivf_index {
+  int dim;
+  long noc;
+  long nlist;
+  unsigned long hash;     /* checksum of the codebook */
+  float *cent;            /* the centroids, nlist * dim floats */
+  long *list;             /* list of each codebook vector */
+  long *start;            /* members of list l are */
+  long *members;          /*   members[start[l] ... start[l + 1] - 1] */
+  float *vecs;            /* copies of the members, dim floats each */
+  long stamp;             /* adaptations done when the index was made */
+  struct winner_info *probe; /* space for the nearest centroids */
+  int num_probe;
+};
+
+unsigned long codebook_hash(struct entries *codes);
+struct ivf_index *build_ivf_index(struct entries *codes, long nlist);
+struct ivf_index *load_ivf_index(struct entries *codes, char *name);
+int save_ivf_index(struct ivf_index *ivf, char *name);
+void free_ivf_index(void *ivf);
+int ann_probes(int probes);
+
+WINNER_FUNCTION find_winner_ann;
+VECTOR_ADAPT adapt_vector_ann;
+
+#endif /* ANN_ROUT_H */
@@ -0,0 +1,196 @@
+/************************************************************************
+ *                                                                      *
+ *  Program package 'lvq_pak':                                          *
+ *                                                                      *
+ *  annindex.c                                                          *
+ *  -builds the approximate search index of a codebook and reports its  *
+ *   recall                                                             *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lvq_pak.h"
+#include "datafile.h"
+#include "ann_rout.h"
+
+static char *usage[] = {
+  "annindex - builds the approximate search index of a codebook and reports\n",
+  "           its recall\n",
+  "Required parameters:\n",
+  "  -cin filename         input codebook file, the index is saved in\n",
+  "                        filename" ANN_SUFFIX "\n",
+  "Optional parameters:\n",
+  "  -lists integer        number of lists (default: square root of the\n",
+  "                        number of codebook vectors)\n",
+  "  -din filename         test data for measuring the recall\n",
+  "  -probes integer       number of lists searched (default: 1, 2, 4, ...)\n",
+  "  -buffer integer       buffered reading of data, integer lines at a time\n",
+  NULL};
+
+/* winners - find the winners of all samples. If exact is given, the
+   number of winners that are as near as those is returned, otherwise
+   the winners are stored in it. *secs is the time used. */
+
+static long winners(struct entries *codes, struct entries *data,
+		    WINNER_FUNCTION *winner, struct winner_info **exact,
+		    long *num, double *secs)
+{
+  struct data_entry *dtmp;
+  struct winner_info win;
+  long n = 0, hits = 0;
+  clock_t start = clock();
+  eptr p;
+
+  for (dtmp = rewind_entries(data, &p); dtmp != NULL; dtmp = next_entry(&p))
+    {
+      if (winner(codes, dtmp, &win, 1) == 0)
+	win.index = -1;
+
+      if (*num >= 0)
+	{
+	  if ((n < *num) && ((win.index == (*exact)[n].index) ||
+			     (win.diff == (*exact)[n].diff)))
+	    hits++;
+	}
+      else
+	{
+	  *exact = realloc(*exact, (n + 1) * sizeof(struct winner_info));
+	  if (*exact == NULL)
+	    {
+	      fprintf(stderr, "annindex: can't allocate memory\n");
+	      return -1;
+	    }
+	  (*exact)[n] = win;
+	}
+      n++;
+    }
+
+  *secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+  if (*num < 0)
+    *num = n;
+  return hits;
+}
+
+int main(int argc, char **argv)
+{
+  char *in_data_file, *in_code_file, *name;
+  struct entries *data = NULL, *codes = NULL;
+  struct teach_params params;
+  struct ivf_index *ivf;
+  struct winner_info *exact = NULL;
+  long lists, buffer, num = -1, hits;
+  int probes, p;
+  double secs;
+
+  global_options(argc, argv);
+  if (extract_parameter(argc, argv, "-help", OPTION2))
+    {
+      printhelp();
+      exit(0);
+    }
+  in_code_file = extract_parameter(argc, argv, IN_CODE_FILE, ALWAYS);
+  in_data_file = extract_parameter(argc, argv, IN_DATA_FILE, OPTION);
+  lists = oatoi(extract_parameter(argc, argv, "-lists", OPTION), 0);
+  probes = (int) oatoi(extract_parameter(argc, argv, "-probes", OPTION), 0);
+  buffer = oatoi(extract_parameter(argc, argv, "-buffer", OPTION), 0);
+
+  label_not_needed(1);
+
+  ifverbose(2)
+    fprintf(stderr, "Codebook entries are read from file %s\n", in_code_file);
+  if ((codes = open_entries(in_code_file)) == NULL)
+    {
+      fprintf(stderr, "Can't open codes file %s\n", in_code_file);
+      exit(1);
+    }
+
+  if (in_data_file)
+    {
+      ifverbose(2)
+	fprintf(stderr, "Input entries are read from file %s\n", in_data_file);
+      if ((data = open_entries(in_data_file)) == NULL)
+	{
+	  fprintf(stderr, "Can't open data file %s\n", in_data_file);
+	  close_entries(codes);
+	  exit(1);
+	}
+      if (data->dimension != codes->dimension)
+	{
+	  fprintf(stderr, "Data and codebook vectors have different dimensions\n");
+	  close_entries(data);
+	  close_entries(codes);
+	  exit(1);
+	}
+    }
+
+  if (set_teach_params(&params, codes, data, buffer, NULL))
+    {
+      close_entries(data);
+      close_entries(codes);
+      exit(1);
+    }
+
+  if ((ivf = build_ivf_index(codes, lists)) == NULL)
+    {
+      close_entries(data);
+      close_entries(codes);
+      exit(1);
+    }
+
+  name = malloc(strlen(in_code_file) + strlen(ANN_SUFFIX) + 1);
+  if (name == NULL)
+    exit(1);
+  sprintf(name, "%s%s", in_code_file, ANN_SUFFIX);
+  if (save_ivf_index(ivf, name))
+    exit(1);
+  ifverbose(1)
+    fprintf(stderr, "index of %ld lists saved to %s\n", ivf->nlist, name);
+
+  codes->index = ivf;
+  codes->free_index = free_ivf_index;
+
+  if (data)
+    {
+      if (codes->num_entries < ANN_MIN_SIZE)
+	fprintf(stderr, "codebooks smaller than %d are always scanned\n",
+		ANN_MIN_SIZE);
+
+      if (winners(codes, data, find_winner_euc, &exact, &num, &secs) < 0)
+	exit(1);
+      fprintf(stdout, "exact:       %10.0f samples/s\n",
+	      (secs > 0.0) ? num / secs : 0.0);
+
+      for (p = (probes > 0) ? probes : 1; p <= ivf->nlist; p *= 2)
+	{
+	  ann_probes(p);
+	  hits = winners(codes, data, find_winner_ann, &exact, &num, &secs);
+	  fprintf(stdout, "probes %4d: %10.0f samples/s, recall %6.2f %%\n", p,
+		  (secs > 0.0) ? num / secs : 0.0,
+		  (num > 0) ? 100.0 * hits / num : 100.0);
+	  if ((probes > 0) || (hits == num))
+	    break;
+	}
+    }
+
+  free(name);
+  ofree(exact);
+  close_entries(data);
+  close_entries(codes);
+  return 0;
+}
@@ -0,0 +1,129 @@
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  ascii2bin.c (for ascii2bin and bin2ascii)                           *
+ *  -converts data and codebook files between the ASCII and the binary  *
+ *   format                                                             *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvq_pak.h"
+#include "datafile.h"
+#include "binfile.h"
+
+static char *usage[] = {
+  "ascii2bin/bin2ascii - converts data and codebook files between the ASCII\n",
+  "                      and the binary format\n",
+  "The output format is determined from the program name (ascii2bin writes\n",
+  "binary files, bin2ascii ASCII files). The input may be in either format.\n",
+  "Required parameters:\n",
+  "  -din filename         input data or codebook file\n",
+  "  -dout filename        output file\n",
+  "Optional parameters:\n",
+  "  -buffer integer       buffered reading of data, integer lines at a time\n",
+  NULL};
+
+/* save_entries_ascii - saves entries to an ASCII file so that they are
+   read back exactly. Like save_entries but the components are written
+   with as many digits as they need. */
+
+static int save_entries_ascii(struct entries *data, char *out_file)
+{
+  struct file_info *fi;
+  struct data_entry *entry;
+  eptr p;
+  int error = 0;
+
+  if ((fi = open_file(out_file, "w")) == NULL)
+    {
+      fprintf(stderr, "bin2ascii: Can't open file '%s'\n", out_file);
+      return 1;
+    }
+
+  write_header(fi, data);
+  for (entry = rewind_entries(data, &p); entry != NULL; entry = next_entry(&p))
+    write_entry_prec(fi, data, entry, 0);
+
+  if (lvq_errno || ferror(fi->fp))
+    {
+      fprintf(stderr, "bin2ascii: Error converting to file '%s'\n", out_file);
+      error = 1;
+    }
+  if (close_file(fi))
+    error = 1;
+  return error;
+}
+
+int main(int argc, char **argv)
+{
+  char *in_data_file, *out_data_file, *progname;
+  struct entries *data;
+  long buffer;
+  int to_binary, error;
+
+  global_options(argc, argv);
+  if (extract_parameter(argc, argv, "-help", OPTION2))
+    {
+      printhelp();
+      exit(0);
+    }
+
+  progname = getprogname();
+  if (strcasecmp(progname, "ascii2bin") == 0)
+    to_binary = 1;
+  else if (strcasecmp(progname, "bin2ascii") == 0)
+    to_binary = 0;
+  else
+    {
+      fprintf(stderr, "Unknown conversion %s\n", progname);
+      exit(1);
+    }
+
+  in_data_file = extract_parameter(argc, argv, IN_DATA_FILE, ALWAYS);
+  out_data_file = extract_parameter(argc, argv, OUT_DATA_FILE, ALWAYS);
+  buffer = oatoi(extract_parameter(argc, argv, "-buffer", OPTION), 0);
+
+  if (parameters_left())
+    fprintf(stderr, "Extra parameters in command line ignored\n");
+
+  /* every entry is converted, also the ones without labels or with
+     all components masked off */
+  label_not_needed(1);
+
+  ifverbose(2)
+    fprintf(stderr, "Input entries are read from file %s\n", in_data_file);
+  if ((data = open_entries(in_data_file)) == NULL)
+    {
+      fprintf(stderr, "Can't open data file '%s'\n", in_data_file);
+      exit(1);
+    }
+  data->flags.skip_empty = 0;
+  set_buffer(data, buffer);
+
+  ifverbose(2)
+    fprintf(stderr, "Entries are saved to file %s\n", out_data_file);
+  if (to_binary)
+    error = save_entries_bin(data, out_data_file);
+  else
+    error = save_entries_ascii(data, out_data_file);
+
+  close_entries(data);
+  return error;
+}
@@ -192,6 +192,13 @@ struct entries *balance_codes(struct teach_params *teach, char *outfile)
   tlab->next = entr;
   /* laske montako uutta */
 
+  /* put the modified codebook back into one block */
+  if (flatten_entries(codes))
+    {
+      fprintf(stderr, "balance_codes: can't rebuild codebook\n");
+      return NULL;
+    }
+
   ifverbose(1)
     fprintf(stderr, "Codebook vectors are redistributed\n");
 
@@ -270,7 +277,7 @@ int main(int argc, char **argv)
   init_random(randomize);
 
   set_teach_params(&params, codes, data, buffer, funcname);
-  params.winner = find_winner_knn;
+  params.winner = params.knn_winner;
 
   codes = balance_codes(&params, out_code_file);
 
@@ -0,0 +1,817 @@
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  binfile.c                                                           *
+ *   - reading and writing of binary data and codebook files            *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvq_pak.h"
+#include "fileio.h"
+#include "datafile.h"
+#include "labels.h"
+#include "binfile.h"
+#ifndef NO_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif /* NO_MMAP */
+
+/* round a section length up to a multiple of 4 bytes */
+#define PAD4(n) (((n) + 3) & ~3L)
+
+/* number of bytes in the mask of one entry */
+#define MASK_BYTES(dim) (((dim) + 7) / 8)
+
+/* offset of the first chunk in the file */
+#define BIN_DATA_START (BIN_MAGIC_LEN + sizeof(struct bin_header))
+
+/* is_bin_file - tells if the file is a binary file by looking at its
+   first byte. The byte is pushed back so the file can be read from
+   the start in either format. */
+
+int is_bin_file(struct file_info *fi)
+{
+  int c;
+
+  c = getc(fi->fp);
+  if (c == EOF)
+    return 0;
+  ungetc(c, fi->fp);
+
+  return (c == (unsigned char) BIN_MAGIC[0]);
+}
+
+/* get_bin_header - reads the magic and the header of a binary file.
+   Returns a non-zero value on error. */
+
+static int get_bin_header(struct file_info *fi, struct bin_header *hdr)
+{
+  char magic[BIN_MAGIC_LEN];
+
+  if ((fread(magic, 1, BIN_MAGIC_LEN, fi->fp) != BIN_MAGIC_LEN) ||
+      (memcmp(magic, BIN_MAGIC, BIN_MAGIC_LEN) != 0) ||
+      (fread(hdr, sizeof(struct bin_header), 1, fi->fp) != 1))
+    {
+      fprintf(stderr, "Can't read header of binary file %s\n", fi->name);
+      return ERR_HEADER;
+    }
+
+  if (hdr->byteorder != BIN_BYTEORDER)
+    {
+      fprintf(stderr, "Binary file %s has a different byte order\n",
+	      fi->name);
+      return ERR_HEADER;
+    }
+
+  if ((hdr->version < 1) || (hdr->version > BIN_VERSION))
+    {
+      fprintf(stderr, "Binary file %s has unknown version %d\n",
+	      fi->name, hdr->version);
+      return ERR_HEADER;
+    }
+
+  if (hdr->dimension <= 0)
+    {
+      fprintf(stderr, "Can't read dimension parameter in file %s", fi->name);
+      return ERR_HEADER;
+    }
+
+  fi->lineno = 0;
+  return 0;
+}
+
+/* map_file - maps a binary file to memory if it is a regular file.
+   If it can't be mapped, it is read with fread instead. */
+
+static void map_file(struct entries *entries)
+{
+#ifndef NO_MMAP
+  struct bin_info *bin = entries->bin;
+  struct file_info *fi = entries->fi;
+  struct stat st;
+  void *map;
+
+  if (getenv("LVQSOM_NOMMAP") || fi->flags.pipe || (fi->fp == stdin))
+    return;
+
+  if ((fstat(fileno(fi->fp), &st) != 0) || !S_ISREG(st.st_mode) ||
+      (st.st_size < (long) BIN_DATA_START))
+    return;
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(fi->fp), 0);
+  if (map == MAP_FAILED)
+    {
+      ifverbose(2)
+	perror("map_file");
+      return;
+    }
+
+  bin->map = map;
+  bin->map_size = st.st_size;
+  bin->next = BIN_DATA_START;
+  bin->advice = -1;
+#endif /* NO_MMAP */
+}
+
+/* advise - tells the system in which order the mapped file will be
+   used: in the order of the file or, when the entries are shuffled,
+   in random order. */
+
+static void advise(struct entries *entr)
+{
+#ifndef NO_MMAP
+  struct bin_info *bin = entr->bin;
+  int advice = entr->flags.random_order ? MADV_RANDOM : MADV_SEQUENTIAL;
+
+  if (advice != bin->advice)
+    {
+      madvise(bin->map, bin->map_size, advice);
+      bin->advice = advice;
+    }
+#endif /* NO_MMAP */
+}
+
+/* read_bin_header - reads the header of a binary file and sets the
+   entries variables accordingly like read_headers does for ASCII
+   files. Returns a non-zero value on error. */
+
+int read_bin_header(struct entries *entries)
+{
+  struct bin_header hdr;
+  struct bin_info *bin;
+  int error;
+
+  clear_err();
+  if ((error = get_bin_header(entries->fi, &hdr)))
+    return error;
+
+  entries->dimension = hdr.dimension;
+  entries->topol = hdr.topol;
+  entries->neigh = hdr.neigh;
+  entries->xdim = hdr.xdim;
+  entries->ydim = hdr.ydim;
+
+  if ((bin = calloc(1, sizeof(struct bin_info))) == NULL)
+    {
+      perror("read_bin_header");
+      return ERR_NOMEM;
+    }
+  entries->bin = bin;
+  map_file(entries);
+
+  return 0;
+}
+
+/* rewind_bin - go back to the first entry of a binary file. Returns 0
+   on success, error code otherwise. */
+
+int rewind_bin(struct entries *entries)
+{
+  struct bin_header hdr;
+  int error;
+
+  entries->bin->chunk.n = 0;
+  entries->bin->pos = 0;
+
+  if (entries->bin->map)
+    {
+      entries->bin->next = BIN_DATA_START;
+      entries->fi->flags.eof = 0;
+      entries->fi->error = 0;
+      entries->fi->lineno = 0;
+      return 0;
+    }
+
+  if ((error = rewind_file(entries->fi)))
+    return error;
+
+  return get_bin_header(entries->fi, &hdr);
+}
+
+/* free_bin - deallocate the reading state of a binary file and unmap
+   the file. The entries loaded from a mapped file must have been
+   freed first. */
+
+void free_bin(struct entries *entries)
+{
+  struct bin_info *bin = entries->bin;
+
+  if (bin)
+    {
+#ifndef NO_MMAP
+      if (bin->map)
+	munmap(bin->map, bin->map_size);
+#endif /* NO_MMAP */
+      ofree(bin->buf);
+      ofree(bin->labels);
+      free(bin);
+    }
+  entries->bin = NULL;
+}
+
+/* read_chunk - reads the next chunk of a binary file and finds its
+   sections. At the end of the file the eof flag of the file is set.
+   Returns a non-zero value on error. */
+
+static int read_chunk(struct entries *entr)
+{
+  struct bin_info *bin = entr->bin;
+  struct bin_chunk *ch = &bin->chunk;
+  struct file_info *fi = entr->fi;
+  long dim = entr->dimension, off, need, i, nstr;
+  char *s, *end;
+  void *tmp;
+
+  if (bin->map)
+    {
+      /* the chunk is used where it is in the mapping */
+      if (bin->next == (long) BIN_DATA_START)
+	advise(entr);
+      if (bin->next + (long) sizeof(struct bin_chunk) > bin->map_size)
+	goto truncated;
+      memcpy(ch, bin->map + bin->next, sizeof(struct bin_chunk));
+      bin->next += sizeof(struct bin_chunk);
+      if ((ch->n != 0) && (bin->next + ch->size > bin->map_size))
+	goto truncated;
+      bin->data = bin->map + bin->next;
+      bin->next += ch->size;
+    }
+  else if (fread(ch, sizeof(struct bin_chunk), 1, fi->fp) != 1)
+    goto truncated;
+  bin->pos = 0;
+
+  if (ch->n == 0)
+    {
+      /* end of the file */
+      fi->flags.eof = 1;
+      return 0;
+    }
+
+  if ((ch->n < 0) || (ch->size < 0))
+    goto corrupt;
+
+  if (!bin->map)
+    {
+      if (ch->size > bin->size)
+	{
+	  if ((tmp = realloc(bin->buf, ch->size)) == NULL)
+	    {
+	      perror("load_entry");
+	      ch->n = 0;
+	      return ERR_NOMEM;
+	    }
+	  bin->buf = tmp;
+	  bin->size = ch->size;
+	}
+
+      if ((long) fread(bin->buf, 1, ch->size, fi->fp) != ch->size)
+	goto truncated;
+      bin->data = bin->buf;
+    }
+
+  /* find the sections */
+  bin->points = (float *) bin->data;
+  off = PAD4(ch->n * dim * (long) sizeof(float));
+  bin->mask = NULL;
+  bin->weight = bin->fixed = bin->first = bin->labs = NULL;
+
+  if (ch->sections & BIN_MASKS)
+    {
+      bin->mask = (unsigned char *) (bin->data + off);
+      off += PAD4(ch->n * MASK_BYTES(dim));
+    }
+  if (ch->sections & BIN_WEIGHTS)
+    {
+      bin->weight = (int *) (bin->data + off);
+      off += ch->n * sizeof(int);
+    }
+  if (ch->sections & BIN_FIXED)
+    {
+      bin->fixed = (int *) (bin->data + off);
+      off += 2 * ch->n * sizeof(int);
+    }
+  if (ch->sections & BIN_LABELS)
+    {
+      bin->first = (int *) (bin->data + off);
+      off += (ch->n + 1) * sizeof(int);
+      if (off > ch->size)
+	goto corrupt;
+      need = bin->first[ch->n];
+      if ((bin->first[0] != 0) || (need < 0))
+	goto corrupt;
+      for (i = 0; i < ch->n; i++)
+	if (bin->first[i] > bin->first[i + 1])
+	  goto corrupt;
+      bin->labs = (int *) (bin->data + off);
+      off += need * sizeof(int);
+      if (off + (long) sizeof(int) > ch->size)
+	goto corrupt;
+      nstr = *(int *) (bin->data + off);
+      off += sizeof(int);
+      if (nstr < 0)
+	goto corrupt;
+
+      /* the label strings of the chunk */
+      if (nstr > bin->num_labels)
+	{
+	  if ((tmp = realloc(bin->labels, nstr * sizeof(int))) == NULL)
+	    {
+	      perror("load_entry");
+	      ch->n = 0;
+	      return ERR_NOMEM;
+	    }
+	  bin->labels = tmp;
+	}
+      bin->num_labels = nstr;
+      s = bin->data + off;
+      end = bin->data + ch->size;
+      for (i = 0; i < nstr; i++)
+	{
+	  if ((s >= end) || (memchr(s, '\0', end - s) == NULL))
+	    goto corrupt;
+	  if ((bin->labels[i] = find_conv_to_ind(s)) < 0)
+	    {
+	      ch->n = 0;
+	      return ERR_NOMEM;
+	    }
+	  s += strlen(s) + 1;
+	}
+      for (i = 0; i < need; i++)
+	if ((bin->labs[i] < 0) || (bin->labs[i] >= nstr))
+	  goto corrupt;
+    }
+
+  if (off > ch->size)
+    goto corrupt;
+
+  return 0;
+
+ truncated:
+  fprintf(stderr, "load_entry: unexpected end of binary file %s\n",
+	  fi->name);
+  ch->n = 0;
+  return ERR_FILEFORMAT;
+
+ corrupt:
+  fprintf(stderr, "load_entry: corrupted chunk after entry %ld of binary file %s\n",
+	  fi->lineno, fi->name);
+  ch->n = 0;
+  return ERR_FILEFORMAT;
+}
+
+/* load_bin_entry - load_entry for binary files. Loads the next entry
+   of the file to entry or to a new entry if entry is NULL. Returns
+   NULL at the end of the file or on error. Entries are counted in
+   the lineno of the file, so the messages give the number of the
+   entry where the ASCII files give the line. */
+
+struct data_entry *load_bin_entry(struct entries *entr,
+				  struct data_entry *entry)
+{
+  struct bin_info *bin = entr->bin;
+  struct file_info *fi = entr->fi;
+  int dim = entr->dimension;
+  int entry_is_new = !entry;
+  int i, maskcnt, error;
+  long k, row;
+  unsigned char *bits;
+  char *mask;
+  float *w;
+
+  clear_err();
+
+ next_entry:
+  while (bin->pos >= bin->chunk.n)
+    {
+      if (fi->flags.eof)
+	return NULL;
+      if ((error = read_chunk(entr)))
+	{
+	  ERROR(error);
+	  return NULL;
+	}
+    }
+
+  k = bin->pos++;
+  row = ++fi->lineno;
+
+  /* count the masked components */
+  maskcnt = 0;
+  bits = NULL;
+  if (bin->mask)
+    {
+      bits = bin->mask + k * MASK_BYTES(dim);
+      for (i = 0; i < dim; i++)
+	if (bits[i >> 3] & (1 << (i & 7)))
+	  maskcnt++;
+    }
+
+  if (maskcnt == dim)
+    {
+      if (entr->flags.skip_empty)
+	{
+	  ifverbose(3)
+	    fprintf(stderr, "load_entry: skipping entry %ld of file %s, all components are masked off\n", row, fi->name);
+	  goto next_entry;
+	}
+      else
+	ifverbose(3)
+	  fprintf(stderr, "load_entry: loading entry %ld of file %s, all components are masked off\n", row, fi->name);
+    }
+
+  /* new entries of a mapped file get no space for the vector, they
+     point to the mapping */
+  if ((entry == NULL) && bin->map)
+    {
+      if ((entry = calloc(1, sizeof(struct data_entry))) == NULL)
+	{
+	  perror("load_entry");
+	  ERROR(ERR_NOMEM);
+	  return NULL;
+	}
+      entry->lab.label = LABEL_EMPTY;
+      entry->flags.mapped = 1;
+    }
+
+  entry = init_entry(entr, entry);
+  if (entry == NULL)
+    return NULL;
+
+  if (entry->flags.mapped)
+    entry->points = bin->points + k * dim;
+  else
+    memcpy(entry->points, bin->points + k * dim, dim * sizeof(float));
+
+  if (maskcnt)
+    {
+      if ((mask = malloc(MASK_SIZE(dim))) == NULL)
+	{
+	  fprintf(stderr, "load_entry: failed to allocate mask\n");
+	  if (entry_is_new)
+	    free_entry(entry);
+	  ERROR(ERR_NOMEM);
+	  return NULL;
+	}
+      w = mask_weights(mask, dim);
+      for (i = 0; i < dim; i++)
+	{
+	  mask[i] = (bits[i >> 3] >> (i & 7)) & 1;
+	  w[i] = mask[i] ? 0.0 : 1.0;
+	}
+      entry->mask = mask;
+      entry->maskw = w;
+    }
+
+  if (bin->weight)
+    entry->weight = bin->weight[k];
+
+  if (bin->fixed && (bin->fixed[2 * k] >= 0))
+    {
+      if ((entry->fixed = malloc(sizeof(struct fixpoint))) == NULL)
+	{
+	  perror("load_entry");
+	  if (entry_is_new)
+	    free_entry(entry);
+	  ERROR(ERR_NOMEM);
+	  return NULL;
+	}
+      entry->fixed->xfix = bin->fixed[2 * k];
+      entry->fixed->yfix = bin->fixed[2 * k + 1];
+    }
+
+  if (bin->first)
+    for (i = bin->first[k]; i < bin->first[k + 1]; i++)
+      if (add_entry_label(entry, bin->labels[bin->labs[i]]))
+	{
+	  if (entry_is_new)
+	    free_entry(entry);
+	  return NULL;
+	}
+
+  if ((entr->flags.labels_needed) && (entry->num_labs == 0))
+    {
+      fprintf(stderr, "Required label missing on entry %ld of file %s\n",
+	      row, fi->name);
+      if (entry_is_new)
+	free_entry(entry);
+      ERROR(ERR_FILEFORMAT);
+      return NULL;
+    }
+
+  return entry;
+}
+
+ /******************************************************************
+ * Writing                                                         *
+ *******************************************************************/
+
+/* the sections of the chunk being written */
+
+struct bin_writer {
+  long dim, max, n;       /* dimension, entries per chunk, entries now */
+  int sections;           /* sections that have something in them */
+  float *points;
+  unsigned char *mask;
+  int *weight, *fixed, *first;
+  int *labs;              /* labels of the entries in the chunk */
+  long num_labs, max_labs;
+  int *strs;              /* label indices of the strings of the chunk */
+  int nstr;
+  int *local;             /* string of each label index, or -1 */
+  int num_local;
+};
+
+static void free_writer(struct bin_writer *wr)
+{
+  ofree(wr->points);
+  ofree(wr->mask);
+  ofree(wr->weight);
+  ofree(wr->fixed);
+  ofree(wr->first);
+  ofree(wr->labs);
+  ofree(wr->strs);
+  ofree(wr->local);
+}
+
+static int init_writer(struct bin_writer *wr, int dim)
+{
+  memset(wr, 0, sizeof(struct bin_writer));
+  wr->dim = dim;
+  wr->max = BIN_CHUNK_BYTES / (dim * sizeof(float));
+  if (wr->max > BIN_CHUNK)
+    wr->max = BIN_CHUNK;
+  if (wr->max < 1)
+    wr->max = 1;
+
+  wr->points = malloc(wr->max * dim * sizeof(float));
+  wr->mask = malloc(wr->max * MASK_BYTES(dim));
+  wr->weight = malloc(wr->max * sizeof(int));
+  wr->fixed = malloc(2 * wr->max * sizeof(int));
+  wr->first = malloc((wr->max + 1) * sizeof(int));
+  if (!wr->points || !wr->mask || !wr->weight || !wr->fixed || !wr->first)
+    {
+      free_writer(wr);
+      return ERR_NOMEM;
+    }
+  wr->first[0] = 0;
+  return 0;
+}
+
+/* add_label - adds a label to the entry being added to the chunk.
+   Returns non-zero on error. */
+
+static int add_label(struct bin_writer *wr, int label)
+{
+  void *tmp;
+  int i, size;
+
+  if (label >= wr->num_local)
+    {
+      size = number_of_labels() + 1;
+      if (size <= label)
+	size = label + 1;
+      if ((tmp = realloc(wr->local, size * sizeof(int))) == NULL)
+	return ERR_NOMEM;
+      wr->local = tmp;
+      if ((tmp = realloc(wr->strs, size * sizeof(int))) == NULL)
+	return ERR_NOMEM;
+      wr->strs = tmp;
+      for (i = wr->num_local; i < size; i++)
+	wr->local[i] = -1;
+      wr->num_local = size;
+    }
+
+  if (wr->local[label] < 0)
+    {
+      wr->local[label] = wr->nstr;
+      wr->strs[wr->nstr++] = label;
+    }
+
+  if (wr->num_labs >= wr->max_labs)
+    {
+      wr->max_labs += wr->max;
+      if ((tmp = realloc(wr->labs, wr->max_labs * sizeof(int))) == NULL)
+	return ERR_NOMEM;
+      wr->labs = tmp;
+    }
+  wr->labs[wr->num_labs++] = wr->local[label];
+
+  return 0;
+}
+
+/* add_to_chunk - copies an entry to the chunk being written. Returns
+   non-zero on error. */
+
+static int add_to_chunk(struct bin_writer *wr, struct data_entry *entry)
+{
+  long n = wr->n, dim = wr->dim, i;
+  unsigned char *bits = wr->mask + n * MASK_BYTES(dim);
+  float *p = wr->points + n * dim;
+  int label, error;
+
+  memset(bits, 0, MASK_BYTES(dim));
+  for (i = 0; i < dim; i++)
+    if ((entry->mask != NULL) && (entry->mask[i] != 0))
+      {
+	bits[i >> 3] |= 1 << (i & 7);
+	p[i] = 0.0;
+	wr->sections |= BIN_MASKS;
+      }
+    else
+      p[i] = entry->points[i];
+
+  wr->weight[n] = entry->weight;
+  if (entry->weight)
+    wr->sections |= BIN_WEIGHTS;
+
+  if (entry->fixed)
+    {
+      wr->fixed[2 * n] = entry->fixed->xfix;
+      wr->fixed[2 * n + 1] = entry->fixed->yfix;
+      wr->sections |= BIN_FIXED;
+    }
+  else
+    wr->fixed[2 * n] = wr->fixed[2 * n + 1] = -1;
+
+  for (i = 0; (label = get_entry_labels(entry, i)) != LABEL_EMPTY; i++)
+    {
+      if ((error = add_label(wr, label)))
+	return error;
+      wr->sections |= BIN_LABELS;
+    }
+  wr->first[n + 1] = wr->num_labs;
+
+  wr->n++;
+  return 0;
+}
+
+/* write_section - writes len bytes padded to a multiple of 4. If data
+   is NULL, the len bytes have already been written and only the
+   padding is added. */
+
+static int write_section(FILE *fp, void *data, long len)
+{
+  static char zeros[4] = {0, 0, 0, 0};
+
+  if (data && (len > 0) && ((long) fwrite(data, 1, len, fp) != len))
+    return 1;
+  if ((PAD4(len) > len) && (fwrite(zeros, 1, PAD4(len) - len, fp) == 0))
+    return 1;
+  return 0;
+}
+
+/* write_chunk - writes the chunk and starts a new one. Returns
+   non-zero on error. */
+
+static int write_chunk(FILE *fp, struct bin_writer *wr)
+{
+  struct bin_chunk ch;
+  long n = wr->n, dim = wr->dim, size, strbytes, i;
+  int error = 0;
+  char *s;
+
+  ch.n = n;
+  ch.sections = wr->sections;
+  ch.reserved = 0;
+
+  strbytes = 0;
+  for (i = 0; i < wr->nstr; i++)
+    strbytes += strlen(find_conv_to_lab(wr->strs[i])) + 1;
+
+  size = PAD4(n * dim * (long) sizeof(float));
+  if (ch.sections & BIN_MASKS)
+    size += PAD4(n * MASK_BYTES(dim));
+  if (ch.sections & BIN_WEIGHTS)
+    size += n * sizeof(int);
+  if (ch.sections & BIN_FIXED)
+    size += 2 * n * sizeof(int);
+  if (ch.sections & BIN_LABELS)
+    size += (n + 1 + wr->num_labs + 1) * sizeof(int) + PAD4(strbytes);
+  ch.size = size;
+
+  if (fwrite(&ch, sizeof(struct bin_chunk), 1, fp) != 1)
+    return 1;
+  if (n == 0)
+    return 0;
+
+  error |= write_section(fp, wr->points, n * dim * sizeof(float));
+  if (ch.sections & BIN_MASKS)
+    error |= write_section(fp, wr->mask, n * MASK_BYTES(dim));
+  if (ch.sections & BIN_WEIGHTS)
+    error |= write_section(fp, wr->weight, n * sizeof(int));
+  if (ch.sections & BIN_FIXED)
+    error |= write_section(fp, wr->fixed, 2 * n * sizeof(int));
+  if (ch.sections & BIN_LABELS)
+    {
+      error |= write_section(fp, wr->first, (n + 1) * sizeof(int));
+      error |= write_section(fp, wr->labs, wr->num_labs * sizeof(int));
+      error |= write_section(fp, &wr->nstr, sizeof(int));
+      for (i = 0; i < wr->nstr; i++)
+	{
+	  s = find_conv_to_lab(wr->strs[i]);
+	  if (fwrite(s, 1, strlen(s) + 1, fp) != strlen(s) + 1)
+	    error = 1;
+	}
+      error |= write_section(fp, NULL, strbytes);
+    }
+
+  /* start a new chunk */
+  for (i = 0; i < wr->nstr; i++)
+    wr->local[wr->strs[i]] = -1;
+  wr->nstr = 0;
+  wr->num_labs = 0;
+  wr->sections = 0;
+  wr->n = 0;
+
+  return error;
+}
+
+/* save_entries_bin - saves entries to a binary file. The entries are
+   read with rewind_entries and next_entry so that buffered data can be
+   converted too. Returns a non-zero value on error. */
+
+int save_entries_bin(struct entries *codes, char *out_file)
+{
+  struct file_info *fi;
+  struct bin_header hdr;
+  struct bin_writer wr;
+  struct data_entry *entry;
+  eptr p;
+  int error = 0;
+
+  if (init_writer(&wr, codes->dimension))
+    {
+      fprintf(stderr, "save_entries_bin: can't allocate memory\n");
+      return 1;
+    }
+
+  fi = open_file(out_file, "w");
+  if (fi == NULL) {
+    fprintf(stderr, "save_entries_bin: Can't open file '%s'\n", out_file);
+    free_writer(&wr);
+    return 1;
+  }
+
+  memset(&hdr, 0, sizeof(struct bin_header));
+  hdr.byteorder = BIN_BYTEORDER;
+  hdr.version = BIN_VERSION;
+  hdr.dimension = codes->dimension;
+  hdr.topol = codes->topol;
+  hdr.neigh = codes->neigh;
+  hdr.xdim = codes->xdim;
+  hdr.ydim = codes->ydim;
+
+  if ((fwrite(BIN_MAGIC, 1, BIN_MAGIC_LEN, fi->fp) != BIN_MAGIC_LEN) ||
+      (fwrite(&hdr, sizeof(struct bin_header), 1, fi->fp) != 1))
+    {
+      fprintf(stderr, "save_entries_bin: Error writing headers\n");
+      error = 1;
+      goto end;
+    }
+
+  for (entry = rewind_entries(codes, &p); entry != NULL; entry = next_entry(&p))
+    {
+      if (add_to_chunk(&wr, entry))
+	{
+	  fprintf(stderr, "save_entries_bin: can't allocate memory\n");
+	  error = 1;
+	  goto end;
+	}
+      if (wr.n == wr.max)
+	if ((error = write_chunk(fi->fp, &wr)))
+	  break;
+    }
+
+  /* the last entries and the end of the file */
+  if (!error && !lvq_errno && wr.n)
+    error = write_chunk(fi->fp, &wr);
+  if (error || lvq_errno || write_chunk(fi->fp, &wr))
+    {
+      fprintf(stderr, "save_entries_bin: Error writing entry, aborting\n");
+      error = 1;
+    }
+
+ end:
+  if (close_file(fi))
+    error = 1;
+  free_writer(&wr);
+  return error;
+}
@@ -0,0 +1,123 @@
+#ifndef BINFILE_H
+#define BINFILE_H
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  binfile.h                                                           *
+ *   - header file for binfile.c: binary data and codebook files        *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include "lvq_pak.h"
+#include "fileio.h"
+
+/* A binary file starts with BIN_MAGIC and the header below. All
+   fields are 32-bit integers in the byte order of the machine that
+   wrote the file; the byteorder field tells if it is ours. The first
+   byte of the magic can't start a line of an ASCII file, which is how
+   open_entries tells the formats apart. */
+
+#define BIN_MAGIC "\211SOMPAK\n"
+#define BIN_MAGIC_LEN 8
+#define BIN_BYTEORDER 0x01020304
+#define BIN_VERSION 1
+
+struct bin_header {
+  int byteorder;          /* BIN_BYTEORDER */
+  int version;            /* BIN_VERSION */
+  int dimension;
+  int topol, neigh;       /* TOPOL_* and NEIGH_* of the file */
+  int xdim, ydim;
+  int reserved;           /* zero */
+};
+
+/* After the header the entries are stored in chunks of at most
+   BIN_CHUNK entries. A chunk starts with a struct bin_chunk and its
+   payload has the sections below, each padded to a multiple of 4
+   bytes:
+
+     float points[n][dimension]      always, masked components are 0
+     unsigned char mask[n][(dimension + 7) / 8]
+                                     BIN_MASKS, bit i set if component
+				     i is masked off
+     int weight[n]                   BIN_WEIGHTS
+     int fixed[n][2]                 BIN_FIXED, -1 -1 if no fixed point
+     int first[n + 1]                BIN_LABELS, labels of entry i are
+     int labs[first[n]]                labs[first[i] ... first[i+1]-1]
+     int nstr                          number of label strings
+     char strings[]                    nstr NUL-terminated strings,
+				       labs index them from 0
+
+   A chunk with n == 0 ends the file. Because the sections are per
+   chunk, the files can be written and read through pipes and
+   compressed files like the ASCII files. */
+
+#ifndef BIN_CHUNK
+#define BIN_CHUNK 4096
+#endif /* BIN_CHUNK */
+
+/* largest payload of one chunk the writer aims at, in bytes */
+#ifndef BIN_CHUNK_BYTES
+#define BIN_CHUNK_BYTES (4 * 1024 * 1024)
+#endif /* BIN_CHUNK_BYTES */
+
+#define BIN_MASKS   1
+#define BIN_WEIGHTS 2
+#define BIN_FIXED   4
+#define BIN_LABELS  8
+
+struct bin_chunk {
+  int n;                  /* number of entries in the chunk */
+  int sections;           /* BIN_* flags */
+  int size;               /* size of the payload in bytes */
+  int reserved;
+};
+
+/* Binary files that are regular files are mapped to memory. The
+   vectors of the entries then point straight into the mapping and the
+   pages are shared with the other processes reading the same file.
+   The mapping is kept until the entries are closed. Setting the
+   environment variable LVQSOM_NOMMAP turns mapping off. */
+
+/* state of a binary file being read, entries->bin */
+
+struct bin_info {
+  struct bin_chunk chunk; /* current chunk */
+  char *data;             /* its payload */
+  char *buf;              /* space for the payload if not mapped */
+  long size;              /* space allocated for buf */
+  long pos;               /* next entry of the chunk */
+  char *map;              /* the mapped file or NULL */
+  long map_size;
+  long next;              /* offset of the next chunk in the mapping */
+  int advice;             /* the last madvise() hint given */
+  float *points;          /* the sections of the chunk */
+  unsigned char *mask;
+  int *weight, *fixed, *first, *labs;
+  int *labels;            /* label indices of the strings of the chunk */
+  int num_labels;
+};
+
+int is_bin_file(struct file_info *fi);
+int read_bin_header(struct entries *entries);
+int rewind_bin(struct entries *entries);
+void free_bin(struct entries *entries);
+struct data_entry *load_bin_entry(struct entries *entr,
+				  struct data_entry *entry);
+int save_entries_bin(struct entries *codes, char *out_file);
+
+#endif /* BINFILE_H */
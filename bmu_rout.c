@@ -0,0 +1,388 @@
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  bmu_rout.c                                                          *
+ *   - batched winner search. The distances of a block of samples to    *
+ *     the codebook are computed as |x|^2 - 2 x.c + |c|^2, where the    *
+ *     dot products come from a cache blocked matrix multiplication.    *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include "lvq_pak.h"
+#include "datafile.h"
+#include "vec_rout.h"
+#include "bmu_rout.h"
+#include "prune_rout.h"
+
+/* make_code_panels - arrange a flat codebook for the batched search.
+   Returns NULL on error. */
+
+struct code_panels *make_code_panels(struct entries *codes)
+{
+  struct code_panels *cp;
+  long noc = codes->num_entries, npanels, i, j;
+  int dim = codes->dimension, d;
+  unsigned long addr;
+  double sum, *mean;
+  float *c, *p, x;
+
+  if (codes->block == NULL)
+    {
+      fprintf(stderr, "make_code_panels: codebook is not flat\n");
+      return NULL;
+    }
+
+  npanels = (noc + TILE_COLS - 1) / TILE_COLS;
+
+  cp = malloc(sizeof(struct code_panels));
+  mean = calloc(dim, sizeof(double));
+  if (cp != NULL)
+    cp->mem = calloc((npanels * TILE_COLS * (dim + 1) + dim) * sizeof(float)
+		     + BLOCK_ALIGN, 1);
+  if ((cp == NULL) || (mean == NULL) || (cp->mem == NULL))
+    {
+      fprintf(stderr, "make_code_panels: can't allocate memory\n");
+      if (cp)
+	ofree(cp->mem);
+      ofree(cp);
+      ofree(mean);
+      ERROR(ERR_NOMEM);
+      return NULL;
+    }
+
+  addr = (unsigned long) cp->mem;
+  addr = (addr + BLOCK_ALIGN - 1) & ~((unsigned long) BLOCK_ALIGN - 1);
+  cp->panel = (float *) addr;
+  cp->norm = cp->panel + npanels * TILE_COLS * dim;
+  cp->mean = cp->norm + npanels * TILE_COLS;
+  cp->noc = noc;
+  cp->dim = dim;
+  cp->npanels = npanels;
+  cp->maxnorm = 0.0;
+
+  /* center the vectors around their mean to keep the rounding errors
+     of the dot products small */
+  for (i = 0; i < noc; i++)
+    for (c = block_row(codes, i), d = 0; d < dim; d++)
+      mean[d] += c[d];
+  for (d = 0; d < dim; d++)
+    cp->mean[d] = (noc > 0) ? mean[d] / noc : 0.0;
+
+  for (i = 0; i < npanels * TILE_COLS; i++)
+    {
+      p = cp->panel + (i / TILE_COLS) * TILE_COLS * dim + (i % TILE_COLS);
+      if (i >= noc)
+	{
+	  /* unused places of the last panel never win */
+	  cp->norm[i] = FLT_MAX;
+	  continue;
+	}
+
+      c = block_row(codes, i);
+      for (sum = 0.0, d = 0, j = 0; d < dim; d++, j += TILE_COLS)
+	{
+	  x = c[d] - cp->mean[d];
+	  p[j] = x;
+	  sum += (double) x * x;
+	}
+      cp->norm[i] = sum;
+      if (cp->norm[i] > cp->maxnorm)
+	cp->maxnorm = cp->norm[i];
+    }
+
+  free(mean);
+  return cp;
+}
+
+void free_code_panels(struct code_panels *cp)
+{
+  if (cp)
+    {
+      ofree(cp->mem);
+      free(cp);
+    }
+}
+
+/* exact_dist2 - the distance of the winner is computed again the same
+   way as the winner function would do it, so that the results do not
+   depend on whether the batched search was used */
+
+static float exact_dist2(float *c, float *s, int dim, WINNER_FUNCTION *winner)
+{
+  float diff, difference = 0.0;
+
+  if (winner == find_winner_simd)
+    return current_kernels()->dist2(c, s, dim);
+
+  while (dim-- > 0)
+    {
+      diff = *c++ - *s++;
+      difference += diff * diff;
+    }
+  return difference;
+}
+
+/* find_winners_block - find the winners of n samples. The results are
+   the same as from winner() with knn == 1, which is used for masked
+   samples and for the samples whose two best distances are too close
+   to be told apart from the rounding errors of the decomposition.
+   win[i].index is -1 if winner() didn't find a winner. If lower is not
+   NULL, lower[i] gets a lower bound of the distances from the sample to
+   the other codebook vectors (0 if winner() was used). Returns non-zero
+   on error. */
+
+int find_winners_block(struct code_panels *cp, struct entries *codes,
+		       struct data_entry **samples, long n,
+		       struct winner_info *win, double *lower,
+		       WINNER_FUNCTION *winner)
+{
+  ROW_TILE *tile = current_kernels()->tile;
+  int dim = cp->dim, d, r, j;
+  long b, nb, ng, g, i, pn, p0, p1, chunk, bidx[SAMPLE_BLOCK];
+  float *xbuf, *x, *o, *norm, dist, tol;
+  float out[TILE_ROWS * TILE_COLS];
+  float xnorm[SAMPLE_BLOCK], best[SAMPLE_BLOCK], second[SAMPLE_BLOCK];
+  char skip[SAMPLE_BLOCK];
+  struct data_entry *s;
+
+  xbuf = malloc(SAMPLE_BLOCK * (dim > 0 ? dim : 1) * sizeof(float));
+  if (xbuf == NULL)
+    {
+      fprintf(stderr, "find_winners_block: can't allocate memory\n");
+      ERROR(ERR_NOMEM);
+      return 1;
+    }
+
+  chunk = PANEL_BYTES / (TILE_COLS * (dim > 0 ? dim : 1) * sizeof(float));
+  if (chunk < 1)
+    chunk = 1;
+
+  for (b = 0; b < n; b += SAMPLE_BLOCK)
+    {
+      nb = (n - b < SAMPLE_BLOCK) ? n - b : SAMPLE_BLOCK;
+      ng = (nb + TILE_ROWS - 1) / TILE_ROWS;
+
+      /* centered copies of the samples */
+      for (i = 0; i < ng * TILE_ROWS; i++)
+	{
+	  x = xbuf + i * dim;
+	  best[i] = second[i] = FLT_MAX;
+	  bidx[i] = -1;
+	  xnorm[i] = 0.0;
+	  skip[i] = (i >= nb) || (samples[b + i]->mask != NULL);
+	  if (skip[i])
+	    {
+	      memset(x, 0, dim * sizeof(float));
+	      continue;
+	    }
+	  for (d = 0; d < dim; d++)
+	    {
+	      x[d] = samples[b + i]->points[d] - cp->mean[d];
+	      xnorm[i] += x[d] * x[d];
+	    }
+	}
+
+      /* go through the codebook a part at a time so that the part
+	 stays in the cache for the whole block of samples */
+      for (p0 = 0; p0 < cp->npanels; p0 = p1)
+	{
+	  p1 = (p0 + chunk < cp->npanels) ? p0 + chunk : cp->npanels;
+	  for (g = 0; g < ng; g++)
+	    for (pn = p0; pn < p1; pn++)
+	      {
+		tile(xbuf + g * TILE_ROWS * dim, dim,
+		     cp->panel + pn * TILE_COLS * dim, dim, out);
+		norm = cp->norm + pn * TILE_COLS;
+		for (r = 0; r < TILE_ROWS; r++)
+		  {
+		    i = g * TILE_ROWS + r;
+		    o = out + r * TILE_COLS;
+		    for (j = 0; j < TILE_COLS; j++)
+		      {
+			/* |x|^2 is the same for all and is left out */
+			dist = norm[j] - 2.0 * o[j];
+			if (dist < second[i])
+			  {
+			    if (dist < best[i])
+			      {
+				second[i] = best[i];
+				best[i] = dist;
+				bidx[i] = pn * TILE_COLS + j;
+			      }
+			    else
+			      second[i] = dist;
+			  }
+		      }
+		  }
+	      }
+	}
+
+      for (i = 0; i < nb; i++)
+	{
+	  s = samples[b + i];
+	  tol = 2.0 * (dim + 2) * FLT_EPSILON * (xnorm[i] + cp->maxnorm);
+	  if (skip[i] || (bidx[i] < 0) || (second[i] - best[i] <= tol))
+	    {
+	      if (winner(codes, s, &win[b + i], 1) == 0)
+		win[b + i].index = -1;
+	      if (lower != NULL)
+		lower[b + i] = 0.0;
+	      continue;
+	    }
+	  win[b + i].index = bidx[i];
+	  win[b + i].winner = &codes->units[bidx[i]];
+	  win[b + i].diff = exact_dist2(block_row(codes, bidx[i]), s->points,
+					dim, winner);
+	  if (lower != NULL)
+	    {
+	      /* the decomposition errs at most tol */
+	      dist = second[i] + xnorm[i] - tol;
+	      lower[b + i] = (second[i] == FLT_MAX) ? DBL_MAX :
+		(dist > 0.0) ? sqrt(dist) : 0.0;
+	    }
+	}
+    }
+
+  free(xbuf);
+  return 0;
+}
+
+/* batchable - the winner functions that find the nearest codebook
+   vector in euclidean metric */
+
+static int batchable(WINNER_FUNCTION *winner)
+{
+  return ((winner == find_winner_euc) || (winner == find_winner_euc2) ||
+	  (winner == find_winner_knn) || (winner == find_winner_knn2) ||
+	  (winner == find_winner_simd) || (winner == find_winner_prune));
+}
+
+/* batch_winners - find the winners of all samples of a data set in
+   advance. Returns NULL if the batched search can't be used: the data
+   is read in buffered mode, the codebook is not flat or the winner
+   function is not an euclidean one. Setting the environment variable
+   LVQSOM_NOBATCH turns the batched search off. */
+
+struct winner_batch *batch_winners(struct entries *codes,
+				   struct entries *data,
+				   WINNER_FUNCTION *winner)
+{
+  struct winner_batch *batch;
+  struct code_panels *cp;
+  struct data_entry *dtmp;
+  long n;
+  eptr p;
+
+  if (getenv("LVQSOM_NOBATCH") || !batchable(winner) ||
+      (codes->block == NULL) || (data->flags.loadmode != LOADMODE_ALL))
+    return NULL;
+
+  if ((dtmp = rewind_entries(data, &p)) == NULL)
+    return NULL;
+
+  /* loading the data might have failed or changed the mode */
+  if (data->flags.loadmode != LOADMODE_ALL)
+    return NULL;
+
+  for (n = 0; dtmp != NULL; dtmp = next_entry(&p))
+    n++;
+
+  batch = malloc(sizeof(struct winner_batch));
+  if (batch == NULL)
+    return NULL;
+  batch->num = n;
+  batch->next = 0;
+  batch->samples = malloc((n > 0 ? n : 1) * sizeof(struct data_entry *));
+  batch->win = malloc((n > 0 ? n : 1) * sizeof(struct winner_info));
+  if ((batch->samples == NULL) || (batch->win == NULL))
+    {
+      free_winner_batch(batch);
+      return NULL;
+    }
+
+  for (n = 0, dtmp = rewind_entries(data, &p); dtmp != NULL;
+       dtmp = next_entry(&p))
+    batch->samples[n++] = dtmp;
+
+  ifverbose(2)
+    fprintf(stderr, "batched winner search for %ld samples\n", n);
+
+  if ((cp = make_code_panels(codes)) == NULL)
+    {
+      free_winner_batch(batch);
+      return NULL;
+    }
+
+  /* the bounds of the pruned search are of no use in one pass */
+  if (winner == find_winner_prune)
+    winner = find_winner_euc;
+
+  if (find_winners_block(cp, codes, batch->samples, n, batch->win, NULL,
+			 winner))
+    {
+      free_code_panels(cp);
+      free_winner_batch(batch);
+      return NULL;
+    }
+
+  free_code_panels(cp);
+  return batch;
+}
+
+/* batch_winner - get the winner of a sample. The winners are taken
+   from the batch as long as the samples come in the same order as they
+   are in the data; other samples (or batch == NULL) are handled with
+   winner(). Returns like the winner functions. */
+
+int batch_winner(struct winner_batch *batch, struct entries *codes,
+		 struct data_entry *sample, struct winner_info *win,
+		 WINNER_FUNCTION *winner)
+{
+  long i;
+
+  if (batch != NULL)
+    {
+      /* the data may have been rewound */
+      if ((batch->num > 0) && (batch->samples[0] == sample))
+	batch->next = 0;
+
+      i = batch->next;
+      if ((i < batch->num) && (batch->samples[i] == sample))
+	{
+	  batch->next++;
+	  *win = batch->win[i];
+	  return (win->index >= 0);
+	}
+    }
+
+  return winner(codes, sample, win, 1);
+}
+
+void free_winner_batch(struct winner_batch *batch)
+{
+  if (batch)
+    {
+      ofree(batch->samples);
+      ofree(batch->win);
+      free(batch);
+    }
+}
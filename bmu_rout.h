@@ -0,0 +1,77 @@
+#ifndef BMU_ROUT_H
+#define BMU_ROUT_H
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  bmu_rout.h                                                          *
+ *   - header file for bmu_rout.c: batched winner search                *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include "lvq_pak.h"
+
+/* number of samples handled together and the amount of codebook (in
+   bytes) scanned for each block of samples */
+
+#ifndef SAMPLE_BLOCK
+#define SAMPLE_BLOCK 64
+#endif /* SAMPLE_BLOCK */
+
+#ifndef PANEL_BYTES
+#define PANEL_BYTES (128 * 1024)
+#endif /* PANEL_BYTES */
+
+/* codebook arranged for the batched search. The vectors are centered
+   around their mean and stored in panels of TILE_COLS vectors, one
+   component at a time. */
+
+struct code_panels {
+  long noc;           /* number of codebook vectors */
+  int dim;
+  long npanels;       /* number of panels */
+  float *panel;       /* the panels, aligned to BLOCK_ALIGN */
+  float *norm;        /* squared norms of the centered vectors */
+  float *mean;        /* mean of the codebook vectors */
+  float maxnorm;      /* largest of the norms */
+  void *mem;
+};
+
+/* winners of the samples of a data set, computed in advance */
+
+struct winner_batch {
+  long num;                     /* number of samples */
+  long next;                    /* the sample expected next */
+  struct data_entry **samples;
+  struct winner_info *win;
+};
+
+struct code_panels *make_code_panels(struct entries *codes);
+void free_code_panels(struct code_panels *cp);
+int find_winners_block(struct code_panels *cp, struct entries *codes,
+		       struct data_entry **samples, long n,
+		       struct winner_info *win, double *lower,
+		       WINNER_FUNCTION *winner);
+
+struct winner_batch *batch_winners(struct entries *codes,
+				   struct entries *data,
+				   WINNER_FUNCTION *winner);
+int batch_winner(struct winner_batch *batch, struct entries *codes,
+		 struct data_entry *sample, struct winner_info *win,
+		 WINNER_FUNCTION *winner);
+void free_winner_batch(struct winner_batch *batch);
+
+#endif /* BMU_ROUT_H */
@@ -24,6 +24,7 @@
 #include <float.h>
 #include "lvq_pak.h"
 #include "datafile.h"
+#include "bmu_rout.h"
 
 static char *usage[] = {
   "classify - finds out the classifications against a given codebook\n",
@@ -49,6 +50,7 @@ int compute_classifications(struct teach_params *teach,
   struct entries *codes = teach->codes;
   WINNER_FUNCTION *find_winner = teach->winner;
   struct winner_info win;
+  struct winner_batch *batch;
   eptr p;
 
   if ((datatmp = rewind_entries(data, &p)) == NULL)
@@ -60,10 +62,13 @@ int compute_classifications(struct teach_params *teach,
   /* Number of data vectors */
   noc = data->flags.totlen_known ? data->num_entries : 0;
 
+  /* find the winners all at once if the data is in memory */
+  batch = batch_winners(codes, data, find_winner);
+
   /* Scan all input entries */
   while (datatmp != NULL) {
 
-    if (find_winner(codes, datatmp, &win, 1) == 0)
+    if (batch_winner(batch, codes, datatmp, &win, find_winner) == 0)
       {
 	/* no winner found, all components of sample masked off */
 	label = find_conv_to_ind("# empty datavector");
@@ -86,6 +91,7 @@ int compute_classifications(struct teach_params *teach,
       if (noc)
 	mprint((long) noc--);
   }
+  free_winner_batch(batch);
   ifverbose(1)
     {
       mprint((long) 0);
@@ -24,6 +24,7 @@
 #include <float.h>
 #include "lvq_pak.h"
 #include "datafile.h"
+#include "bmu_rout.h"
 #include "lvq_rout.h"
 #include "labels.h"
 
@@ -48,6 +49,7 @@ int compute_cmatr(struct teach_params *teach, FILE *ocf)
   struct entries *data = teach->data;
   struct entries *codes = teach->codes;
   struct winner_info win;
+  struct winner_batch *batch;
   struct hitlist *correct, *totals, *confuzion;
   struct hit_entry *he, *he2;
   eptr p;
@@ -76,12 +78,15 @@ int compute_cmatr(struct teach_params *teach, FILE *ocf)
   dtmp = rewind_entries(data, &p);
   noc = data->flags.totlen_known ? data->num_entries : 0;
 
+  /* find the winners all at once if the data is in memory */
+  batch = batch_winners(codes, data, find_winner);
+
   /* Scan all input entries */
   while (dtmp != NULL) {
 
     datalabel = get_entry_label(dtmp);
 
-    if (find_winner(codes, dtmp, &win, 1) == 0)
+    if (batch_winner(batch, codes, dtmp, &win, find_winner) == 0)
       {
 	/* invalid data vector */
       }
@@ -122,6 +127,7 @@ int compute_cmatr(struct teach_params *teach, FILE *ocf)
       if (noc)
 	mprint((long) noc--);
   }
+  free_winner_batch(batch);
 
   ifverbose(1)
     {
@@ -192,6 +198,7 @@ int main(int argc, char **argv)
   out_classification_file = 
 	extract_parameter(argc, argv, OUT_CLASSIFICATION_FILE, OPTION);
   buffer = oatoi(extract_parameter(argc, argv, "-buffer", OPTION), 0);
+  funcname = extract_parameter(argc, argv, "-selfuncs", OPTION);
 
   ifverbose(2)
     fprintf(stderr, "Input entries are read from file %s\n", in_data_file);
@@ -67,11 +67,21 @@
 /* No saving snapshots in the background (no fork) */
 #define NO_BACKGROUND_SNAP
 
+/* No POSIX threads, all work is done in one thread */
+#define NO_THREADS
+
+/* No memory mapped files, binary files are read with fread */
+#define NO_MMAP
+
 /* Borland C doesn't have strcasecmp but has the function strcmpi that
    does the same thing */
 
 #define strcasecmp(s1,s2) strcmpi(s1,s2)
 
+/* nor getc_unlocked, the plain getc is used instead */
+
+#define getc_unlocked(fp) getc(fp)
+
 #endif /* MSDOS */
 
 /* definitions needed to get the program name in various environments */
@@ -23,9 +23,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "lvq_pak.h"
 #include "fileio.h"
 #include "datafile.h"
+#include "binfile.h"
+#include "vec_rout.h"
+#include "tree_rout.h"
+#include "prune_rout.h"
+#include "ann_rout.h"
+#include "quant_rout.h"
 
 /* open_data_file - opens a data file for reading. Returns a pointer to 
    entries-structure or NULL on error. If name is NULL, just allocates 
@@ -75,13 +82,23 @@ struct entries *alloc_entries(void)
   en->num_loaded = 0;
   en->num_entries = 0;
   en->fi = NULL;
+  en->bin = NULL;
   en->lap = 0;
+  en->rand_state = 0;
   en->buffer = 0;
   en->flags.loadmode = LOADMODE_ALL;
   en->flags.totlen_known = 0;
   en->flags.random_order = 0;
   en->flags.skip_empty = 1;
   en->flags.labels_needed = (!label_not_needed(-1));
+  en->block = NULL;
+  en->stride = 0;
+  en->units = NULL;
+  en->block_mem = NULL;
+  en->slot = NULL;
+  en->unit_of = NULL;
+  en->index = NULL;
+  en->free_index = NULL;
   return en;
 }
 
@@ -185,19 +202,37 @@ int rewind_datafile(struct file_info *fi)
   return skip_headers(fi);
 }
 	 
+/* close_datafile - closes the file of entries and frees the reading
+   state of a binary file. */
+
+static void close_datafile(struct entries *entries)
+{
+  /* the entries of a mapped file point to the mapping */
+  if (!(entries->bin && entries->bin->map))
+    free_bin(entries);
+  close_file(entries->fi);
+  entries->fi = NULL;
+}
+
 /* open_entries - open a data file. Returns a pointer to a ready-to-use 
-   entries -structure. Return NULL on error. */
+   entries -structure. Both ASCII and binary files are accepted, see
+   binfile.c. Return NULL on error. */
 
 struct entries *open_entries(char *name)
 {
   struct entries *entries;
+  int error;
   
   /* open file */
   if ((entries = open_data_file(name)) == NULL)
     return NULL;
 
   /* read headers */
-  if (read_headers(entries))
+  if (is_bin_file(entries->fi))
+    error = read_bin_header(entries);
+  else
+    error = read_headers(entries);
+  if (error)
     {
       close_entries(entries);
       return NULL;
@@ -216,10 +251,12 @@ void close_entries(struct entries *entries)
       /* deallocate data */
       if (entries->entries)
 	free_entrys(entries->entries);
+      free_block(entries);
       
       /* close file */
       if (entries->fi)
-	close_file(entries->fi);
+	close_datafile(entries);
+      free_bin(entries);
 
       /* free memory allocated for structure */
       free(entries);
@@ -307,8 +344,7 @@ struct entries *read_entries(struct entries *entries)
     {
       entries->num_entries = noc;
       entries->flags.totlen_known = 1;
-      close_file(entries->fi);
-      entries->fi = NULL;
+      close_datafile(entries);
     }
   else 
     {
@@ -328,8 +364,7 @@ struct entries *read_entries(struct entries *entries)
 	  if (noc == entries->num_entries)
 	    {
 	      fprintf(stderr, "read_entries: file %s; size less than buffer size, switching buffering off\n", fi->name);
-	      close_file(entries->fi);
-	      entries->fi = NULL;
+	      close_datafile(entries);
 	      entries->flags.loadmode = LOADMODE_ALL;
 	    }
 	}
@@ -419,16 +454,41 @@ int write_header(struct file_info *fi, struct entries *codes)
 
 int write_entry(struct file_info *fi, struct entries *entr, 
 		struct data_entry *entry)
+{
+  return write_entry_prec(fi, entr, entry, 6);
+}
+
+/* write_entry_prec - write_entry with 'digits' significant digits in
+   the components. With 9 digits the floats are read back exactly. If
+   digits is 0, each component is written with the fewest digits that
+   still read back exactly. */
+
+int write_entry_prec(struct file_info *fi, struct entries *entr, 
+		     struct data_entry *entry, int digits)
 {
   FILE *fp = fi2fp(fi);
-  int i, label;
+  int i, label, prec;
+  char buf[32];
+  float back;
 
   /* write vector */
   for (i = 0; i < entr->dimension; i++) 
     if ((entry->mask != NULL) && (entry->mask[i] != 0 ))
       fprintf(fp, "%s ", masked_string);
+    else if (digits > 0)
+      fprintf(fp, "%.*g ", digits, entry->points[i]);
     else
-      fprintf(fp, "%g ", entry->points[i]);
+      {
+	for (prec = 6; prec < 9; prec++)
+	  {
+	    sprintf(buf, "%.*g", prec, entry->points[i]);
+	    if ((sscanf(buf, "%f", &back) == 1) && (back == entry->points[i]))
+	      break;
+	  }
+	if (prec == 9)
+	  sprintf(buf, "%.9g", entry->points[i]);
+	fprintf(fp, "%s ", buf);
+      }
  
 
   /* Write labels. The last label is empty */
@@ -440,6 +500,12 @@ int write_entry(struct file_info *fi, struct entries *entr,
       else
 	break;
     }
+
+  /* weight and fixed point, if they were given in the input */
+  if (entry->weight)
+    fprintf(fp, "weight=%d ", entry->weight);
+  if (entry->fixed)
+    fprintf(fp, "fixed=%d,%d ", entry->fixed->xfix, entry->fixed->yfix);
   fprintf(fp, "\n");
   
   /* Some kind of error checking could be added ... */
@@ -466,8 +532,11 @@ struct data_entry *init_entry(struct entries *entr, struct data_entry *entry)
       entry->fixed = NULL;
       entry->next = NULL;
       entry->mask = NULL;
+      entry->maskw = NULL;
       entry->lab.label_array = NULL;
       entry->num_labs = 0;
+      entry->flags.in_block = 0;
+      entry->flags.mapped = 0;
 
       entry->points = calloc(entr->dimension, sizeof(float));
       if (entry->points == NULL)
@@ -484,6 +553,7 @@ struct data_entry *init_entry(struct entries *entr, struct data_entry *entry)
     {
       free(entry->mask);
       entry->mask = NULL;
+      entry->maskw = NULL;
     }
 
   /* discard fixed point */
@@ -495,17 +565,32 @@ struct data_entry *init_entry(struct entries *entr, struct data_entry *entry)
   
   clear_entry_labels(entry);
   entry->weight = 0;
+  entry->bmu = -1;
 
   return entry;
 }
 
-/* free_entry - deallocates a data_entry. */
+/* free_entry - deallocates a data_entry. Entries that belong to the
+   flat block of a codebook only release their masks, fixed points and
+   labels; the block itself is freed with free_block. */
 
 void free_entry(struct data_entry *entry)
 {
+  if (entry && entry->flags.in_block)
+    {
+      ofree(entry->fixed);
+      entry->fixed = NULL;
+      ofree(entry->mask);
+      entry->mask = NULL;
+      entry->maskw = NULL;
+      clear_entry_labels(entry);
+      entry->next = NULL;
+      return;
+    }
+
   if (entry)
     {
-      if (entry->points)
+      if (entry->points && !entry->flags.mapped)
 	free(entry->points);
       if (entry->fixed)
 	free(entry->fixed);
@@ -516,15 +601,19 @@ void free_entry(struct data_entry *entry)
     }
 }
 
-/* set_mask - sets a value in mask */
+/* set_mask - sets a value in mask. The weight vector that follows the
+   mask is kept up to date at the same time. */
 
 static char *set_mask(char *mask, int dim, int n)
 {
+  float *w;
+  int i;
+
   clear_err();
 
   if (mask == NULL)
     {
-      mask = malloc(dim);
+      mask = malloc(MASK_SIZE(dim));
       if (mask == NULL)
 	{
 	  fprintf(stderr, "set_mask: failed to allocate mask\n");
@@ -533,10 +622,16 @@ static char *set_mask(char *mask, int dim, int n)
 	  return NULL;
 	}
       memset(mask, 0, dim);
+      w = mask_weights(mask, dim);
+      for (i = 0; i < dim; i++)
+	w[i] = 1.0;
     }
 
   if (n >= 0)
-    mask[n] = 1;
+    {
+      mask[n] = 1;
+      mask_weights(mask, dim)[n] = 0.0;
+    }
   return mask;
 }
   
@@ -545,6 +640,209 @@ static char *set_mask(char *mask, int dim, int n)
 
 char *masked_string = MASKED_VALUE;
 
+/* Lines of data files are parsed in one pass: the components are read
+   with parse_float where they are and only tokens it can't handle are
+   cut out and given to sscanf as before. */
+
+static char is_separator[256];
+static int separators_set = 0;
+
+static void set_separators(void)
+{
+  char *s;
+
+  for (s = SEPARATOR_CHARS; *s; s++)
+    is_separator[(unsigned char) *s] = 1;
+  separators_set = 1;
+}
+
+#define SEPARATOR(c) (is_separator[(unsigned char) (c)])
+#define TOKEN_END(c) (((c) == '\0') || SEPARATOR(c))
+
+/* skip_separators - returns a pointer to the next token or to the end
+   of the line */
+
+static char *skip_separators(char *s)
+{
+  while (SEPARATOR(*s))
+    s++;
+  return s;
+}
+
+/* next_token - like strtok: returns the next token of the line and
+   terminates it, pos is set after it. Returns NULL at the end of the
+   line. */
+
+static char *next_token(char **pos)
+{
+  char *s = skip_separators(*pos), *t;
+
+  if (*s == '\0')
+    {
+      *pos = s;
+      return NULL;
+    }
+
+  for (t = s; !TOKEN_END(*t); t++)
+    ;
+  if (*t)
+    *t++ = '\0';
+  *pos = t;
+  return s;
+}
+
+/* exact powers of ten in double precision */
+
+static double pow10_table[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* Up to MAX_FAST_DIGITS significant digits are collected in an
+   unsigned long; they must fit in it and in a double exactly */
+#if ULONG_MAX > 0xffffffffUL
+#define MAX_FAST_DIGITS 15
+#else
+#define MAX_FAST_DIGITS 9
+#endif
+#define MAX_FAST_EXP 22        /* largest exact power of ten */
+
+#define DIGIT(c) ((unsigned) ((c) - '0') < 10)
+
+/* read_digits - adds the decimal digits at s to the end of *m. Returns
+   the number of digits. *m is garbage if there are more digits than
+   fit in it. */
+
+static int read_digits(char *s, unsigned long *m)
+{
+  char *t;
+
+  for (t = s; DIGIT(*s); s++)
+    *m = *m * 10 + (*s - '0');
+  return s - t;
+}
+
+/* parse_float - reads a decimal number from the start of s into *value
+   and sets *end after it. Only plain numbers (sign, digits, point,
+   exponent) that end at a separator are handled, and only when the
+   result is sure to be what sscanf("%f") gives, i.e. the correctly
+   rounded float. The number is computed in double precision with one
+   rounding (the mantissa and the power of ten are exact). Rounding
+   that double to float gives the correctly rounded float too, except
+   when the double falls exactly halfway between two floats. Returns 0
+   when the number should be read with sscanf instead. */
+
+static int parse_float(char *s, char **end, float *value)
+{
+  unsigned long m = 0;
+  double d, g;
+  int neg = 0, digits = 0, sig, n, exp = 0, eneg = 0, e = 0;
+  char *t;
+  float f;
+
+  if (*s == '-')
+    {
+      neg = 1;
+      s++;
+    }
+  else if (*s == '+')
+    s++;
+
+  /* integer part, leading zeros are not significant */
+  for (t = s; *s == '0'; s++)
+    ;
+  digits = s - t;
+  sig = read_digits(s, &m);
+  s += sig;
+
+  /* fraction */
+  if (*s == '.')
+    {
+      s++;
+      if (m == 0)
+	{
+	  for (t = s; *s == '0'; s++)
+	    ;
+	  exp -= s - t;
+	  digits += s - t;
+	}
+      n = read_digits(s, &m);
+      s += n;
+      exp -= n;
+      sig += n;
+    }
+
+  if (sig > MAX_FAST_DIGITS)
+    return 0;
+  if (digits + sig == 0)
+    return 0;
+
+  /* exponent */
+  if ((*s == 'e') || (*s == 'E'))
+    {
+      s++;
+      if (*s == '-')
+	{
+	  eneg = 1;
+	  s++;
+	}
+      else if (*s == '+')
+	s++;
+      if (!DIGIT(*s))
+	return 0;
+      for (; DIGIT(*s); s++)
+	if (e < 1000)
+	  e = e * 10 + (*s - '0');
+      exp += eneg ? -e : e;
+    }
+
+  if (!TOKEN_END(*s))
+    return 0;
+
+  if (m == 0)
+    f = 0.0;
+  else
+    {
+      if ((exp < -MAX_FAST_EXP) || (exp > MAX_FAST_EXP))
+	return 0;
+      d = (double) m;
+      d = (exp < 0) ? d / pow10_table[-exp] : d * pow10_table[exp];
+      f = (float) d;
+
+      /* if d is halfway between f and the next float g, then 2d - f == g
+	 exactly; otherwise 2d - f is not a float */
+      if ((double) f != d)
+	{
+	  g = 2.0 * d - (double) f;
+	  if ((double) (float) g == g)
+	    return 0;
+	}
+    }
+
+  *value = neg ? -f : f;
+  *end = s;
+  return 1;
+}
+
+/* read_component - reads the vector component at *pos to *value and
+   sets *pos after it. Returns non-zero if it can't be read. */
+
+static int read_component(char **pos, float *value)
+{
+  char *s = *pos, *t;
+
+  if (parse_float(s, pos, value))
+    return 0;
+
+  /* not a plain number: give the token to sscanf */
+  for (t = s; !TOKEN_END(*t); t++)
+    ;
+  if (*t)
+    *t++ = '\0';
+  *pos = t;
+
+  return (sscanf(s, "%f", value) <= 0);
+}
+
 /* load_entry - loads one data_entry from file associated with entr. If 
    entry is non-NULL, an old data_entry is reused, otherwise a new entry 
    is allocated. Returns NULL on error. */
@@ -554,17 +852,28 @@ struct data_entry *load_entry(struct entries *entr, struct data_entry *entry)
   int i;
   float ent;
   char lab[STR_LNG];
-  char *toke, *line;
+  char *toke, *line, *pos;
   long row;
-  int dim, label_found;
+  int dim, label_found, masklen;
   int entry_is_new = !entry;
   char *mask = NULL;
   int maskcnt;  /* now many components are masked */
   struct file_info *fi = entr->fi;
   dim = entr->dimension;
 
+  if (entr->bin)
+    return load_bin_entry(entr, entry);
+
   clear_err();
 
+  if (!separators_set)
+    set_separators();
+
+  /* a mask string with separators in it can't match a token */
+  masklen = strlen(masked_string);
+  if (strpbrk(masked_string, SEPARATOR_CHARS))
+    masklen = 0;
+
   /* read next line */
  read_next_line:
   line = NULL;
@@ -590,8 +899,8 @@ struct data_entry *load_entry(struct entries *entr, struct data_entry *entry)
   row = entr->fi->lineno;
 
   /* Try to read the first vector value */
-  toke = strtok(line, SEPARATOR_CHARS);
-  if (toke == NULL)
+  pos = skip_separators(line);
+  if (*pos == '\0')
     {
       /* line is empty, skip it */
       ifverbose(5)
@@ -608,45 +917,24 @@ struct data_entry *load_entry(struct entries *entr, struct data_entry *entry)
 
   maskcnt = 0;
 
-  /* examine first vector value (component) */
-  if (strcmp(toke, masked_string) == 0)
-    {
-      mask = set_mask(mask, dim, 0);
-      if (mask == NULL)
-	{
+  /* Read the vector values */
+  for (i = 0; i < dim; i++) {
+    if (i > 0)
+      {
+	pos = skip_separators(pos);
+	if (*pos == '\0') {
+	  fprintf(stderr, "load_entry: can't read entry in file %s on line %ld, component %d\n",
+		  fi->name, row, i);
+	  ofree(mask);
 	  if (entry_is_new)
 	    free_entry(entry);
+	  ERROR(ERR_FILEFORMAT);
 	  return NULL;
 	}
-	  
-      maskcnt++;
-      ent = 0.0;
-    }
-  else
-    if (sscanf(toke, "%f", &ent) <= 0) {
-      fprintf(stderr, "Can't read entry on line %ld, component 0\n", row);
-      if (entry_is_new)
-	free_entry(entry);
-
-      ERROR(ERR_FILEFORMAT);
-      return NULL;
-    }
-  entry->points[0] = ent;
-
-
-  /* Read the other vector values */
-  for (i = 1; i < dim; i++) {
-    toke = strtok(NULL, SEPARATOR_CHARS);
-    if (toke == NULL) {
-      fprintf(stderr, "load_entry: can't read entry in file %s on line %ld, component %d\n",
-	      fi->name, row, i);
-      if (entry_is_new)
-	free_entry(entry);
-      ERROR(ERR_FILEFORMAT);
-      return NULL;
-    }
+      }
 
-    if (strcmp(toke, masked_string) == 0)
+    if (masklen && (strncmp(pos, masked_string, masklen) == 0) &&
+	TOKEN_END(pos[masklen]))
       {
 	mask = set_mask(mask, dim, i);
 	if (mask == NULL)
@@ -657,11 +945,16 @@ struct data_entry *load_entry(struct entries *entr, struct data_entry *entry)
 	  }
 	maskcnt++;
 	ent = 0.0;
+	pos += masklen;
       }
     else
-      if (sscanf(toke, "%f", &ent) <= 0) {
-	fprintf(stderr, "load_entry: can't read entry in file %s on line %ld, component %d\n",
-	      fi->name, row, i);
+      if (read_component(&pos, &ent)) {
+	if (i == 0)
+	  fprintf(stderr, "Can't read entry on line %ld, component 0\n", row);
+	else
+	  fprintf(stderr, "load_entry: can't read entry in file %s on line %ld, component %d\n",
+		  fi->name, row, i);
+	ofree(mask);
 	if (entry_is_new)
 	  free_entry(entry);
 	ERROR(ERR_FILEFORMAT);
@@ -692,6 +985,7 @@ struct data_entry *load_entry(struct entries *entr, struct data_entry *entry)
   if (mask)
     {
       entry->mask = mask;
+      entry->maskw = mask_weights(mask, dim);
       mask = NULL;
     }
 
@@ -702,7 +996,7 @@ struct data_entry *load_entry(struct entries *entr, struct data_entry *entry)
 
   label_found = 0;
 
-  while ((toke = strtok(NULL, SEPARATOR_CHARS)) != NULL) 
+  while ((toke = next_token(&pos)) != NULL) 
     {
       if (strncmp(toke, "weight=", 7) == 0) 
 	entry->weight = get_weight(toke);
@@ -799,10 +1093,11 @@ struct data_entry *rewind_entries(struct entries *entries, eptr *ptr)
 
       /* buffered loading */
       fi = entries->fi;
+      entries->rand_state = orand_state();
       if ((fi->flags.eof) || (current != NULL))
 	{
 	  /* if we are at the end of file, need to rewind the file */
-	  if (rewind_datafile(fi))
+	  if (entries->bin ? rewind_bin(entries) : rewind_datafile(fi))
 	    {
 	      fprintf(stderr, "error rewinding file\n");
 	      return NULL;
@@ -823,6 +1118,7 @@ struct data_entry *rewind_entries(struct entries *entries, eptr *ptr)
       if ((current == NULL) && (!entries->flags.totlen_known))
 	{
 	  /* file not loaded into memory */
+	  entries->rand_state = orand_state();
 	  if (!read_entries(entries))
 	    {
 	      fprintf(stderr, "rewind_entries failed\n");
@@ -852,6 +1148,340 @@ void free_entrys(struct data_entry *data)
     }
 }
 
+/******************************************************************* 
+ * Flat codebooks                                                  * 
+ *******************************************************************/
+
+/* block_stride - length of one row in the flat block. Rows are padded
+   so that every row starts at an aligned address. */
+
+static long block_stride(int dim)
+{
+  long align = BLOCK_ALIGN / sizeof(float);
+
+  if (dim < 1)
+    dim = 1;
+  return ((dim + align - 1) / align) * align;
+}
+
+/* new_block - allocate an aligned, zeroed block for noe vectors and an
+   array of noe entries pointing to its rows. The entries are linked
+   in order. Returns non-zero on error. */
+
+static int new_block(struct entries *entr, long noe, float **block, 
+		     void **mem, struct data_entry **units)
+{
+  long i, stride = block_stride(entr->dimension);
+  struct data_entry *u;
+  unsigned long addr;
+
+  *mem = calloc(noe * stride * sizeof(float) + BLOCK_ALIGN, 1);
+  *units = calloc(noe > 0 ? noe : 1, sizeof(struct data_entry));
+  if ((*mem == NULL) || (*units == NULL))
+    {
+      fprintf(stderr, "new_block: can't allocate block for %ld vectors\n",
+	      noe);
+      ofree(*mem);
+      ofree(*units);
+      ERROR(ERR_NOMEM);
+      return 1;
+    }
+
+  addr = (unsigned long) *mem;
+  addr = (addr + BLOCK_ALIGN - 1) & ~((unsigned long) BLOCK_ALIGN - 1);
+  *block = (float *) addr;
+
+  for (i = 0, u = *units; i < noe; i++, u++)
+    {
+      u->points = *block + i * stride;
+      u->lab.label = LABEL_EMPTY;
+      u->num_labs = 0;
+      u->weight = 0;
+      u->mask = NULL;
+      u->maskw = NULL;
+      u->fixed = NULL;
+      u->bmu = -1;
+      u->flags.in_block = 1;
+      u->next = (i < noe - 1) ? u + 1 : NULL;
+    }
+
+  return 0;
+}
+
+/* free_block - deallocate the flat block of a codebook and its search
+   index. The entries of the block should have been released with
+   free_entry first. */
+
+void free_block(struct entries *entr)
+{
+  if (entr->index && entr->free_index)
+    entr->free_index(entr->index);
+  entr->index = NULL;
+  entr->free_index = NULL;
+  if (entr->block_mem)
+    free(entr->block_mem);
+  if (entr->units)
+    free(entr->units);
+  if (entr->slot)
+    free(entr->slot);
+  if (entr->unit_of)
+    free(entr->unit_of);
+  entr->block = NULL;
+  entr->block_mem = NULL;
+  entr->units = NULL;
+  entr->slot = NULL;
+  entr->unit_of = NULL;
+  entr->stride = 0;
+}
+
+/* alloc_block_entries - allocate a flat codebook of noe zeroed
+   vectors. Any previous entries of entr are freed. Returns a pointer
+   to the first entry or NULL on error. */
+
+struct data_entry *alloc_block_entries(struct entries *entr, long noe)
+{
+  float *block;
+  void *mem;
+  struct data_entry *units;
+
+  clear_err();
+  if (new_block(entr, noe, &block, &mem, &units))
+    return NULL;
+
+  if (entr->entries)
+    free_entrys(entr->entries);
+  free_block(entr);
+
+  entr->block = block;
+  entr->block_mem = mem;
+  entr->units = units;
+  entr->stride = block_stride(entr->dimension);
+  entr->entries = (noe > 0) ? units : NULL;
+  entr->num_entries = entr->num_loaded = noe;
+  entr->flags.loadmode = LOADMODE_ALL;
+  entr->flags.totlen_known = 1;
+
+  return units;
+}
+
+/* flatten_entries - move the vectors of a codebook into one aligned
+   block so that they can be scanned linearly. The entries list keeps
+   working as before. Can be called again after entries have been added
+   to or removed from the list. Buffered files can't be flattened.
+   Returns non-zero on error. */
+
+int flatten_entries(struct entries *entr)
+{
+  long noe, i, dim = entr->dimension;
+  float *block;
+  void *mem;
+  struct data_entry *units, *entry, *next;
+  eptr p;
+
+  clear_err();
+  if (entr->flags.loadmode == LOADMODE_BUFFER)
+    return 1;
+
+  /* make sure everything has been loaded */
+  if ((entr->entries == NULL) && (!entr->flags.totlen_known))
+    if (rewind_entries(entr, &p) == NULL)
+      return 1;
+
+  for (noe = 0, entry = entr->entries; entry != NULL; entry = entry->next)
+    noe++;
+
+  if (new_block(entr, noe, &block, &mem, &units))
+    return 1;
+
+  /* move entries to the block */
+  for (i = 0, entry = entr->entries; entry != NULL; i++, entry = next)
+    {
+      next = entry->next;
+      memcpy(units[i].points, entry->points, dim * sizeof(float));
+      units[i].lab = entry->lab;
+      units[i].num_labs = entry->num_labs;
+      units[i].weight = entry->weight;
+      units[i].mask = entry->mask;
+      units[i].maskw = entry->maskw;
+      units[i].fixed = entry->fixed;
+
+      if (!entry->flags.in_block)
+	{
+	  if (!entry->flags.mapped)
+	    free(entry->points);
+	  free(entry);
+	}
+    }
+
+  free_block(entr);
+
+  entr->block = block;
+  entr->block_mem = mem;
+  entr->units = units;
+  entr->stride = block_stride(entr->dimension);
+  entr->entries = (noe > 0) ? units : NULL;
+  entr->num_entries = entr->num_loaded = noe;
+  entr->flags.totlen_known = 1;
+
+  return 0;
+}
+
+/* Layouts of a map. Normally unit i of a flat codebook is row i of the
+   block, so the units of a neighbourhood lie on as many separate
+   stretches of memory as it has rows. Along a Morton or a Hilbert
+   curve the units that are near each other on the map are mostly near
+   each other in the block too. Only the block is reordered: the
+   entries keep their order and block_row still gives the vector of
+   unit i, so the rest of the program sees no difference and the
+   codebook is written out row by row as before. */
+
+struct layout_key {
+  unsigned long key;
+  long index;
+};
+
+static int compare_keys(const void *a, const void *b)
+{
+  const struct layout_key *ka = a, *kb = b;
+
+  if (ka->key < kb->key)
+    return -1;
+  return (ka->key > kb->key);
+}
+
+/* morton_key - interleave the bits of x and y */
+
+static unsigned long morton_key(unsigned long x, unsigned long y)
+{
+  unsigned long key = 0, bit;
+  int i;
+
+  for (i = 0, bit = 1; (x >> i) || (y >> i); i++, bit <<= 2)
+    {
+      if ((x >> i) & 1)
+	key |= bit;
+      if ((y >> i) & 1)
+	key |= bit << 1;
+    }
+  return key;
+}
+
+/* hilbert_key - distance of (x, y) along the Hilbert curve that fills
+   an n x n square, n a power of two */
+
+static unsigned long hilbert_key(unsigned long n, unsigned long x,
+				 unsigned long y)
+{
+  unsigned long s, rx, ry, t, key = 0;
+
+  for (s = n / 2; s > 0; s /= 2)
+    {
+      rx = (x & s) != 0;
+      ry = (y & s) != 0;
+      key += s * s * ((3 * rx) ^ ry);
+      /* rotate the quadrant */
+      if (ry == 0)
+	{
+	  if (rx == 1)
+	    {
+	      x = n - 1 - x;
+	      y = n - 1 - y;
+	    }
+	  t = x;
+	  x = y;
+	  y = t;
+	}
+    }
+  return key;
+}
+
+/* set_layout - store the units of a flat map in the block in the order
+   given by layout. Returns non-zero on error. */
+
+int set_layout(struct entries *entr, int layout)
+{
+  long noe = entr->num_entries, i, from, to, stride = entr->stride;
+  unsigned long n;
+  struct layout_key *keys;
+  long *slot = NULL, *unit_of = NULL;
+  float *tmp;
+
+  if ((entr->block == NULL) ||
+      (noe != (long) entr->xdim * entr->ydim) || (noe < 1))
+    {
+      fprintf(stderr, "set_layout: codebook is not a flat map\n");
+      return 1;
+    }
+
+  if ((layout == LAYOUT_ROWS) && (entr->slot == NULL))
+    return 0;
+
+  tmp = malloc(noe * stride * sizeof(float));
+  if (tmp == NULL)
+    {
+      fprintf(stderr, "set_layout: can't allocate memory\n");
+      ERROR(ERR_NOMEM);
+      return 1;
+    }
+
+  if (layout != LAYOUT_ROWS)
+    {
+      keys = malloc(noe * sizeof(struct layout_key));
+      slot = malloc(noe * sizeof(long));
+      unit_of = malloc(noe * sizeof(long));
+      if ((keys == NULL) || (slot == NULL) || (unit_of == NULL))
+	{
+	  fprintf(stderr, "set_layout: can't allocate memory\n");
+	  ofree(keys);
+	  ofree(slot);
+	  ofree(unit_of);
+	  free(tmp);
+	  ERROR(ERR_NOMEM);
+	  return 1;
+	}
+
+      for (n = 1; (n < (unsigned long) entr->xdim) ||
+	     (n < (unsigned long) entr->ydim); n *= 2);
+
+      for (i = 0; i < noe; i++)
+	{
+	  keys[i].index = i;
+	  if (layout == LAYOUT_HILBERT)
+	    keys[i].key = hilbert_key(n, i % entr->xdim, i / entr->xdim);
+	  else
+	    keys[i].key = morton_key(i % entr->xdim, i / entr->xdim);
+	}
+      qsort(keys, noe, sizeof(struct layout_key), compare_keys);
+      for (i = 0; i < noe; i++)
+	{
+	  slot[keys[i].index] = i;
+	  unit_of[i] = keys[i].index;
+	}
+      free(keys);
+    }
+
+  /* move the rows to their new places */
+  memcpy(tmp, entr->block, noe * stride * sizeof(float));
+  for (i = 0; i < noe; i++)
+    {
+      from = (entr->slot != NULL) ? entr->slot[i] : i;
+      to = (slot != NULL) ? slot[i] : i;
+      memcpy(entr->block + to * stride, tmp + from * stride,
+	     stride * sizeof(float));
+      entr->units[i].points = entr->block + to * stride;
+    }
+  free(tmp);
+
+  if (entr->slot)
+    free(entr->slot);
+  if (entr->unit_of)
+    free(entr->unit_of);
+  entr->slot = slot;
+  entr->unit_of = unit_of;
+
+  return 0;
+}
+
 /* copy_entry - Copy one entry (next==NULL) */
 
 struct data_entry *copy_entry(struct entries *entries, struct data_entry *data)
@@ -875,14 +1505,23 @@ struct data_entry *copy_entry(struct entries *entries, struct data_entry *data)
   /* copy mask */
   if (data->mask)
     {
-      if ((tmp->mask = malloc(entries->dimension)) == NULL)
+      if ((tmp->mask = malloc(MASK_SIZE(entries->dimension))) == NULL)
 	{
 	  fprintf(stderr, "Can't allocate memory for mask\n");
 	  free_entry(tmp);
 	  ERROR(ERR_NOMEM);
 	  return NULL;
 	}
-      memcpy(tmp->mask, data->mask, entries->dimension);
+      if (data->maskw)
+	memcpy(tmp->mask, data->mask, MASK_SIZE(entries->dimension));
+      else
+	{
+	  memcpy(tmp->mask, data->mask, entries->dimension);
+	  for (i = 0; i < entries->dimension; i++)
+	    mask_weights(tmp->mask, entries->dimension)[i] = 
+	      data->mask[i] ? 0.0 : 1.0;
+	}
+      tmp->maskw = mask_weights(tmp->mask, entries->dimension);
     }
 
   /* copy other stuff */
@@ -1209,21 +1848,56 @@ static struct vec_functions {
   DIST_FUNCTION *dist;        /* calculates distance between two vectors */
   VECTOR_ADAPT *vector_adapt; /* adapt one vector */
   WINNER_FUNCTION *winner;    /* function to find winner */
+  WINNER_FUNCTION *knn_winner; /* function to find k nearest neighbours */
+  char *kernels;              /* SIMD kernels to use, NULL if none */
 #if 0
   ALPHA_FUNC *alpha_func;
   MAPDIST_FUNCTION *mapdist;  /* calculates distance between two units */
   NEIGH_ADAPT *neigh_adapt;   /* adapts weights */
 #endif
 } vec_funcs[] = {
-  { "default", vector_dist_euc, adapt_vector, find_winner_euc },
-  /* { "fast", vector_dist_euc2, adapt_vector2, find_winner_euc2 }, */
-  { NULL, NULL, NULL, NULL }};
+  { "default", vector_dist_euc, adapt_vector, find_winner_euc, 
+    find_winner_knn, NULL },
+  { "fast", vector_dist_euc2, adapt_vector2, find_winner_euc2, 
+    find_winner_knn2, NULL },
+  /* SIMD versions, the instruction set is selected at run time */
+  { "simd", vector_dist_simd, adapt_vector_simd, find_winner_simd, 
+    find_winner_simd, "auto" },
+  { "avx512", vector_dist_simd, adapt_vector_simd, find_winner_simd, 
+    find_winner_simd, "avx512" },
+  { "avx2", vector_dist_simd, adapt_vector_simd, find_winner_simd, 
+    find_winner_simd, "avx2" },
+  { "sse2", vector_dist_simd, adapt_vector_simd, find_winner_simd, 
+    find_winner_simd, "sse2" },
+  /* exact search with a kd-tree or a ball tree over the codebook */
+  { "tree", vector_dist_euc, adapt_vector_tree, find_winner_tree, 
+    find_winner_tree, NULL },
+  /* pruning with the triangle inequality, for repeated searches */
+  { "prune", vector_dist_euc, adapt_vector_prune, find_winner_prune, 
+    find_winner_prune, NULL },
+  /* approximate search with inverted lists, for large codebooks */
+  { "ann", vector_dist_euc, adapt_vector_ann, find_winner_ann, 
+    find_winner_ann, NULL },
+  /* scan of a copy quantized to 8 bits, checked with exact distances */
+  { "quant", vector_dist_euc, adapt_vector_quant, find_winner_quant, 
+    find_winner_quant, "auto" },
+  /* SIMD versions checked against the default ones */
+  { "check", vector_dist_check, adapt_vector_check, find_winner_check, 
+    find_winner_check, "auto" },
+  { NULL, NULL, NULL, NULL, NULL, NULL }};
+
+/* set_vector_functions - select a set of vector functions by name. If
+   name is NULL, the set named in the environment variable
+   LVQSOM_SELFUNCS or the default set is used. */
 
 int set_vector_functions(struct teach_params *params, char *name)
 {
   struct vec_functions *vec = vec_funcs;
   int ret = 0;
 
+  if (name == NULL)
+    name = getenv("LVQSOM_SELFUNCS");
+
   if (name)
     for (;vec->name != NULL;vec++)
       if (strcasecmp(vec->name, name) == 0)
@@ -1236,9 +1910,14 @@ int set_vector_functions(struct teach_params *params, char *name)
       ret = 1;
     }
   
+  if (vec->kernels)
+    select_vec_kernels(vec->kernels);
+  vec_check_mode(vec->winner == find_winner_check);
+
   params->dist = vec->dist;
   params->vector_adapt = vec->vector_adapt;
   params->winner = vec->winner;
+  params->knn_winner = vec->knn_winner;
   return ret;
 }
 
@@ -1257,6 +1936,13 @@ int set_teach_params(struct teach_params *params, struct entries *codes,
   /* Load all codes to memory. This should be on for codebook files */
   set_buffer(codes, 0);
 
+  /* keep the codebook in one block so that it can be scanned fast */
+  if (flatten_entries(codes))
+    {
+      fprintf(stderr, "set_teach_params: can't load codebook\n");
+      error = 1;
+    }
+
   params->topol = codes->topol;
   params->mapdist = NULL;
   params->neigh = codes->neigh;
@@ -1269,6 +1955,7 @@ int set_teach_params(struct teach_params *params, struct entries *codes,
   set_vector_functions(params, name);
 #else
   params->winner = find_winner_euc;
+  params->knn_winner = find_winner_knn;
   params->dist = vector_dist_euc;
   params->vector_adapt = adapt_vector;
 #endif
@@ -1277,6 +1964,14 @@ int set_teach_params(struct teach_params *params, struct entries *codes,
   if (data)
     params->data = data;
   params->snapshot = NULL;
+  params->stop = NULL;
+  params->checkpoint = NULL;
+  params->resume = NULL;
+  params->local_search = LOCAL_OFF;
+  params->cutoff = 0.0;
+  params->tables = NULL;
+  params->threads = 1;
+  params->layout = LAYOUT_ROWS;
 
   return error;
 }
@@ -1307,6 +2002,14 @@ struct typelist snapshot_list[] = {
 #endif /* NO_PIPED_COMMANDS */
   {SNAPSHOT_SAVEFILE, NULL, NULL}}; /* default */
 
+/* layouts of the block of a map */
+
+struct typelist layout_list[] = {
+  {LAYOUT_ROWS, "rows", NULL},
+  {LAYOUT_MORTON, "morton", NULL},
+  {LAYOUT_HILBERT, "hilbert", NULL},
+  {LAYOUT_ROWS, NULL, NULL}};      /* default */
+
 int label_not_needed(int level)
 {
   static int label_level = 0;
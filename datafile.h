@@ -34,6 +34,14 @@
 #define MASKED_VALUE "x"
 #endif /* MASKED_VALUE */
 
+/* A mask is allocated in one piece with its weight vector (maskw of
+   data_entry), which starts at MASK_WOFFSET bytes from the mask. */
+
+#define MASK_WOFFSET(dim) \
+  (((dim) + sizeof(float) - 1) & ~(sizeof(float) - 1))
+#define MASK_SIZE(dim) (MASK_WOFFSET(dim) + (dim) * sizeof(float))
+#define mask_weights(mask, dim) ((float *) ((mask) + MASK_WOFFSET(dim)))
+
 /* characters that separate vector components on a line, typically
    whitespace characters */
 
@@ -42,7 +50,20 @@
 #define SEPARATOR_CHARS " \r\t"
 #endif /* SEPARATOR_CHARS */
 
+/* alignment of the flat codebook block in bytes. Rows of the block are
+   padded to a multiple of this. */
+
+#ifndef BLOCK_ALIGN
+#define BLOCK_ALIGN 64
+#endif /* BLOCK_ALIGN */
+
+/* orders of the units of a map in its flat block, see set_layout */
+#define LAYOUT_ROWS    0   /* row by row, the order of the units */
+#define LAYOUT_MORTON  1   /* along a Morton (Z-order) curve */
+#define LAYOUT_HILBERT 2   /* along a Hilbert curve */
+
 extern char *masked_string;
+extern struct typelist layout_list[];
 
 struct entries *open_data_file(char *name);
 int read_headers(struct entries *entries);
@@ -51,6 +72,7 @@ struct entries *read_entries(struct entries *entries);
 int save_entries_wcomments(struct entries *codes, char *out_code_file, char *comments);
 #define save_entries(codes,name) save_entries_wcomments((codes),(name),NULL)
 int write_entry(struct file_info *, struct entries *, struct data_entry *);
+int write_entry_prec(struct file_info *, struct entries *, struct data_entry *, int digits);
 int write_header(struct file_info *fi, struct entries *codes);
 
 struct data_entry *init_entry(struct entries *entr, struct data_entry *entry);
@@ -73,6 +95,12 @@ struct entries *copy_entries(struct entries *entr);
 struct data_entry *copy_entry(struct entries *entries, struct data_entry *data);
 void free_entrys(struct data_entry *data);
 
+/* flat codebooks */
+struct data_entry *alloc_block_entries(struct entries *entr, long noe);
+int flatten_entries(struct entries *entr);
+void free_block(struct entries *entr);
+int set_layout(struct entries *entr, int layout);
+
 int get_topol(char *);
 int get_neigh(char *);
 int get_xdim(char *);
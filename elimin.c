@@ -36,6 +36,7 @@ static char *usage[] = {
   "  -cout filename        output codebook filename\n",
   "Optional parameters:\n",
   "  -knn N                use N nearest neighbours (default: 5)\n", 
+  "  -selfuncs name        select a set of functions\n",
   NULL};
 
 
@@ -130,7 +131,9 @@ int main(int argc, char **argv)
   int knn;
   char *in_data_file;
   char *out_code_file;
+  char *funcname;
   struct entries *data, *codes;
+  struct teach_params params;
 
   global_options(argc, argv);
   if (extract_parameter(argc, argv, "-help", OPTION2))
@@ -141,6 +144,8 @@ int main(int argc, char **argv)
   in_data_file = extract_parameter(argc, argv, IN_DATA_FILE, ALWAYS);
   out_code_file = extract_parameter(argc, argv, OUT_CODE_FILE, ALWAYS);
   knn = (int) oatoi(extract_parameter(argc, argv, KNN_NEIGHBORS, OPTION), 5);
+  funcname = extract_parameter(argc, argv, "-selfuncs", OPTION);
+  set_vector_functions(&params, funcname);
 
   ifverbose(2)
     fprintf(stderr, "Input entries are read from file %s\n", in_data_file);
@@ -152,7 +157,7 @@ int main(int argc, char **argv)
 
   ifverbose(2)
     fprintf(stderr, "Extra codes are eliminated\n");
-  codes = eliminate_codes(knn, data, find_winner_knn);
+  codes = eliminate_codes(knn, data, params.knn_winner);
   close_entries(data);
   if (codes == NULL)
     {
@@ -41,6 +41,7 @@ static char *usage[] = {
   "                        the type determined from the program name\n",
   "  -knn N                use N nearest neighbours\n", 
   "  -rand integer         seed for random number generator. 0 is current time\n",
+  "  -selfuncs name        select a set of functions\n",
   NULL};
 
 struct entries *init_codes(long number_of_codes, struct entries *data,
@@ -165,8 +166,10 @@ int main(int argc, char **argv)
   char *in_data_file;
   char *out_code_file;
   char *progname, *pname;
+  char *funcname;
   int prop = -1;
   struct entries *data, *codes;
+  struct teach_params params;
 
   global_options(argc, argv);
   if (extract_parameter(argc, argv, "-help", OPTION2))
@@ -204,6 +207,8 @@ int main(int argc, char **argv)
 				NUMBER_OF_CODES, ALWAYS), 1);
   knn = (int) oatoi(extract_parameter(argc, argv, KNN_NEIGHBORS, OPTION), 5);
   randomize = (int) oatoi(extract_parameter(argc, argv, RANDOM, OPTION), 0);
+  funcname = extract_parameter(argc, argv, "-selfuncs", OPTION);
+  set_vector_functions(&params, funcname);
 
   ifverbose(2)
     fprintf(stderr, "Input entries are read from file %s\n", in_data_file);
@@ -215,7 +220,7 @@ int main(int argc, char **argv)
 
   init_random(randomize);
 
-  codes = init_codes(number_of_codes, data, knn, prop, find_winner_knn);
+  codes = init_codes(number_of_codes, data, knn, prop, params.knn_winner);
   if (codes == NULL)
     {
       fprintf(stderr, "Failed to initialize codes\n");
@@ -334,8 +334,9 @@ char *getline_file(struct file_info *fi)
 	    }
 	}
 
-      /* get next character */
-      c = fgetc(fp);
+      /* get next character. A file is read by one thread at a time, so
+	 the locking of getc is not needed. */
+      c = getc_unlocked(fp);
 
       /* end of line? */
       if (c == '\n')
@@ -203,7 +203,7 @@ int main(int argc, char **argv)
   }
 
   set_teach_params(&params, codes, data, buffer, funcname);
-  params.winner = find_winner_knn;
+  params.winner = params.knn_winner;
   params.knn = knn;
 
   compute_knnaccuracy(&params);
@@ -31,6 +31,9 @@
 #include <float.h>
 #include "lvq_pak.h"
 #include "datafile.h"
+#include "vec_rout.h"
+#include "bmu_rout.h"
+#include "thread_rout.h"
 
 /* find_winner_euc - finds the winning entry (1 nearest neighbour) in
    codebook using euclidean distance. Information about the winning
@@ -43,48 +46,98 @@ int find_winner_euc(struct entries *codes, struct data_entry *sample,
 {
   struct data_entry *codetmp;
   int dim, i, masked;
-  float diffsf, diff, difference;
+  float diffsf, diff, difference, *c;
+  long index, noc, row;
   eptr p;
 
   dim = codes->dimension;
   win->index = -1;
   win->winner = NULL;
   win->diff = -1.0;
-  
-  /* Go through all code vectors */
-  codetmp = rewind_entries(codes, &p);
   diffsf = FLT_MAX;
+
+  if (codes->block != NULL)
+    {
+      /* Flat codebook: go through the rows of the block in the order
+	 they are stored. Of equally distant units the first one wins
+	 whatever the layout. */
+      noc = codes->num_entries;
+      for (row = 0; row < noc; row++)
+	{
+	  if (codes->unit_of != NULL)
+	    {
+	      index = codes->unit_of[row];
+	      c = codes->block + row * codes->stride;
+	    }
+	  else
+	    {
+	      index = row;
+	      c = block_row(codes, row);
+	    }
+	  difference = 0.0;
+	  masked = 0;
+
+	  for (i = 0; i < dim; i++)
+	    {
+	      if ((sample->mask != NULL) && (sample->mask[i] != 0))
+		{
+		  masked++;
+		  continue; /* ignore vector components that have 1 in mask */
+		}
+	      diff = c[i] - sample->points[i];
+	      difference += diff * diff;
+	      if (difference > diffsf) break;
+	    }
+
+	  if (masked == dim)
+	    return 0; /* can't calculate winner, empty data vector */
+
+	  if ((difference < diffsf) ||
+	      ((difference == diffsf) && (index < win->index))) {
+	    win->index = index;
+	    win->diff = difference;
+	    diffsf = difference;
+	  }
+	}
+      if (win->index >= 0)
+	win->winner = &codes->units[win->index];
+    }
+  else
+    {
+      /* Go through all code vectors */
+      codetmp = rewind_entries(codes, &p);
   
-  while (codetmp != NULL) {
-    difference = 0.0;
-    masked = 0;
+      while (codetmp != NULL) {
+	difference = 0.0;
+	masked = 0;
 
-    /* Compute the distance between codebook and input entry */
-    for (i = 0; i < dim; i++)
-      {
-	if ((sample->mask != NULL) && (sample->mask[i] != 0))
+	/* Compute the distance between codebook and input entry */
+	for (i = 0; i < dim; i++)
 	  {
-	    masked++;
-	    continue; /* ignore vector components that have 1 in mask */
+	    if ((sample->mask != NULL) && (sample->mask[i] != 0))
+	      {
+		masked++;
+		continue; /* ignore vector components that have 1 in mask */
+	      }
+	    diff = codetmp->points[i] - sample->points[i];
+	    difference += diff * diff;
+	    if (difference > diffsf) break;
 	  }
-	diff = codetmp->points[i] - sample->points[i];
-	difference += diff * diff;
-	if (difference > diffsf) break;
-      }
     
-    if (masked == dim)
-      return 0; /* can't calculate winner, empty data vector */
+	if (masked == dim)
+	  return 0; /* can't calculate winner, empty data vector */
     
-    /* If distance is smaller than previous distances */
-    if (difference < diffsf) {
-      win->winner = codetmp;
-      win->index = p.index;
-      win->diff = difference;
-      diffsf = difference;
-    }
+	/* If distance is smaller than previous distances */
+	if (difference < diffsf) {
+	  win->winner = codetmp;
+	  win->index = p.index;
+	  win->diff = difference;
+	  diffsf = difference;
+	}
     
-    codetmp = next_entry(&p);
-  }
+	codetmp = next_entry(&p);
+      }
+    }
   
   if (win->index < 0)
     ifverbose(3)
@@ -99,41 +152,69 @@ int find_winner_euc2(struct entries *codes, struct data_entry *sample,
   struct data_entry *codetmp;
   int dim, i;
   float diffsf, diff, difference, *s, *c;
+  long index, noc;
   eptr p;
 
+  /* masked samples are handled with the weight vectors */
   if (sample->mask != NULL)
-    return find_winner_euc(codes, sample, win, knn);
+    return find_winner_simd(codes, sample, win, 1);
 
   dim = codes->dimension;
   win->index = -1;
   win->winner = NULL;
   win->diff = -1.0;
-  
-  /* Go through all code vectors */
-  codetmp = rewind_entries(codes, &p);
   diffsf = FLT_MAX;
+
+  if (codes->block != NULL)
+    {
+      /* Flat codebook: go through the rows of the block */
+      noc = codes->num_entries;
+      for (index = 0; index < noc; index++)
+	{
+	  difference = 0.0;
+	  c = block_row(codes, index); s = sample->points;
+	  for (i = 0; i < dim; i++)
+	    {
+	      diff = *c++ - *s++;
+	      difference += diff * diff;
+	    }
+
+	  if (difference < diffsf) {
+	    win->index = index;
+	    win->diff = difference;
+	    diffsf = difference;
+	  }
+	}
+      if (win->index >= 0)
+	win->winner = &codes->units[win->index];
+    }
+  else
+    {
+      /* Go through all code vectors */
+      codetmp = rewind_entries(codes, &p);
   
-  while (codetmp != NULL) {
-    difference = 0.0;
+      while (codetmp != NULL) {
+	difference = 0.0;
 
-    /* Compute the distance between codebook and input entry */
-    c = codetmp->points; s = sample->points;
-    for (i = 0; i < dim; i++)
-      {
-	diff = *c++ - *s++;
-	difference += diff * diff;
-      }
+	/* Compute the distance between codebook and input entry */
+	c = codetmp->points; s = sample->points;
+	for (i = 0; i < dim; i++)
+	  {
+	    diff = *c++ - *s++;
+	    difference += diff * diff;
+	  }
     
-    /* If distance is smaller than previous distances */
-    if (difference < diffsf) {
-      win->winner = codetmp;
-      win->index = p.index;
-      win->diff = difference;
-      diffsf = difference;
-    }
+	/* If distance is smaller than previous distances */
+	if (difference < diffsf) {
+	  win->winner = codetmp;
+	  win->index = p.index;
+	  win->diff = difference;
+	  diffsf = difference;
+	}
     
-    codetmp = next_entry(&p);
-  }
+	codetmp = next_entry(&p);
+      }
+    }
   
   if (win->index < 0)
     ifverbose(3)
@@ -142,6 +223,136 @@ int find_winner_euc2(struct entries *codes, struct data_entry *sample,
   return 1; /* number of neighbours */
 }
 
+/* The k best candidates are kept in a max-heap with the worst one on
+   top. Of two candidates at equal distance the later one is considered
+   better, as it was with the sorted list used before. */
+
+#define worse(a, b) (((a)->diff > (b)->diff) || \
+		     (((a)->diff == (b)->diff) && ((a)->index < (b)->index)))
+
+static void sift_down(struct winner_info *heap, int n, int i)
+{
+  struct winner_info tmp;
+  int c;
+
+  while ((c = 2 * i + 1) < n)
+    {
+      if ((c + 1 < n) && worse(&heap[c + 1], &heap[c]))
+	c++;
+      if (!worse(&heap[c], &heap[i]))
+	break;
+      tmp = heap[i];
+      heap[i] = heap[c];
+      heap[c] = tmp;
+      i = c;
+    }
+}
+
+/* heap_winner - offer a candidate to the heap of the knn best winners.
+   *n is the number of candidates in the heap. */
+
+void heap_winner(struct winner_info *heap, int *n, int knn, float difference,
+		 long index, struct data_entry *entry)
+{
+  struct winner_info tmp;
+  int i, p;
+
+  if (*n < knn)
+    {
+      /* not full yet, add to the bottom and move up */
+      i = (*n)++;
+      heap[i].diff = difference;
+      heap[i].index = index;
+      heap[i].winner = entry;
+      while (i > 0)
+	{
+	  p = (i - 1) / 2;
+	  if (!worse(&heap[i], &heap[p]))
+	    break;
+	  tmp = heap[i];
+	  heap[i] = heap[p];
+	  heap[p] = tmp;
+	  i = p;
+	}
+      return;
+    }
+
+  tmp.diff = difference;
+  tmp.index = index;
+  if ((knn < 1) || worse(&tmp, &heap[0]))
+    return;
+
+  heap[0].diff = difference;
+  heap[0].index = index;
+  heap[0].winner = entry;
+  sift_down(heap, knn, 0);
+}
+
+/* sort_winners - sort the heap so that the best winner is first. The
+   places not filled get index -1. */
+
+void sort_winners(struct winner_info *heap, int n, int knn)
+{
+  struct winner_info tmp;
+  int m;
+
+  for (m = n - 1; m > 0; m--)
+    {
+      tmp = heap[0];
+      heap[0] = heap[m];
+      heap[m] = tmp;
+      sift_down(heap, m, 0);
+    }
+
+  for (m = n; m < knn; m++)
+    {
+      heap[m].index = -1;
+      heap[m].winner = NULL;
+      heap[m].diff = FLT_MAX;
+    }
+}
+
+/* knn_dist - distance used by find_winner_knn. Components masked off in
+   the sample are left out and their number is returned in
+   *masked. The summing is stopped when the distance exceeds bound,
+   which is checked every DIST_BLOCK components. */
+
+static float knn_dist(float *c, struct data_entry *sample, int dim,
+		      float bound, int *masked)
+{
+  float diff, difference = 0.0, *s = sample->points;
+  char *mask = sample->mask;
+  int i, end;
+
+  *masked = 0;
+  for (i = 0; i < dim; )
+    {
+      end = (i + DIST_BLOCK < dim) ? i + DIST_BLOCK : dim;
+      if (mask == NULL)
+	for (; i < end; i++)
+	  {
+	    diff = c[i] - s[i];
+	    difference += diff * diff;
+	  }
+      else
+	for (; i < end; i++)
+	  {
+	    if (mask[i] != 0)
+	      {
+		(*masked)++;
+		continue; /* ignore vector components that have 1 in mask */
+	      }
+	    diff = c[i] - s[i];
+	    difference += diff * diff;
+	  }
+
+      if (difference > bound)
+	break;
+    }
+
+  return difference;
+}
+
 /* find_winner_knn - finds the winning entrys (k nearest neighbours)
    in codebook using euclidean distance. Information about the winning
    entry is saved in the winner_info structures provided by the
@@ -153,8 +364,9 @@ int find_winner_knn(struct entries *codes, struct data_entry *sample,
 		    struct winner_info *win, int knn)
 {
   struct data_entry *codetmp;
-  int dim, i, j, masked;
-  float difference, diff;
+  int dim, masked, n = 0;
+  float difference, bound = FLT_MAX;
+  long index, noc;
   eptr p;
 
   if (knn == 1) /* might be a little faster */
@@ -162,56 +374,49 @@ int find_winner_knn(struct entries *codes, struct data_entry *sample,
 
   dim = codes->dimension;
   
-  for (i = 0; i < knn; i++)
+  if (codes->block != NULL)
     {
-      win[i].index = -1;
-      win[i].winner = NULL;
-      win[i].diff = FLT_MAX;
-    }
-  /* Go through all code vectors */
+      /* Flat codebook: go through the rows of the block */
+      noc = codes->num_entries;
+      for (index = 0; index < noc; index++)
+	{
+	  difference = knn_dist(block_row(codes, index), sample, dim, bound,
+				&masked);
+	  if (masked == dim)
+	    return 0;
 
-  codetmp = rewind_entries(codes, &p);
+	  if (difference <= bound)
+	    {
+	      heap_winner(win, &n, knn, difference, index,
+			  &codes->units[index]);
+	      if (n == knn)
+		bound = win[0].diff;
+	    }
+	}
+    }
+  else
+    {
+      /* Go through all code vectors */
+      codetmp = rewind_entries(codes, &p);
   
-  while (codetmp != NULL) {
-    difference = 0.0;
-    
-    masked = 0;
-    /* Compute the distance between codebook and input entry */
-    for (i = 0; i < dim; i++)
-      {
+      while (codetmp != NULL) {
 	/* pitaisiko ottaa huomioon myos codebookissa olevat?? */
-	if ((sample->mask != NULL) && (sample->mask[i] != 0))
-	  {
-	    masked++;
-	    continue; /* ignore vector components that have 1 in mask */
-	  }
-	diff = codetmp->points[i] - sample->points[i];
-	difference += diff * diff;
-	if (difference > win[knn-1].diff) break;
-      }
-
-    if (masked == dim)
-      return 0;
+	difference = knn_dist(codetmp->points, sample, dim, bound, &masked);
+	if (masked == dim)
+	  return 0;
     
-    /* If distance is smaller than previous distances */
-    for (i = 0; (i < knn) && (difference > win[i].diff); i++);
-
-    if (i < knn) 
-      {
-	for (j = knn - 1; j > i; j--)
+	if (difference <= bound)
 	  {
-	    win[j].diff = win[j - 1].diff;
-	    win[j].index = win[j - 1].index;
-	    win[j].winner = win[j - 1].winner;
+	    heap_winner(win, &n, knn, difference, p.index, codetmp);
+	    if (n == knn)
+	      bound = win[0].diff;
 	  }
-
-	win[i].diff = difference;
-	win[i].index = p.index;
-	win[i].winner = codetmp;
-      }
     
-    codetmp = next_entry(&p);
-  }
+	codetmp = next_entry(&p);
+      }
+    }
+
+  sort_winners(win, n, knn);
   
   if (win->index < 0)
     ifverbose(3)
@@ -220,68 +425,17 @@ int find_winner_knn(struct entries *codes, struct data_entry *sample,
   return knn; /* number of neighbours */
 }
 
+/* find_winner_knn2 - like find_winner_knn but the distances are computed
+   with the vectorized kernels (see find_winner_simd). Masked samples
+   are handled there too. */
+
 int find_winner_knn2(struct entries *codes, struct data_entry *sample, 
 		     struct winner_info *win, int knn)
 {
-  struct data_entry *codetmp;
-  int dim, i, j;
-  float difference, diff, *s, *c;
-  eptr p;
-
-  if (sample->mask != NULL)
-    return find_winner_knn(codes, sample, win, knn);
-
-  if (knn == 1) /* might be a little faster */
+  if ((knn == 1) && (sample->mask == NULL)) /* might be a little faster */
     return find_winner_euc2(codes, sample, win, 1);
 
-  dim = codes->dimension;
-  
-  for (i = 0; i < knn; i++)
-    {
-      win[i].index = -1;
-      win[i].winner = NULL;
-      win[i].diff = FLT_MAX;
-    }
-  /* Go through all code vectors */
-
-  codetmp = rewind_entries(codes, &p);
-  
-  while (codetmp != NULL) {
-    difference = 0.0;
-    
-    /* Compute the distance between codebook and input entry */
-    c = codetmp->points; s = sample->points;
-    for (i = 0; i < dim; i++)
-      {
-	diff = *c++ - *s++;
-	difference += diff * diff;
-      }
-
-    /* If distance is smaller than previous distances */
-    for (i = 0; (i < knn) && (difference > win[i].diff); i++);
-
-    if (i < knn) 
-      {
-	for (j = knn - 1; j > i; j--)
-	  {
-	    win[j].diff = win[j - 1].diff;
-	    win[j].index = win[j - 1].index;
-	    win[j].winner = win[j - 1].winner;
-	  }
-
-	win[i].diff = difference;
-	win[i].index = p.index;
-	win[i].winner = codetmp;
-      }
-    
-    codetmp = next_entry(&p);
-  }
-  
-  if (win->index < 0)
-    ifverbose(3)
-      fprintf(stderr, "find_winner_knn: can't find winner\n");
-
-  return knn; /* number of neighbours */
+  return find_winner_simd(codes, sample, win, knn);
 }
 
 /* vector_dist_euc - compute distance between two vectors is euclidean
@@ -321,7 +475,7 @@ float vector_dist_euc2(struct data_entry *v1, struct data_entry *v2, int dim)
   int i;
 
   if ((v1->mask != NULL) || (v2->mask != NULL))
-    return vector_dist_euc(v1, v2, dim);
+    return vector_dist_simd(v1, v2, dim);
 
   difference = 0.0;
   for (x1 = v1->points, x2 = v2->points, i = 0; i < dim; i++)
@@ -356,7 +510,10 @@ void adapt_vector2(struct data_entry *codetmp, struct data_entry *sample,
   int i;
   float *c, *s;
   if (sample->mask != NULL)
-    adapt_vector(codetmp, sample, dim, alpha);
+    {
+      adapt_vector_simd(codetmp, sample, dim, alpha);
+      return;
+    }
 
   c = codetmp->points; s = sample->points;
   for (i = 0; i < dim; i++, c++) 
@@ -472,6 +629,13 @@ long orand()
   return((int) ((next = (next * 23) % 100000001) % RND_MAX));
 }
 
+/* orand_state - the state of orand(), restored with osrand() */
+
+unsigned long orand_state(void)
+{
+  return next;
+}
+
 /* init_random - initialize own random number generator with seed. 
    If seed is 0, uses current time as seed. */
 
@@ -657,6 +821,15 @@ int global_options(int argc, char **argv)
 
   verbose(oatoi(extract_parameter(argc, argv, VERBOSE, OPTION), 1));
 
+  /* number of threads, 0 is one per processor */
+  s = getenv("LVQSOM_THREADS");
+  if (s)
+    use_threads(atoi(s));
+
+  s = extract_parameter(argc, argv, "-threads", OPTION);
+  if (s)
+    use_threads(atoi(s));
+
   return 0;
 }  
 
@@ -866,6 +1039,460 @@ void free_snapshot(struct snapshot_info *shot)
     }
 }
 
+/* get_stop_info - allocate and initialize early stopping info. The
+   held-out data is read from 'filename' if it is not NULL. */
+
+struct stop_info *get_stop_info(char *filename, long interval,
+				float threshold, int type)
+{
+  struct stop_info *stop;
+
+  stop = malloc(sizeof(struct stop_info));
+  if (stop == NULL)
+    {
+      fprintf(stderr, "get_stop_info: Can't allocate structure\n");
+      ERROR(ERR_NOMEM);
+      return NULL;
+    }
+
+  stop->interval = interval;
+  stop->threshold = threshold;
+  stop->type = type;
+  stop->data = NULL;
+  stop->sum = 0.0;
+  stop->count = 0;
+  stop->best = DBL_MAX;
+  stop->calm = 0;
+  stop->smooth = -1.0;
+  stop->stop = -1;
+  stop->tail = 0;
+
+  if (filename)
+    {
+      if ((stop->data = open_entries(filename)) == NULL)
+	{
+	  fprintf(stderr, "get_stop_info: Can't open data file '%s'\n",
+		  filename);
+	  free(stop);
+	  return NULL;
+	}
+    }
+
+  ifverbose(2)
+    fprintf(stderr, "early stopping: interval: %ld, threshold: %g, data: %s\n",
+	    interval, threshold, filename ? filename : "training samples");
+
+  return stop;
+}
+
+/* free_stop_info - deallocate early stopping info */
+
+void free_stop_info(struct stop_info *stop)
+{
+  if (stop)
+    {
+      if (stop->data)
+	close_entries(stop->data);
+      free(stop);
+    }
+}
+
+/* stop_sample - add the error of a trained sample to the estimate. The
+   error comes from the winner search the training did anyway. */
+
+void stop_sample(struct stop_info *stop, float error)
+{
+  if (stop && (stop->data == NULL))
+    {
+      stop->sum += error;
+      stop->count++;
+    }
+}
+
+/* stop_time - the place in the schedule of a running length of
+   'length' for iteration le. After training has converged the rest of
+   the schedule is run faster. */
+
+long stop_time(struct stop_info *stop, long le, long length)
+{
+  if ((stop == NULL) || (stop->stop < 0) || (le <= stop->stop) ||
+      (stop->tail <= 0))
+    return le;
+
+  return stop->stop + (long) ((double) (le - stop->stop) *
+			      (length - stop->stop) / stop->tail);
+}
+
+/* held_out_error - the mean error of the held-out data with the current
+   codebook. Returns a negative value on error. */
+
+static double held_out_error(struct teach_params *teach,
+			     struct stop_info *stop)
+{
+  struct entries *codes = teach->codes;
+  WINNER_FUNCTION *find_winner = teach->winner;
+  struct data_entry *dtmp;
+  struct winner_info win;
+  struct winner_batch *batch;
+  double sum = 0.0;
+  long n = 0;
+  eptr p;
+
+  if ((dtmp = rewind_entries(stop->data, &p)) == NULL)
+    {
+      fprintf(stderr, "early stopping: can't get held-out data\n");
+      return -1.0;
+    }
+
+  if (stop->data->dimension != codes->dimension)
+    {
+      fprintf(stderr, "early stopping: held-out data and codebook vectors have different dimensions\n");
+      return -1.0;
+    }
+
+  batch = batch_winners(codes, stop->data, find_winner);
+
+  for (; dtmp != NULL; dtmp = next_entry(&p))
+    {
+      if (batch_winner(batch, codes, dtmp, &win, find_winner) == 0)
+	continue; /* ignore empty vectors */
+
+      if (stop->type == STOP_ACCURACY)
+	sum += (get_entry_label(win.winner) != get_entry_label(dtmp));
+      else
+	sum += sqrt((double) win.diff);
+      n++;
+    }
+  free_winner_batch(batch);
+
+  return (n > 0) ? sum / n : -1.0;
+}
+
+/* check_stop - estimate the error after le iterations when it is time
+   to. If the error is no longer improving, see struct stop_info, the
+   training is set to end after stop->tail more iterations: *end is set
+   to where the loop should end. Returns non-zero when that happens. */
+
+int check_stop(struct teach_params *teach, long le, long length, long *end)
+{
+  struct stop_info *stop = teach->stop;
+  double error;
+
+  if ((stop == NULL) || (stop->stop >= 0) || (stop->interval <= 0) ||
+      (le <= 0) || (le % stop->interval))
+    return 0;
+
+  if (stop->data)
+    error = held_out_error(teach, stop);
+  else
+    error = (stop->count > 0) ? stop->sum / stop->count : -1.0;
+  stop->sum = 0.0;
+  stop->count = 0;
+
+  if (error < 0.0)
+    return 0;
+
+  /* the estimates are smoothed so that noise doesn't look like
+     convergence */
+  if (stop->smooth >= 0.0)
+    error = STOP_SMOOTHING * stop->smooth + (1.0 - STOP_SMOOTHING) * error;
+  stop->smooth = error;
+
+  ifverbose(2)
+    fprintf(stderr, "early stopping: %s %g after %ld iterations\n",
+	    (stop->type == STOP_ACCURACY) ? "classification error" :
+	    "quantization error", error, le);
+
+  if ((stop->best < DBL_MAX) &&
+      (stop->best - error <= stop->threshold * stop->best))
+    stop->calm++;
+  else
+    stop->calm = 0;
+  if (error < stop->best)
+    stop->best = error;
+
+  if ((stop->calm < STOP_PATIENCE) || (le < STOP_MIN_FRACTION * length))
+    return 0;
+
+  stop->stop = le;
+  stop->tail = (long) (STOP_TAIL_FRACTION * (length - le));
+  if (stop->tail < stop->interval)
+    stop->tail = stop->interval;
+  if (stop->tail > length - le)
+    stop->tail = length - le;
+  *end = le + stop->tail;
+  ifverbose(1)
+    fprintf(stderr, "\nearly stopping: converged after %ld iterations, finishing in %ld\n",
+	    le, stop->tail);
+  return 1;
+}
+
+/* get_checkpoint - allocate and initialize checkpoint info */
+
+struct checkpoint_info *get_checkpoint(char *filename, long interval)
+{
+  struct checkpoint_info *ck;
+
+  ck = malloc(sizeof(struct checkpoint_info));
+  if (ck == NULL)
+    {
+      fprintf(stderr, "get_checkpoint: Can't allocate structure\n");
+      ERROR(ERR_NOMEM);
+      return NULL;
+    }
+
+  ck->filename = NULL;
+  if (filename)
+    if ((ck->filename = ostrdup(filename)) == NULL)
+      {
+	free(ck);
+	return NULL;
+      }
+  ck->interval = interval;
+  ck->iter = -1;
+  ck->length = 0;
+  ck->rand_load = ck->rand_now = 0;
+  ck->index = 0;
+  ck->has_stop = 0;
+  ck->alphas = NULL;
+  ck->num_alphas = 0;
+
+  return ck;
+}
+
+/* free_checkpoint - deallocate checkpoint info */
+
+void free_checkpoint(struct checkpoint_info *ck)
+{
+  if (ck)
+    {
+      ofree(ck->filename);
+      ofree(ck->alphas);
+      free(ck);
+    }
+}
+
+/* save_checkpoint - save the state of the training after iter
+   iterations. p points to the sample used last. alphas are the
+   learning rates of the noc codebook vectors in olvq1 or NULL. The
+   file is written under another name first so that a checkpoint is
+   never left half written. Returns non-zero on error. */
+
+int save_checkpoint(struct teach_params *teach, long iter, eptr *p,
+		    float *alphas, long noc)
+{
+  struct checkpoint_info *ck = teach->checkpoint;
+  struct entries *codes = teach->codes;
+  struct stop_info *stop = teach->stop;
+  struct data_entry *entry;
+  struct file_info *fi;
+  FILE *fp;
+  eptr cp;
+  char *tmpname;
+  long i;
+  int retcode = 0;
+
+  if ((tmpname = malloc(strlen(ck->filename) + 5)) == NULL)
+    {
+      fprintf(stderr, "save_checkpoint: Can't allocate mem for string\n");
+      return 1;
+    }
+  sprintf(tmpname, "%s.tmp", ck->filename);
+
+  if ((fi = open_file(tmpname, "w")) == NULL)
+    {
+      free(tmpname);
+      return 1;
+    }
+  fp = fi2fp(fi);
+
+  if (write_header(fi, codes))
+    {
+      fprintf(stderr, "save_checkpoint: Error writing headers\n");
+      retcode = 1;
+      goto end;
+    }
+
+  ifverbose(3)
+    fprintf(stderr, "saving checkpoint: file '%s', %ld iterations\n",
+	    ck->filename, iter);
+
+  fprintf(fp, "#CHECKPOINT FILE\n");
+  fprintf(fp, "#checkpoint iterations %ld %ld\n", iter, teach->length);
+  fprintf(fp, "#checkpoint random %lu %lu\n", teach->data->rand_state,
+	  orand_state());
+  fprintf(fp, "#checkpoint index %ld\n", p->index);
+  if (stop)
+    fprintf(fp, "#checkpoint stop %.17g %.17g %ld %ld %ld %ld\n",
+	    stop->best, stop->sum, stop->count, stop->stop, stop->tail,
+	    stop->calm);
+  if (alphas)
+    {
+      fprintf(fp, "#checkpoint alphas %ld", noc);
+      for (i = 0; i < noc; i++)
+	{
+	  if ((i % 8) == 0)
+	    fprintf(fp, "\n#checkpoint alpha");
+	  fprintf(fp, " %.9g", alphas[i]);
+	}
+      fprintf(fp, "\n");
+    }
+
+  /* all digits of the vectors */
+  for (entry = rewind_entries(codes, &cp); entry != NULL;
+       entry = next_entry(&cp))
+    if (write_entry_prec(fi, codes, entry, 9))
+      {
+	fprintf(stderr, "save_checkpoint: Error writing entry, aborting\n");
+	retcode = 1;
+	break;
+      }
+
+ end:
+  if (ferror(fp))
+    retcode = 1;
+  close_file(fi);
+  if ((retcode == 0) && rename(tmpname, ck->filename))
+    {
+      perror("save_checkpoint");
+      retcode = 1;
+    }
+  free(tmpname);
+  return retcode;
+}
+
+/* read_checkpoint - read the state of the training from a checkpoint
+   file. The codebook is read from the same file with open_entries.
+   Returns NULL on error. */
+
+struct checkpoint_info *read_checkpoint(char *filename)
+{
+  struct checkpoint_info *ck;
+  struct file_info *fi;
+  char line[1024], *s;
+  long i = 0, n;
+  int ok = 1;
+
+  if ((ck = get_checkpoint(NULL, 0)) == NULL)
+    return NULL;
+
+  if ((fi = open_file(filename, "r")) == NULL)
+    {
+      fprintf(stderr, "read_checkpoint: Can't open file '%s'\n", filename);
+      free_checkpoint(ck);
+      return NULL;
+    }
+
+  /* the state is in the comment lines after the header line */
+  if (fgets(line, sizeof(line), fi2fp(fi)) != NULL)
+    while (ok && (fgets(line, sizeof(line), fi2fp(fi)) != NULL) &&
+	   (line[0] == '#'))
+      {
+	if (strncmp(line, "#checkpoint ", 12))
+	  continue;
+	s = line + 12;
+	if (!strncmp(s, "iterations ", 11))
+	  ok = (sscanf(s + 11, "%ld %ld", &ck->iter, &ck->length) == 2);
+	else if (!strncmp(s, "random ", 7))
+	  ok = (sscanf(s + 7, "%lu %lu", &ck->rand_load, &ck->rand_now) == 2);
+	else if (!strncmp(s, "index ", 6))
+	  ok = (sscanf(s + 6, "%ld", &ck->index) == 1);
+	else if (!strncmp(s, "stop ", 5))
+	  {
+	    /* older checkpoints don't have the count of calm estimates */
+	    ck->stop.calm = 0;
+	    ok = ck->has_stop =
+	      (sscanf(s + 5, "%lf %lf %ld %ld %ld %ld", &ck->stop.best,
+		      &ck->stop.sum, &ck->stop.count, &ck->stop.stop,
+		      &ck->stop.tail, &ck->stop.calm) >= 5);
+	  }
+	else if (!strncmp(s, "alphas ", 7))
+	  {
+	    ok = (sscanf(s + 7, "%ld", &ck->num_alphas) == 1) &&
+	      (ck->num_alphas > 0) &&
+	      ((ck->alphas = malloc(ck->num_alphas * sizeof(float))) != NULL);
+	    i = 0;
+	  }
+	else if (!strncmp(s, "alpha ", 6) && (ck->alphas != NULL))
+	  {
+	    s += 6;
+	    while ((i < ck->num_alphas) &&
+		   (sscanf(s, "%f%ln", &ck->alphas[i], &n) == 1))
+	      {
+		s += n;
+		i++;
+	      }
+	  }
+      }
+  close_file(fi);
+
+  if (!ok || (ck->iter < 0) || ((ck->alphas != NULL) && (i != ck->num_alphas)))
+    {
+      fprintf(stderr, "read_checkpoint: '%s' is not a valid checkpoint file\n",
+	      filename);
+      free_checkpoint(ck);
+      return NULL;
+    }
+
+  return ck;
+}
+
+/* resume_data - put the data and orand() to the state they were in
+   when the checkpoint teach->resume was saved. *le is set to the
+   iterations done and *end to where the training loop ends. Returns
+   the sample to use next or NULL on error. */
+
+struct data_entry *resume_data(struct teach_params *teach, eptr *p,
+			       long *le, long *end)
+{
+  struct checkpoint_info *ck = teach->resume;
+  struct stop_info *stop = teach->stop;
+  struct entries *data = teach->data;
+  struct data_entry *sample;
+  long i;
+
+  if (ck->length != teach->length)
+    {
+      fprintf(stderr, "resume_data: the checkpoint is from training with running length %ld, not %ld\n",
+	      ck->length, teach->length);
+      return NULL;
+    }
+
+  /* load the data in the same order as before */
+  osrand((int) ck->rand_load);
+  if ((sample = rewind_entries(data, p)) == NULL)
+    return NULL;
+
+  for (i = 0; i < ck->index; i++)
+    if ((sample = next_entry(p)) == NULL)
+      {
+	fprintf(stderr, "resume_data: less data than when the checkpoint was saved\n");
+	return NULL;
+      }
+  osrand((int) ck->rand_now);
+
+  *le = ck->iter;
+  *end = teach->length;
+  if (stop && ck->has_stop)
+    {
+      stop->best = ck->stop.best;
+      stop->sum = ck->stop.sum;
+      stop->count = ck->stop.count;
+      stop->calm = ck->stop.calm;
+      stop->stop = ck->stop.stop;
+      stop->tail = ck->stop.tail;
+      if (stop->stop >= 0)
+	*end = stop->stop + stop->tail;
+    }
+
+  ifverbose(2)
+    fprintf(stderr, "resuming training after %ld iterations\n", *le);
+
+  if ((sample = next_entry(p)) == NULL)
+    sample = rewind_entries(data, p);
+  return sample;
+}
+
 /* get_type_by_id - search typelist for id */
 
 struct typelist *get_type_by_id(struct typelist *types, int id)
@@ -83,7 +83,17 @@ struct data_entry {
     struct data_entry *next;
     char   *mask;  /* if mask is present, ignore vector components marked 
 		      with nonzero */
+    float  *maskw; /* weights: 0.0 for masked components, 1.0 for others.
+		      Allocated together with the mask. */
     struct fixpoint *fixed;
+    long   bmu;    /* winner of the sample in the previous round of 
+		      training, -1 if not known */
+    struct {
+      unsigned int in_block : 1; /* entry and its points belong to the
+				    flat block of an entries-structure */
+      unsigned int mapped : 1;   /* points are in a memory mapped file,
+				    see binfile.h */
+    } flags;
   };
 
 struct entries {
@@ -107,11 +117,33 @@ struct entries {
     unsigned int labels_needed : 1; /* Set if labels are required */
   } flags;
   int lap;               /* how many times have all samples been used */
+  unsigned long rand_state; /* orand() state when the samples in memory
+			       started to be loaded, see rewind_entries */
   struct file_info *fi;  /* file info for file if needed */
+  struct bin_info *bin;  /* reading state of a binary file, see binfile.c */
   long buffer;           /* how many lines to read from file at one time */
   void *userdata;
+  /* Flat storage for codebooks. When block is non-NULL, the vectors of
+     all entries are stored row by row in one aligned block and the
+     entries themselves are in the array 'units', linked in order. The
+     points of each entry then point to its row in the block. */
+  float *block;          /* aligned vector data, num_entries rows */
+  long stride;           /* distance between rows in floats */
+  struct data_entry *units; /* per-unit entries (labels, masks etc.) */
+  void *block_mem;       /* unaligned allocation behind block */
+  /* Row of each unit in the block and the unit in each row, see
+     set_layout. NULL when the units are stored in their own order. */
+  long *slot, *unit_of;
+  /* Search index built over the block by some of the winner functions.
+     It is released with free_index when the block is freed. */
+  void *index;
+  void (*free_index)(void *index);
 };
 
+/* pointer to the vector of unit i of a flat codebook */
+#define block_row(e,i) ((e)->block + \
+  ((e)->slot ? (e)->slot[i] : (long)(i)) * (e)->stride)
+
 #define labels_needed(codes) ((codes)->flags.labels_needed = 1)
 
 /* structure used to get information about the winning entries. Also
@@ -183,6 +215,72 @@ struct snapshot_info {
 #define SNAPFLAG_NOWAIT 4       /* do not wait for previous save to complete */
 #endif
 
+/* Early stopping. Every 'interval' iterations the error of the map is
+   estimated, either from the samples trained since the last estimate
+   or from a held-out data set. When it has improved by less than
+   'threshold' (relative to the best error so far) STOP_PATIENCE times
+   in a row, and at least STOP_MIN_FRACTION of the training is done,
+   the rest of the alpha and radius schedule is run in STOP_TAIL_FRACTION
+   of the iterations left, but in no less than 'interval' iterations. */
+
+#ifndef STOP_PATIENCE
+#define STOP_PATIENCE 3
+#endif /* STOP_PATIENCE */
+
+#ifndef STOP_MIN_FRACTION
+#define STOP_MIN_FRACTION 0.5
+#endif /* STOP_MIN_FRACTION */
+
+/* weight of the earlier estimates in the smoothed one */
+
+#ifndef STOP_SMOOTHING
+#define STOP_SMOOTHING 0.5
+#endif /* STOP_SMOOTHING */
+
+#ifndef STOP_TAIL_FRACTION
+#define STOP_TAIL_FRACTION 0.5
+#endif /* STOP_TAIL_FRACTION */
+
+struct stop_info {
+  long interval;         /* iterations between the estimates */
+  float threshold;       /* smallest relative improvement */
+  int type;              /* what is measured */
+  struct entries *data;  /* held-out data, NULL to use the training samples */
+  double sum;            /* errors of the samples since the last estimate */
+  long count;
+  double best;           /* the smallest estimate so far */
+  double smooth;         /* the smoothed estimate, negative before any */
+  long calm;             /* estimates in a row that improved too little */
+  long stop;             /* iteration where training converged, -1 before */
+  long tail;             /* iterations left after that */
+};
+
+#define STOP_QERROR   1  /* quantization error */
+#define STOP_ACCURACY 2  /* classification error */
+
+/* Checkpoints. Unlike a snapshot, a checkpoint holds the whole state of
+   the training so that it can be resumed later with the same results:
+   the codebook with all digits, the iteration, the state of orand(),
+   the place in the data and the state of the early stopping and the
+   learning rates of olvq1. The same structure is used for saving
+   checkpoints (filename, interval) and for the state read from one. */
+
+struct checkpoint_info {
+  char *filename;        /* file to save the checkpoints to */
+  long interval;         /* save every 'interval' iterations */
+  long iter;             /* iterations done */
+  long length;           /* running length of the training */
+  unsigned long rand_load; /* orand() state when the data was loaded */
+  unsigned long rand_now;  /* orand() state after 'iter' iterations */
+  long index;            /* the sample used last since rewinding */
+  int has_stop;          /* is the early stopping state in 'stop' */
+  struct stop_info stop;
+  float *alphas;         /* learning rates of olvq1, NULL if none */
+  long num_alphas;
+};
+
+struct neigh_tables;
+
 struct teach_params {
   short topol;
   short neigh;
@@ -192,17 +290,31 @@ struct teach_params {
   NEIGH_ADAPT *neigh_adapt;   /* adapts weights */
   VECTOR_ADAPT *vector_adapt; /* adapt one vector */
   WINNER_FUNCTION *winner;    /* function to find winner */
+  WINNER_FUNCTION *knn_winner; /* function to find k nearest neighbours */
   ALPHA_FUNC *alpha_func;
   float radius;               /* initial radius (for SOM) */
   float alpha;                /* initial alpha value */
   long length;                /* length of training */
   int knn;                    /* nearest neighbours */
+  short local_search;         /* winner search from the previous winner */
+  float cutoff;               /* smallest gaussian neighbourhood adapted */
+  struct neigh_tables *tables; /* neighbourhood tables, NULL for shared */
+  int threads;                /* threads for the work of one sample */
+  short layout;               /* order of the units in the codebook block */
   struct entries *codes;
   struct entries *data;
   struct snapshot_info *snapshot;
+  struct stop_info *stop;     /* early stopping, NULL if not used */
+  struct checkpoint_info *checkpoint; /* saving checkpoints, NULL if not */
+  struct checkpoint_info *resume;     /* state to resume from or NULL */
   time_t start_time, end_time;
 };
 
+/* local winner search in SOM training */
+#define LOCAL_OFF    0   /* scan the whole map */
+#define LOCAL_EXACT  1   /* scan with the bound found near the old winner */
+#define LOCAL_APPROX 2   /* search only near the old winner */
+
 #define LOADMODE_ALL    0   
 #define LOADMODE_BUFFER 1  
 
@@ -244,8 +356,18 @@ extern int lvq_errno;
 #include "labels.h"
 
 WINNER_FUNCTION find_winner_euc, find_winner_knn;
-DIST_FUNCTION vector_dist_euc;
-VECTOR_ADAPT adapt_vector;
+WINNER_FUNCTION find_winner_euc2, find_winner_knn2;
+DIST_FUNCTION vector_dist_euc, vector_dist_euc2;
+VECTOR_ADAPT adapt_vector, adapt_vector2;
+void heap_winner(struct winner_info *heap, int *n, int knn, float difference,
+		 long index, struct data_entry *entry);
+void sort_winners(struct winner_info *heap, int n, int knn);
+
+/* the k nearest neighbour searches check every DIST_BLOCK components
+   whether the distance already exceeds that of the k:th best */
+#ifndef DIST_BLOCK
+#define DIST_BLOCK 16
+#endif /* DIST_BLOCK */
 
 /* useful general routines */
 void errormsg(char *msg);
@@ -263,6 +385,7 @@ extern int verbose_level;
 
 void osrand(int i);
 long orand();
+unsigned long orand_state(void);
 void init_random(int i);
 
 char *ostrdup(char *str);
@@ -279,6 +402,23 @@ int save_snapshot(struct teach_params *teach, long iter);
 struct snapshot_info *get_snapshot(char *filename, long interval, int type);
 void free_snapshot(struct snapshot_info *shot);
 
+/* Early stopping */
+struct stop_info *get_stop_info(char *filename, long interval,
+				float threshold, int type);
+void free_stop_info(struct stop_info *stop);
+void stop_sample(struct stop_info *stop, float error);
+long stop_time(struct stop_info *stop, long le, long length);
+int check_stop(struct teach_params *teach, long le, long length, long *end);
+
+/* Checkpoints */
+struct checkpoint_info *get_checkpoint(char *filename, long interval);
+struct checkpoint_info *read_checkpoint(char *filename);
+void free_checkpoint(struct checkpoint_info *ck);
+int save_checkpoint(struct teach_params *teach, long iter, eptr *p,
+		    float *alphas, long noc);
+struct data_entry *resume_data(struct teach_params *teach, eptr *p,
+			       long *le, long *end);
+
 
 /* typelist searches */
 struct typelist *get_type_by_id(struct typelist *types, int id);
@@ -498,7 +498,7 @@ struct mindists *med_distances(struct entries *codes, DIST_FUNCTION *distance)
 struct entries *lvq1_training(struct teach_params *teach)
 {
 
-  long le, total_length, length = teach->length;
+  long le, end, total_length, length = teach->length;
   int label, dim;
   int numofe;
   float shortest;
@@ -511,6 +511,8 @@ struct entries *lvq1_training(struct teach_params *teach)
   struct entries *data = teach->data;
   struct entries *codes = teach->codes;
   struct snapshot_info *snap = teach->snapshot;
+  struct stop_info *stop = teach->stop;
+  struct checkpoint_info *ck = teach->checkpoint;
   float alpha = teach->alpha;
   eptr p;
 
@@ -518,7 +520,13 @@ struct entries *lvq1_training(struct teach_params *teach)
   
   dim = codes->dimension;
 
-  if ((datatmp = rewind_entries(data, &p)) == NULL)
+  le = 0;
+  end = length;
+  if (teach->resume)
+    datatmp = resume_data(teach, &p, &le, &end);
+  else
+    datatmp = rewind_entries(data, &p);
+  if (datatmp == NULL)
     {
       fprintf(stderr, "lvq1_training: can't get data\n");
       return NULL;
@@ -526,7 +534,7 @@ struct entries *lvq1_training(struct teach_params *teach)
 
   numofe = data->flags.totlen_known ? data->num_entries : 0;
 
-  for (le = 0; le < length; le++, datatmp = next_entry(&p))
+  for (; le < end; le++, datatmp = next_entry(&p))
     {
       if (datatmp == NULL)
 	{
@@ -543,8 +551,9 @@ struct entries *lvq1_training(struct teach_params *teach)
       shortest = win.diff;
       best = win.winner;
       label = get_entry_label(best);
+      stop_sample(stop, label != get_entry_label(datatmp));
       
-      talpha = get_alpha(le, length, alpha);
+      talpha = get_alpha(stop_time(stop, le, length), length, alpha);
       
       /* Was the classification correct? If classification was
          correct; move towards, else move away */
@@ -567,6 +576,13 @@ struct entries *lvq1_training(struct teach_params *teach)
       }
 
       
+      check_stop(teach, le + 1, length, &end);
+
+      /* save the state of the training when needed */
+      if (ck && (((le + 1) % ck->interval) == 0))
+        if (save_checkpoint(teach, le + 1, &p, NULL, 0))
+          fprintf(stderr, "checkpoint failed\n");
+
       ifverbose(1) 
 	mprint(length - le);
     }
@@ -584,7 +600,7 @@ struct entries *lvq1_training(struct teach_params *teach)
 struct entries *olvq1_training(struct teach_params *teach, 
 			       char *infile, char *outfile)
 {
-  long i, le, noc, length = teach->length;
+  long i, le, end, noc, length = teach->length;
   int label;
   int numofe;
   int potobe, dim;
@@ -597,6 +613,8 @@ struct entries *olvq1_training(struct teach_params *teach,
   struct entries *data = teach->data;
   struct entries *codes = teach->codes;
   struct snapshot_info *snap = teach->snapshot;
+  struct stop_info *stop = teach->stop;
+  struct checkpoint_info *ck = teach->checkpoint;
   float alpha = teach->alpha;
   struct winner_info win;
   eptr p;
@@ -626,15 +644,34 @@ struct entries *olvq1_training(struct teach_params *teach,
     }
   }
 
-  if ((datatmp = rewind_entries(data, &p)) == NULL)
+  le = 0;
+  end = length;
+  if (teach->resume)
+    datatmp = resume_data(teach, &p, &le, &end);
+  else
+    datatmp = rewind_entries(data, &p);
+  if (datatmp == NULL)
     {
       fprintf(stderr, "olvq1_training: can't get data\n");
       return NULL;
     }
 
+  /* the learning rates are part of the state */
+  if (teach->resume && teach->resume->alphas)
+    {
+      if (teach->resume->num_alphas != noc)
+	{
+	  fprintf(stderr, "olvq1_training: the checkpoint is for %ld codebook vectors, not %ld\n",
+		  teach->resume->num_alphas, noc);
+	  return NULL;
+	}
+      for (i = 0; i < noc; i++)
+	talpha[i] = teach->resume->alphas[i];
+    }
+
   numofe = data->flags.totlen_known ? data->num_entries : 0;
 
-  for (le = 0; le < length; le++, datatmp = next_entry(&p))
+  for (; le < end; le++, datatmp = next_entry(&p))
     {
       if (datatmp == NULL)
 	{
@@ -652,6 +689,7 @@ struct entries *olvq1_training(struct teach_params *teach,
       best = win.winner;
       label = get_entry_label(best);
       potobe = win.index;
+      stop_sample(stop, label != get_entry_label(datatmp));
       
       /* Individual alphas for every codebook vector; */
       /* Was the classification correct?              */
@@ -684,6 +722,13 @@ struct entries *olvq1_training(struct teach_params *teach,
       }
 
       
+      check_stop(teach, le + 1, length, &end);
+
+      /* save the state of the training when needed */
+      if (ck && (((le + 1) % ck->interval) == 0))
+        if (save_checkpoint(teach, le + 1, &p, talpha, noc))
+          fprintf(stderr, "checkpoint failed\n");
+
       ifverbose(1)
 	mprint(length - le);
     }
@@ -702,7 +747,7 @@ struct entries *olvq1_training(struct teach_params *teach,
 struct entries *lvq2_training(struct teach_params *teach, float winlen)
 {
 
-  long le, total_length, numofe;
+  long le, end, total_length, numofe;
   int label, nlabel, datalabel, dim;
   float shortest, nshortest;
   float talpha;
@@ -716,6 +761,8 @@ struct entries *lvq2_training(struct teach_params *teach, float winlen)
   long length = teach->length;
   float alpha = teach->alpha;
   struct snapshot_info *snap = teach->snapshot;
+  struct stop_info *stop = teach->stop;
+  struct checkpoint_info *ck = teach->checkpoint;
   struct winner_info win[2];
   eptr p;
 
@@ -723,14 +770,20 @@ struct entries *lvq2_training(struct teach_params *teach, float winlen)
 
   total_length = length;
 
-  if ((datatmp = rewind_entries(data, &p)) == NULL)
+  le = 0;
+  end = length;
+  if (teach->resume)
+    datatmp = resume_data(teach, &p, &le, &end);
+  else
+    datatmp = rewind_entries(data, &p);
+  if (datatmp == NULL)
     {
       fprintf(stderr, "lvq2_training: can't get data\n");
       return NULL;
     }
   numofe = data->flags.totlen_known ? data->num_entries : 0;
 
-  for (le = 0; le < length; le++, datatmp = next_entry(&p))
+  for (; le < end; le++, datatmp = next_entry(&p))
     {
       if (datatmp == NULL)
 	{
@@ -744,7 +797,7 @@ struct entries *lvq2_training(struct teach_params *teach, float winlen)
 	}
       
       /* True alpha is decreasing linearly during the training */
-      talpha = get_alpha(le, length, alpha);
+      talpha = get_alpha(stop_time(stop, le, length), length, alpha);
       
       /* find two best mathing units */
       find_winners(codes, datatmp, win, 2);
@@ -758,6 +811,7 @@ struct entries *lvq2_training(struct teach_params *teach, float winlen)
       nlabel = get_entry_label(nbest);
       
       datalabel = get_entry_label(datatmp);
+      stop_sample(stop, label != datalabel);
       /* Corrections are made only if the two nearest codebook vectors
 	 belong to different classes, one of them correct, and if the
 	 input entry is located inside a window between the nearest codebook
@@ -793,6 +847,13 @@ struct entries *lvq2_training(struct teach_params *teach, float winlen)
 	    }
 	}
       
+      check_stop(teach, le + 1, length, &end);
+
+      /* save the state of the training when needed */
+      if (ck && (((le + 1) % ck->interval) == 0))
+        if (save_checkpoint(teach, le + 1, &p, NULL, 0))
+          fprintf(stderr, "checkpoint failed\n");
+
       ifverbose(1)
 	mprint(length - le);
     }
@@ -808,7 +869,7 @@ struct entries *lvq2_training(struct teach_params *teach, float winlen)
 struct entries *lvq3_training(struct teach_params *teach,
 			      float epsilon, float winlen)
 {
-  long le, numofe, total_length;
+  long le, end, numofe, total_length;
   int label, nlabel, datalabel, dim;
   float shortest, nshortest;
   float talpha;
@@ -819,6 +880,8 @@ struct entries *lvq3_training(struct teach_params *teach,
   struct entries *data = teach->data;
   struct entries *codes = teach->codes;
   struct snapshot_info *snap = teach->snapshot;
+  struct stop_info *stop = teach->stop;
+  struct checkpoint_info *ck = teach->checkpoint;
   long length = teach->length;
   float alpha = teach->alpha;
   struct winner_info win[2];
@@ -828,14 +891,20 @@ struct entries *lvq3_training(struct teach_params *teach,
   
   total_length = length;
 
-  if ((datatmp = rewind_entries(data, &p)) == NULL)
+  le = 0;
+  end = length;
+  if (teach->resume)
+    datatmp = resume_data(teach, &p, &le, &end);
+  else
+    datatmp = rewind_entries(data, &p);
+  if (datatmp == NULL)
     {
       fprintf(stderr, "lvq3_training: can't get data\n");
       return NULL;
     }
   numofe = data->flags.totlen_known ? data->num_entries : 0;
   
-  for (le = 0; le < length; le++, datatmp = next_entry(&p))
+  for (; le < end; le++, datatmp = next_entry(&p))
     {
       if (datatmp == NULL)
 	{
@@ -849,7 +918,7 @@ struct entries *lvq3_training(struct teach_params *teach,
 	}
       
       /* True alpha is decreasing linearly during the training */
-      talpha = get_alpha(le, length, alpha);
+      talpha = get_alpha(stop_time(stop, le, length), length, alpha);
       
       /* find two best mathing units */
       find_winners(codes, datatmp, win, 2);
@@ -863,6 +932,7 @@ struct entries *lvq3_training(struct teach_params *teach,
       nlabel = get_entry_label(nbest);
       
       datalabel = get_entry_label(datatmp);
+      stop_sample(stop, label != datalabel);
       /* Corrections are made if the two nearest codebook vectors
 	 belong to different classes, one of them correct, and if the
 	 input entry is located inside a window between the nearest codebook
@@ -906,6 +976,13 @@ struct entries *lvq3_training(struct teach_params *teach,
 	    }
 	}
       
+      check_stop(teach, le + 1, length, &end);
+
+      /* save the state of the training when needed */
+      if (ck && (((le + 1) % ck->interval) == 0))
+        if (save_checkpoint(teach, le + 1, &p, NULL, 0))
+          fprintf(stderr, "checkpoint failed\n");
+
       ifverbose(1)
 	mprint(length - le);
     }
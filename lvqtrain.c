@@ -59,6 +59,15 @@ static char *usage[] = {
   "  -snapfile filename    snapshot filename\n",
   "  -snapinterval integer interval between snapshots\n",
   "  -selfuncs name        select a set of functions\n",
+  "  -stopinterval integer estimate the classification error at this interval\n",
+  "                        and finish the training when it no longer improves\n",
+  "  -stopthreshold float  smallest relative improvement (default 0.001)\n",
+  "  -stopdata filename    held-out data for the estimate (default the samples\n",
+  "                        trained since the last estimate)\n",
+  "  -checkfile filename   checkpoint file, holds the whole state of training\n",
+  "  -checkinterval integer interval between checkpoints\n",
+  "  -resume filename      continue training from a checkpoint, with the same\n",
+  "                        parameters\n",
   NULL};
 
 
@@ -88,6 +97,13 @@ int main(int argc, char **argv)
   struct snapshot_info *snap = NULL;
   int snap_type;
   char *funcname = NULL;
+  long stop_interval;
+  float stop_threshold;
+  char *stop_file;
+  struct stop_info *stop = NULL;
+  long check_interval;
+  char *check_file, *resume_file;
+  struct checkpoint_info *ck = NULL, *resume = NULL;
 
   global_options(argc, argv);
   if (extract_parameter(argc, argv, "-help", OPTION2))
@@ -120,6 +136,7 @@ int main(int argc, char **argv)
   randomize = oatoi(rand_s, 0);
   buffer = oatoi(extract_parameter(argc, argv, "-buffer", OPTION), 0);
   alpha_s = extract_parameter(argc, argv, "-alpha_type", OPTION);
+  funcname = extract_parameter(argc, argv, "-selfuncs", OPTION);
 
   snapshot_file = extract_parameter(argc, argv, "-snapfile", OPTION);
   snapshot_interval = 
@@ -129,6 +146,17 @@ int main(int argc, char **argv)
     get_id_by_str(snapshot_list, 
                   extract_parameter(argc, argv, "-snaptype", OPTION));
 
+  stop_interval =
+    oatoi(extract_parameter(argc, argv, "-stopinterval", OPTION), 0);
+  stop_threshold =
+    oatof(extract_parameter(argc, argv, "-stopthreshold", OPTION), 0.001);
+  stop_file = extract_parameter(argc, argv, "-stopdata", OPTION);
+
+  check_file = extract_parameter(argc, argv, "-checkfile", OPTION);
+  check_interval =
+    oatoi(extract_parameter(argc, argv, "-checkinterval", OPTION), 0);
+  resume_file = extract_parameter(argc, argv, "-resume", OPTION);
+
   if (snapshot_interval)
     {
       if (snapshot_file == NULL)
@@ -141,6 +169,31 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+  if (stop_interval > 0)
+    {
+      stop = get_stop_info(stop_file, stop_interval, stop_threshold,
+			   STOP_ACCURACY);
+      if (stop == NULL)
+	exit(1);
+    }
+
+  if (check_interval > 0)
+    {
+      if (check_file == NULL)
+        {
+          check_file = out_code_file;
+          fprintf(stderr, "checkpoint file not specified, using '%s'\n", check_file);
+        }
+      if ((ck = get_checkpoint(check_file, check_interval)) == NULL)
+	exit(1);
+    }
+
+  /* the codebook is read from the checkpoint. olvq1 still looks for
+     the learning rates of -cin so that it is set up as before. */
+  if (resume_file)
+    if ((resume = read_checkpoint(resume_file)) == NULL)
+      exit(1);
+
   switch(lvqtype) 
     {
     case OLVQ1:
@@ -171,7 +224,7 @@ int main(int argc, char **argv)
 
   ifverbose(2)
     fprintf(stderr, "Codebook entries are read from file %s\n", in_code_file);
-  if ((codes = open_entries(in_code_file)) == NULL)
+  if ((codes = open_entries(resume_file ? resume_file : in_code_file)) == NULL)
     {
       fprintf(stderr, "Can't open code file '%s'\n", in_data_file);
       close_entries(data);
@@ -210,6 +263,9 @@ int main(int argc, char **argv)
   params.alpha_type = type_tmp->id;
   params.alpha_func = type_tmp->data;
   params.snapshot = snap;
+  params.stop = stop;
+  params.checkpoint = ck;
+  params.resume = resume;
 
   switch (lvqtype)
     {
@@ -221,11 +277,11 @@ int main(int argc, char **argv)
 			      out_code_file);
       break;
     case LVQ2:
-      params.winner = find_winner_knn;
+      params.winner = params.knn_winner;
       codes2 = lvq2_training(&params, winlen);
       break;
     case LVQ3:
-      params.winner = find_winner_knn;
+      params.winner = params.knn_winner;
       codes2 = lvq3_training(&params, epsilon, winlen);
       break;
     default:
@@ -250,6 +306,12 @@ int main(int argc, char **argv)
 
   close_entries(data);
   close_entries(codes);
+  if (stop)
+    free_stop_info(stop);
+  if (ck)
+    free_checkpoint(ck);
+  if (resume)
+    free_checkpoint(resume);
 
   return(0);
 }
@@ -0,0 +1,837 @@
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  prune_rout.c                                                        *
+ *   - winner search that skips distance computations with the        *
+ *     triangle inequality, using bounds kept for each sample between   *
+ *     the searches (Elkan, Hamerly)                                    *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "lvq_pak.h"
+#include "datafile.h"
+#include "prune_rout.h"
+
+/* For each sample the winner a and a lower bound l of the distances to
+   the other codebook vectors are remembered. A codebook vector c that
+   has moved a distance m(c) changes its distance to any sample at most
+   by m(c), so the sample has still the same winner if
+
+       d(a) < l - m
+
+   where m is the largest movement of the vectors other than a. The
+   exact distance d(a) is computed in any case, as the winner functions
+   return it; it is the upper bound of Hamerly's algorithm without the
+   loosening by the movement of a. Another bound is s(a), half the
+   distance from a to the nearest other vector, loosened by half of the
+   movements of a and of the others: if d(a) < s(a), no other vector
+   can be nearer. If neither holds, each vector is checked with its own
+   movement, d(a) < l - m(c) or 2 d(a) < d(a, c) - m(a) - m(c), so that
+   a vector that has moved much but is far away doesn't matter. When the
+   whole codebook is scanned, c is skipped if 2 d(best) < d(best, c)
+   with the distance table loosened in the same way (Elkan).
+
+   The movements are measured against a snapshot of the codebook, so
+   that a vector that moves back and forth doesn't loosen the bounds
+   more than its distance from the snapshot. Between the measurements
+   adapt_vector_prune adds each move to the path of the vector, and the
+   longest path is added to the movements. The bounds of the samples
+   are kept relative to the snapshot ref, which is taken again when the
+   vectors have moved from it on the average as far as the bounds are
+   above the winners; the distance table has its own snapshot. Nothing
+   is computed in advance for a search that can't reuse a bound: the
+   distance table is made when the first bound is checked. All bounds
+   have a margin for the rounding errors, so that the winners are the
+   same as from find_winner_euc. */
+
+static struct bound_state *current = NULL;
+static long searches = 0, computed = 0, total = 0;
+
+static void prune_report(void)
+{
+  ifverbose(1)
+    if (total > 0)
+      fprintf(stderr, "triangle inequality pruning: %ld searches, %ld of %ld distances computed (%.1f%% pruned)\n",
+	      searches, computed, total, 100.0 * (total - computed) / total);
+}
+
+/* margin for the rounding errors of a distance of dim components
+   summed in double */
+
+#define DBL_MARGIN(dim) (2 * ((dim) + 2) * DBL_EPSILON)
+
+/* the largest movement of the vectors other than a */
+
+#define others(dr, a) (((a) == (dr)->far) ? (dr)->far2 : (dr)->far1)
+
+/* take_snap - take a new snapshot of the codebook */
+
+static void take_snap(struct bound_state *st, struct drift *dr)
+{
+  long i;
+
+  for (i = 0; i < st->noc; i++)
+    {
+      memcpy(dr->snap + i * st->dim, block_row(st->codes, i),
+	     st->dim * sizeof(float));
+      dr->moved[i] = 0.0;
+    }
+  dr->far = -1;
+  dr->far1 = dr->far2 = dr->mean = 0.0;
+}
+
+/* measure - how far each vector is from the snapshot */
+
+static void measure(struct bound_state *st, struct drift *dr)
+{
+  long i;
+  int d;
+  float *c, *s;
+  double sum, diff, m;
+
+  dr->far = -1;
+  dr->far1 = dr->far2 = dr->mean = 0.0;
+  for (i = 0, s = dr->snap; i < st->noc; i++, s += st->dim)
+    {
+      c = block_row(st->codes, i);
+      for (sum = 0.0, d = 0; d < st->dim; d++)
+	{
+	  diff = (double) c[d] - s[d];
+	  sum += diff * diff;
+	}
+      m = dr->moved[i] = sqrt(sum) * (1.0 + DBL_MARGIN(st->dim));
+      dr->mean += m / st->noc;
+      if (m > dr->far1)
+	{
+	  dr->far2 = dr->far1;
+	  dr->far1 = m;
+	  dr->far = i;
+	}
+      else if (m > dr->far2)
+	dr->far2 = m;
+    }
+  computed += st->noc;
+}
+
+/* compute_pairs - distances between the codebook vectors. The rows are
+   computed against a copy of the codebook stored by components, so
+   that the innermost loop goes through the vectors. */
+
+static void compute_pairs(struct bound_state *st)
+{
+  long noc = st->noc, i, j;
+  int dim = st->dim, d;
+  float *c, *t, *row;
+  double *acc = st->acc, diff, ci, slack = 1.0 - DBL_MARGIN(dim) - FLT_EPSILON;
+
+  take_snap(st, &st->at_pairs);
+  for (i = 0; i < noc; i++)
+    for (c = block_row(st->codes, i), d = 0; d < dim; d++)
+      st->trans[d * noc + i] = c[d];
+
+  for (i = 0; i < noc; i++)
+    {
+      for (j = 0; j < noc; j++)
+	acc[j] = 0.0;
+      for (d = 0, t = st->trans; d < dim; d++, t += noc)
+	{
+	  ci = t[i];
+	  for (j = 0; j < noc; j++)
+	    {
+	      diff = t[j] - ci;
+	      acc[j] += diff * diff;
+	    }
+	}
+
+      /* rounded down, also when stored as float */
+      row = st->pair + i * noc;
+      st->half[i] = DBL_MAX;
+      st->nearest[i] = i;
+      for (j = 0; j < noc; j++)
+	{
+	  row[j] = sqrt(acc[j]) * slack;
+	  if ((j != i) && (row[j] < st->half[i]))
+	    {
+	      st->half[i] = row[j];
+	      st->nearest[i] = j;
+	    }
+	}
+      if (st->half[i] < DBL_MAX)
+	st->half[i] *= 0.5;
+    }
+
+  st->pairs_valid = 1;
+  st->pair_age = 0;
+  st->pair_saved = 0;
+  computed += noc * (noc - 1) / 2;
+}
+
+/* want_pairs - whether the distance table should be computed before
+   checking a bound. It is computed again only if the old one has saved
+   more distances than it took. */
+
+static int want_pairs(struct bound_state *st)
+{
+  if (st->pair == NULL)
+    return 0;
+  if (!st->pairs_valid)
+    return 1;
+  return ((st->pair_age >= PRUNE_REFRESH * st->noc) &&
+	  (2 * st->pair_saved >= st->noc * (st->noc - 1)) &&
+	  ((st->at_pairs.far1 > 0.0) || (st->odo_max > 0.0)));
+}
+
+/* new_epoch - measure the movements of the codebook and start the
+   paths from zero. If the bounds of the samples would no longer prune,
+   they are moved to a new snapshot. */
+
+static void new_epoch(struct bound_state *st)
+{
+  struct sample_bound *b;
+  long i;
+
+  measure(st, &st->ref);
+  if (st->pairs_valid)
+    measure(st, &st->at_pairs);
+  for (i = 0; i < st->noc; i++)
+    st->odo[i] = 0.0;
+  st->odo_max = 0.0;
+  st->age = 0;
+
+  if (st->ref.mean > st->slack)
+    {
+      for (i = 0, b = st->table; i < st->table_size; i++, b++)
+	if ((b->sample != NULL) && (b->index >= 0))
+	  b->lower -= others(&st->ref, b->index);
+      take_snap(st, &st->ref);
+    }
+}
+
+/* epoch_length - searches between the measurements. The measurements
+   and moving the bounds should cost a small part of the searches. */
+
+static long epoch_length(struct bound_state *st)
+{
+  long len;
+
+  len = 16 * st->table_used / ((long) st->noc * st->dim + 1);
+  return (len > PRUNE_EPOCH) ? len : PRUNE_EPOCH;
+}
+
+/* new_bound_state - set up the search state for a flat codebook.
+   Returns NULL on error. */
+
+struct bound_state *new_bound_state(struct entries *codes)
+{
+  struct bound_state *st;
+  long noc = codes->num_entries, n;
+  int dim = codes->dimension, pairs;
+
+  n = (noc * dim > 0) ? noc * dim : 1;
+  pairs = ((double) noc * noc <= PRUNE_MAX_PAIRS);
+  st = calloc(1, sizeof(struct bound_state));
+  if (st != NULL)
+    {
+      st->codes = codes;
+      st->noc = noc;
+      st->dim = dim;
+      st->ref.snap = malloc(n * sizeof(float));
+      st->ref.moved = malloc((noc > 0 ? noc : 1) * sizeof(double));
+      st->odo = calloc(noc > 0 ? noc : 1, sizeof(double));
+      if (pairs)
+	{
+	  st->at_pairs.snap = malloc(n * sizeof(float));
+	  st->at_pairs.moved = malloc((noc > 0 ? noc : 1) * sizeof(double));
+	  st->pair = malloc((noc > 0 ? noc * noc : 1) * sizeof(float));
+	  st->half = malloc((noc > 0 ? noc : 1) * sizeof(double));
+	  st->nearest = malloc((noc > 0 ? noc : 1) * sizeof(long));
+	  st->trans = malloc(n * sizeof(float));
+	  st->acc = malloc((noc > 0 ? noc : 1) * sizeof(double));
+	}
+      st->table_size = 1024;
+      st->table = calloc(st->table_size, sizeof(struct sample_bound));
+    }
+  if ((st == NULL) || (st->ref.snap == NULL) || (st->ref.moved == NULL) ||
+      (st->odo == NULL) || (st->table == NULL) ||
+      (pairs && ((st->at_pairs.snap == NULL) ||
+		 (st->at_pairs.moved == NULL) || (st->pair == NULL) ||
+		 (st->half == NULL) || (st->nearest == NULL) ||
+		 (st->trans == NULL) || (st->acc == NULL))))
+    {
+      fprintf(stderr, "new_bound_state: can't allocate memory\n");
+      free_bound_state(st);
+      ERROR(ERR_NOMEM);
+      return NULL;
+    }
+
+  take_snap(st, &st->ref);
+  return st;
+}
+
+void free_bound_state(void *state)
+{
+  struct bound_state *st = state;
+
+  if (st)
+    {
+      if (st == current)
+	current = NULL;
+      ofree(st->ref.snap);
+      ofree(st->ref.moved);
+      ofree(st->at_pairs.snap);
+      ofree(st->at_pairs.moved);
+      ofree(st->odo);
+      ofree(st->pair);
+      ofree(st->half);
+      ofree(st->nearest);
+      ofree(st->trans);
+      ofree(st->acc);
+      ofree(st->table);
+      free(st);
+    }
+}
+
+/* get_state - returns the search state of the codebook, setting it up
+   if needed. Returns NULL if the codebook should be scanned. */
+
+static struct bound_state *get_state(struct entries *codes)
+{
+  static int registered = 0;
+  struct bound_state *st;
+
+  if (codes->block == NULL)
+    return NULL;
+
+  if (codes->index != NULL)
+    {
+      if (codes->free_index != free_bound_state)
+	return NULL; /* some other index is in use */
+
+      st = codes->index;
+      if ((st->noc == codes->num_entries) && (st->dim == codes->dimension))
+	return (current = st);
+
+      free_bound_state(st);
+      codes->index = NULL;
+      codes->free_index = NULL;
+    }
+
+  if ((st = new_bound_state(codes)) == NULL)
+    return NULL;
+
+  codes->index = st;
+  codes->free_index = free_bound_state;
+  if (!registered)
+    {
+      atexit(prune_report);
+      registered = 1;
+    }
+  return (current = st);
+}
+
+/* hash_points - checksum of the components of a sample. The data
+   entries are reused when the data is read in buffered mode, so the
+   pointer alone doesn't identify the sample. */
+
+static unsigned long hash_points(float *points, int dim)
+{
+  unsigned long h = 2166136261UL;
+  unsigned int w;
+  int i;
+
+  for (i = 0; i < dim; i++)
+    {
+      memcpy(&w, points + i, sizeof(w));
+      h = (h ^ w) * 16777619UL;
+    }
+  return h;
+}
+
+#define slot_of(s, size) \
+  (((unsigned long) (s) >> 4) * 2654435761UL & ((size) - 1))
+
+/* find_bound - returns the place of the sample in the table, a new one
+   (with index -1) if the sample is not there or its components have
+   changed. Returns NULL on error. */
+
+static struct sample_bound *find_bound(struct bound_state *st,
+				       struct data_entry *sample)
+{
+  struct sample_bound *b, *old;
+  unsigned long h = hash_points(sample->points, st->dim);
+  long size, i;
+
+  if (2 * (st->table_used + 1) > st->table_size)
+    {
+      /* grow the table */
+      old = st->table;
+      size = st->table_size;
+      st->table = calloc(2 * size, sizeof(struct sample_bound));
+      if (st->table == NULL)
+	{
+	  fprintf(stderr, "find_bound: can't allocate memory\n");
+	  st->table = old;
+	  ERROR(ERR_NOMEM);
+	  return NULL;
+	}
+      st->table_size = 2 * size;
+      for (i = 0; i < size; i++)
+	if (old[i].sample != NULL)
+	  {
+	    b = st->table + slot_of(old[i].sample, st->table_size);
+	    while (b->sample != NULL)
+	      if (++b == st->table + st->table_size)
+		b = st->table;
+	    *b = old[i];
+	  }
+      free(old);
+    }
+
+  b = st->table + slot_of(sample, st->table_size);
+  while (b->sample != NULL)
+    {
+      if (b->sample == sample)
+	{
+	  if (b->hash != h)
+	    b->index = -1;
+	  b->hash = h;
+	  return b;
+	}
+      if (++b == st->table + st->table_size)
+	b = st->table;
+    }
+
+  b->sample = sample;
+  b->hash = h;
+  b->index = -1;
+  st->table_used++;
+  return b;
+}
+
+/* lookup_bound - returns the place of a sample already given to
+   find_bound, or NULL. Doesn't change the table, so the threads can
+   use it. */
+
+static struct sample_bound *lookup_bound(struct bound_state *st,
+					 struct data_entry *sample)
+{
+  struct sample_bound *b;
+
+  b = st->table + slot_of(sample, st->table_size);
+  while (b->sample != NULL)
+    {
+      if (b->sample == sample)
+	return b;
+      if (++b == st->table + st->table_size)
+	b = st->table;
+    }
+  return NULL;
+}
+
+/* dist2 - the squared distance as find_winner_euc computes it,
+   stopping when it exceeds limit */
+
+static float dist2(float *c, float *x, int dim, float limit)
+{
+  float diff, difference = 0.0;
+  int i;
+
+  for (i = 0; i < dim; i++)
+    {
+      diff = c[i] - x[i];
+      difference += diff * diff;
+      if (difference > limit) break;
+    }
+  return difference;
+}
+
+/* half_now - bound of half the distance from vector a to the nearest
+   other vector */
+
+static double half_now(struct bound_state *st, long a)
+{
+  return st->half[a] - 0.5 * (st->at_pairs.moved[a] +
+			      others(&st->at_pairs, a)) - st->odo_max;
+}
+
+/* set_lower - remember the bound of the distances to the others,
+   relative to the snapshot ref */
+
+static void set_lower(struct bound_state *st, struct sample_bound *b,
+		      long index, double lower)
+{
+  b->index = index;
+  if (lower < DBL_MAX)
+    b->lower = lower - others(&st->ref, index) - st->odo_max;
+  else
+    b->lower = DBL_MAX;
+}
+
+static void set_winner(struct entries *codes, struct winner_info *win,
+		       long index, float diff)
+{
+  win->index = index;
+  win->winner = &codes->units[index];
+  win->diff = diff;
+}
+
+/* check_each - the bounds loosened by the movement of each vector
+   instead of the largest one: a far vector that has moved much doesn't
+   matter. Returns non-zero if no vector can be nearer than da. */
+
+static int check_each(struct bound_state *st, struct sample_bound *b,
+		      double da)
+{
+  struct drift *at = &st->at_pairs;
+  long noc = st->noc, a = b->index, j;
+  float *pair = st->pairs_valid ? st->pair + a * noc : NULL;
+  double lower = b->lower - st->odo_max - da, near;
+
+  near = (pair != NULL) ? at->moved[a] + 2 * st->odo_max + 2 * da : 0.0;
+
+  /* the nearest vector is the most likely to be nearer */
+  j = (pair != NULL) ? st->nearest[a] : a;
+  if ((j != a) && (lower <= st->ref.moved[j]) &&
+      (pair[j] - at->moved[j] <= near))
+    return 0;
+
+  for (j = 0; j < noc; j++)
+    if ((j != a) && (lower <= st->ref.moved[j]) &&
+	((pair == NULL) || (pair[j] - at->moved[j] <= near)))
+      return 0;
+  return 1;
+}
+
+/* check_bound - computes the distance to the old winner of the sample
+   into *da and returns non-zero if the winner is still the same */
+
+static int check_bound(struct bound_state *st, struct sample_bound *b,
+		       float *x, float *da, struct prune_count *count)
+{
+  long a = b->index;
+  double e = 2 * (st->dim + 2) * FLT_EPSILON, lower, half;
+
+  *da = dist2(block_row(st->codes, a), x, st->dim, FLT_MAX);
+  count->computed++;
+
+  lower = b->lower - others(&st->ref, a) - st->odo_max;
+  if (st->pairs_valid)
+    {
+      half = half_now(st, a);
+      if (half > lower)
+	lower = half;
+    }
+
+  if (sqrt(*da) * (1.0 + e) < lower)
+    {
+      /* keep the tighter of the bounds */
+      lower -= others(&st->ref, a) + st->odo_max;
+      if (lower > b->lower)
+	b->lower = lower;
+      return 1;
+    }
+
+  return check_each(st, b, sqrt(*da) * (1.0 + e));
+}
+
+/* scan - go through the codebook, starting with the vector a at the
+   distance da (a < 0 if none). Returns the winner, its distance in
+   *bestd and a lower bound of the distances to the others in *low. */
+
+static long scan(struct bound_state *st, float *x, long a, float da,
+		 float *bestd, double *low, struct prune_count *count)
+{
+  struct drift *at = &st->at_pairs;
+  long noc = st->noc, best = a, j;
+  int dim = st->dim;
+  float d, *pair = st->pairs_valid ? st->pair : NULL;
+  double e = 2 * (dim + 2) * FLT_EPSILON, db, gap;
+
+  *bestd = (a >= 0) ? da : FLT_MAX;
+  *low = DBL_MAX;
+  db = sqrt(*bestd) * (1.0 + e);
+
+  for (j = 0; j < noc; j++)
+    {
+      if (j == a)
+	continue;
+
+      /* c_j is farther than best if d(best, c_j) > 2 d(best) */
+      if ((pair != NULL) && (best >= 0))
+	{
+	  gap = pair[best * noc + j] - at->moved[best] - at->moved[j] -
+	    2 * st->odo_max - db;
+	  if (gap > db)
+	    {
+	      if (gap < *low)
+		*low = gap;
+	      continue;
+	    }
+	}
+
+      d = dist2(block_row(st->codes, j), x, dim, *bestd);
+      count->computed++;
+      if ((d < *bestd) || ((d == *bestd) && (j < best)))
+	{
+	  if ((best >= 0) && (sqrt(*bestd) * (1.0 - e) < *low))
+	    *low = sqrt(*bestd) * (1.0 - e);
+	  best = j;
+	  *bestd = d;
+	  db = sqrt(d) * (1.0 + e);
+
+	  /* all the others are farther than 2 s(best) - d(best) */
+	  if ((pair != NULL) && (db < (gap = half_now(st, best))))
+	    {
+	      if (2 * gap - db < *low)
+		*low = 2 * gap - db;
+	      break;
+	    }
+	}
+      else if (sqrt(d) * (1.0 - e) < *low)
+	*low = sqrt(d) * (1.0 - e);
+    }
+
+  if ((best >= 0) && (*low < DBL_MAX))
+    {
+      count->slack += *low - db;
+      count->gaps++;
+    }
+  return best;
+}
+
+/* search - find the winner of an unmasked sample with the bound b from
+   find_bound (may be NULL). Returns 0 if no winner was found. */
+
+static int search(struct bound_state *st, struct sample_bound *b,
+		  float *x, struct winner_info *win, struct prune_count *count)
+{
+  long a = -1, best;
+  float da = FLT_MAX, bestd;
+  double low;
+
+  count->searches++;
+  if ((b != NULL) && (b->index >= 0))
+    {
+      if (check_bound(st, b, x, &da, count))
+	{
+	  set_winner(st->codes, win, b->index, da);
+	  return 1;
+	}
+      a = b->index;
+    }
+
+  if ((best = scan(st, x, a, da, &bestd, &low, count)) < 0)
+    return 0;
+
+  if (b != NULL)
+    set_lower(st, b, best, low);
+  set_winner(st->codes, win, best, bestd);
+  return 1;
+}
+
+/* prune_finish - add the work of the searches to the totals and to the
+   state. Not for the threads. */
+
+void prune_finish(struct bound_state *st, struct prune_count *count)
+{
+  double mean;
+
+  searches += count->searches;
+  computed += count->computed;
+  total += count->searches * st->noc;
+  st->pair_age += count->searches;
+  st->pair_saved += count->searches * st->noc - count->computed;
+  if (count->gaps > 0)
+    {
+      mean = count->slack / count->gaps;
+      st->slack += (mean - st->slack) * count->gaps /
+	(count->gaps + PRUNE_EPOCH);
+    }
+}
+
+/* find_winner_prune - find the nearest codebook vector, skipping the
+   distance computations that can't change the winner. Returns the same
+   winners as find_winner_euc (knn == 1) and find_winner_knn; only the
+   search for one winner of unmasked samples is pruned. */
+
+int find_winner_prune(struct entries *codes, struct data_entry *sample,
+		      struct winner_info *win, int knn)
+{
+  struct bound_state *st;
+  struct sample_bound *b;
+  struct prune_count count;
+  int found;
+
+  if (knn > 1)
+    return find_winner_knn(codes, sample, win, knn);
+
+  if ((sample->mask != NULL) || ((st = get_state(codes)) == NULL) ||
+      (st->noc == 0))
+    return find_winner_euc(codes, sample, win, 1);
+
+  if ((++st->age >= epoch_length(st)) && (st->odo_max > 0.0))
+    new_epoch(st);
+
+  b = find_bound(st, sample);
+  if ((b != NULL) && (b->index >= 0) && want_pairs(st))
+    compute_pairs(st);
+
+  memset(&count, 0, sizeof(count));
+  found = search(st, b, sample->points, win, &count);
+  prune_finish(st, &count);
+  if (!found)
+    return find_winner_euc(codes, sample, win, 1);
+  return 1;
+}
+
+/* prune_prepare - get the state ready for searching the samples in
+   threads with prune_search, prune_settled and prune_record. Returns
+   NULL on error. */
+
+struct bound_state *prune_prepare(struct entries *codes,
+				  struct data_entry **samples, long n)
+{
+  struct bound_state *st;
+  long i;
+
+  if ((st = get_state(codes)) == NULL)
+    return NULL;
+
+  if (st->odo_max > 0.0)
+    new_epoch(st);
+  if ((st->table_used > 0) && want_pairs(st))
+    compute_pairs(st);
+
+  for (i = 0; i < n; i++)
+    if ((samples[i]->mask == NULL) && (find_bound(st, samples[i]) == NULL))
+      return NULL;
+  return st;
+}
+
+/* prune_search - find the winner of a sample given to prune_prepare.
+   Returns like the winner functions. */
+
+int prune_search(struct bound_state *st, struct data_entry *sample,
+		 struct winner_info *win, struct prune_count *count)
+{
+  int found = 0;
+
+  if ((sample->mask == NULL) && (st->noc > 0))
+    found = search(st, lookup_bound(st, sample), sample->points, win,
+		   count);
+  if (!found)
+    return find_winner_euc(st->codes, sample, win, 1);
+  return 1;
+}
+
+/* prune_settled - returns non-zero if the bound of a sample given to
+   prune_prepare shows that its winner is the same; the winner is then
+   in win. Otherwise the winner must be searched and given to
+   prune_record. */
+
+int prune_settled(struct bound_state *st, struct data_entry *sample,
+		  struct winner_info *win, struct prune_count *count)
+{
+  struct sample_bound *b;
+  float da;
+
+  if ((sample->mask != NULL) ||
+      ((b = lookup_bound(st, sample)) == NULL) || (b->index < 0))
+    return 0;
+
+  if (!check_bound(st, b, sample->points, &da, count))
+    return 0;
+  count->searches++;
+  set_winner(st->codes, win, b->index, da);
+  return 1;
+}
+
+/* prune_record - remember the winner found for a sample, with a lower
+   bound of the distances to the others */
+
+void prune_record(struct bound_state *st, struct data_entry *sample,
+		  struct winner_info *win, double lower,
+		  struct prune_count *count)
+{
+  struct sample_bound *b;
+  double e = 2 * (st->dim + 2) * FLT_EPSILON;
+
+  count->searches++;
+  count->computed += st->noc;
+  if ((sample->mask != NULL) || (win->index < 0) ||
+      ((b = lookup_bound(st, sample)) == NULL))
+    return;
+
+  set_lower(st, b, win->index, lower);
+  if (lower < DBL_MAX)
+    {
+      count->slack += lower - sqrt(win->diff) * (1.0 + e);
+      count->gaps++;
+    }
+}
+
+/* adapt_vector_prune - adapt_vector that records how far the vector
+   moved. The arithmetic is the same as in adapt_vector. */
+
+void adapt_vector_prune(struct data_entry *codetmp, struct data_entry *sample,
+			int dim, float alpha)
+{
+  struct bound_state *st = current;
+  int i;
+  float old;
+  double move = 0.0, diff, *odo;
+
+  for (i = 0; i < dim; i++)
+    if ((sample->mask != NULL) && (sample->mask[i] != 0))
+      continue; /* ignore vector components that have 1 in mask */
+    else
+      {
+	old = codetmp->points[i];
+	codetmp->points[i] += alpha *
+	  (sample->points[i] - codetmp->points[i]);
+	diff = (double) codetmp->points[i] - old;
+	move += diff * diff;
+      }
+
+  if ((st == NULL) || (codetmp < st->codes->units) ||
+      (codetmp >= st->codes->units + st->noc))
+    return;
+
+  odo = st->odo + (codetmp - st->codes->units);
+  *odo += sqrt(move) * (1.0 + DBL_MARGIN(dim));
+  if (*odo > st->odo_max)
+    st->odo_max = *odo;
+}
+
+/* prune_moved - record changes of the codebook made without
+   adapt_vector_prune, like the updates of batch training. Returns
+   non-zero on error. */
+
+int prune_moved(struct entries *codes)
+{
+  if ((codes->index == NULL) || (codes->free_index != free_bound_state))
+    return 0;
+
+  new_epoch(codes->index);
+  return 0;
+}
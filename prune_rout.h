@@ -0,0 +1,120 @@
+#ifndef PRUNE_ROUT_H
+#define PRUNE_ROUT_H
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  prune_rout.h                                                        *
+ *   - header file for prune_rout.c: winner search with distance        *
+ *     bounds                                                           *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include "lvq_pak.h"
+
+/* the distances between the codebook vectors are kept for codebooks
+   of up to this many pairs of vectors */
+
+#ifndef PRUNE_MAX_PAIRS
+#define PRUNE_MAX_PAIRS 4194304
+#endif /* PRUNE_MAX_PAIRS */
+
+/* the distances between the codebook vectors are computed again after
+   this many searches per codebook vector, if the codebook has changed */
+
+#ifndef PRUNE_REFRESH
+#define PRUNE_REFRESH 16
+#endif /* PRUNE_REFRESH */
+
+/* least number of searches between the measurements of the codebook */
+
+#ifndef PRUNE_EPOCH
+#define PRUNE_EPOCH 64
+#endif /* PRUNE_EPOCH */
+
+/* what is remembered of a sample between the searches */
+
+struct sample_bound {
+  struct data_entry *sample;
+  unsigned long hash;     /* of the components, to notice reused entries */
+  long index;             /* the winner, -1 if not searched yet */
+  double lower;           /* lower bound of the distances to the reference
+			     positions of the other vectors */
+};
+
+/* how far the codebook vectors are from a snapshot */
+
+struct drift {
+  float *snap;            /* the snapshot */
+  double *moved;          /* distance of each vector from the snapshot */
+  long far;               /* the vector with the largest distance */
+  double far1, far2;      /* the largest and the second largest distance */
+  double mean;            /* the mean distance */
+};
+
+/* state of the search, kept as the index of the codebook */
+
+struct bound_state {
+  struct entries *codes;
+  long noc;
+  int dim;
+  struct drift ref;       /* the bounds of the samples are relative to
+			     this snapshot */
+  struct drift at_pairs;  /* the codebook when pair was computed */
+  double *odo;            /* length of the path of each vector since the
+			     drifts were measured */
+  double odo_max;         /* the longest of the paths */
+  long age;               /* searches since the drifts were measured */
+  double slack;           /* mean gap between the bound and the winner */
+  float *pair;            /* distances between the vectors, or NULL */
+  double *half;           /* half of the distance to the nearest other
+			     vector */
+  long *nearest;          /* the nearest other vector */
+  float *trans;           /* the codebook by components, for pair */
+  double *acc;            /* a row of pair being summed */
+  int pairs_valid;
+  long pair_age;          /* searches since pair was computed */
+  long pair_saved;        /* distances saved since then */
+  struct sample_bound *table;
+  long table_size, table_used;
+};
+
+/* work done in searches, collected separately by each thread */
+
+struct prune_count {
+  long searches, computed;
+  double slack;           /* sum of the gaps */
+  long gaps;
+};
+
+struct bound_state *new_bound_state(struct entries *codes);
+void free_bound_state(void *state);
+int prune_moved(struct entries *codes);
+struct bound_state *prune_prepare(struct entries *codes,
+				  struct data_entry **samples, long n);
+int prune_search(struct bound_state *st, struct data_entry *sample,
+		 struct winner_info *win, struct prune_count *count);
+int prune_settled(struct bound_state *st, struct data_entry *sample,
+		  struct winner_info *win, struct prune_count *count);
+void prune_record(struct bound_state *st, struct data_entry *sample,
+		  struct winner_info *win, double lower,
+		  struct prune_count *count);
+void prune_finish(struct bound_state *st, struct prune_count *count);
+
+WINNER_FUNCTION find_winner_prune;
+VECTOR_ADAPT adapt_vector_prune;
+
+#endif /* PRUNE_ROUT_H */
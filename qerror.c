@@ -36,6 +36,8 @@ static char *usage[] = {
   "Optional parameters:\n",
   "  -qetype 1             another way to calculate the error\n",
   "  -radius float         radius of neighborhood for alternative above\n",
+  "  -cutoff float         leave out the units where the gaussian neighborhood\n",
+  "                        is smaller than this (default 0)\n",
   "  -buffer integer       buffered reading of data, integer lines at a time\n",
   "  -selfuncs name        select a set of functions\n",
   NULL};
@@ -48,6 +50,7 @@ int main(int argc, char **argv)
   char *in_code_file;
   struct teach_params teach;
   int qmode;
+  float cutoff;
   struct entries *data, *codes;
   char *funcname = NULL;
   
@@ -63,6 +66,7 @@ int main(int argc, char **argv)
   buffer = oatoi(extract_parameter(argc, argv, "-buffer", OPTION), 0);
   teach.radius = oatof(extract_parameter(argc, argv, TRAINING_RADIUS, OPTION), 1.0);
   qmode = oatoi(extract_parameter(argc, argv, "-qetype", OPTION), 0);
+  cutoff = oatof(extract_parameter(argc, argv, "-cutoff", OPTION), 0.0);
   funcname = extract_parameter(argc, argv, "-selfuncs", OPTION);
 
   label_not_needed(1);
@@ -105,6 +109,7 @@ int main(int argc, char **argv)
 
   set_teach_params(&teach, codes, data, buffer, funcname);
   set_som_params(&teach);
+  teach.cutoff = cutoff;
 
   if (qmode > 0)
     qerror = find_qerror2(&teach);
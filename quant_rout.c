@@ -0,0 +1,309 @@
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  quant_rout.c                                                        *
+ *   - winner search over a copy of the codebook quantized to 8 bits,   *
+ *     with the best candidates compared again with exact distances     *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include "lvq_pak.h"
+#include "datafile.h"
+#include "vec_rout.h"
+#include "quant_rout.h"
+
+/* The quantized copy has a quarter of the size of the codebook, so a
+   scan reads that much less memory. Each component is scaled to the
+   range -127 ... 127 of its own values in the codebook. The sample is
+   scaled the same way (but not rounded), so that the distance to a
+   quantized vector is sum of scale^2 * (y - q)^2. The best candidates
+   of the scan are then compared with exact distances. The winner is
+   therefore nearly always the exact one, and a part of the searches
+   is checked against find_winner_euc to tell how often it is not.
+
+   The copy is made when first needed and thrown away when the codebook
+   changes; during training the codebook is scanned (see tree_rout.c). */
+
+static long adapt_count = 0, last_count = 0;
+static long checked = 0, differ = 0, searches = 0;
+static int rerank = -1, check_every = -1;
+
+static void quant_report(void)
+{
+  ifverbose(1)
+    if (checked > 0)
+      fprintf(stderr, "quantized search: %ld of %ld checked winners differ from the exact ones (%.2f%%)\n",
+	      differ, checked, 100.0 * differ / checked);
+}
+
+/* quantize_codebook - make the quantized copy of a flat codebook.
+   Returns NULL on error. */
+
+struct quant_codebook *quantize_codebook(struct entries *codes)
+{
+  struct quant_codebook *qc;
+  long noc = codes->num_entries, i;
+  int dim = codes->dimension, d;
+  float *c, lo, hi, x;
+
+  if (codes->block == NULL)
+    {
+      fprintf(stderr, "quantize_codebook: codebook is not flat\n");
+      return NULL;
+    }
+
+  qc = calloc(1, sizeof(struct quant_codebook));
+  if (qc != NULL)
+    {
+      qc->dim = dim;
+      qc->qdim = (dim + 15) & ~15;
+      qc->noc = noc;
+      qc->mid = malloc((dim > 0 ? dim : 1) * sizeof(float));
+      qc->scale = malloc((dim > 0 ? dim : 1) * sizeof(float));
+      qc->w = calloc(qc->qdim > 0 ? qc->qdim : 1, sizeof(float));
+      qc->q = calloc(noc * qc->qdim > 0 ? noc * qc->qdim : 1, 1);
+    }
+  if ((qc == NULL) || (qc->mid == NULL) || (qc->scale == NULL) ||
+      (qc->w == NULL) || (qc->q == NULL))
+    {
+      fprintf(stderr, "quantize_codebook: can't allocate memory\n");
+      free_quant_codebook(qc);
+      ERROR(ERR_NOMEM);
+      return NULL;
+    }
+
+  for (d = 0; d < dim; d++)
+    {
+      lo = FLT_MAX;
+      hi = -FLT_MAX;
+      for (i = 0; i < noc; i++)
+	{
+	  x = block_row(codes, i)[d];
+	  if (x < lo)
+	    lo = x;
+	  if (x > hi)
+	    hi = x;
+	}
+      qc->mid[d] = (noc > 0) ? 0.5 * (lo + hi) : 0.0;
+      qc->scale[d] = (hi > lo) ? (hi - lo) / 254.0 : 1.0;
+      qc->w[d] = qc->scale[d] * qc->scale[d];
+    }
+
+  for (i = 0; i < noc; i++)
+    for (c = block_row(codes, i), d = 0; d < dim; d++)
+      {
+	x = floor((c[d] - qc->mid[d]) / qc->scale[d] + 0.5);
+	qc->q[i * qc->qdim + d] = (x > 127) ? 127 : ((x < -127) ? -127 : x);
+      }
+
+  qc->stamp = adapt_count;
+
+  ifverbose(2)
+    fprintf(stderr, "quantized codebook of %ld vectors\n", noc);
+
+  return qc;
+}
+
+void free_quant_codebook(void *quant)
+{
+  struct quant_codebook *qc = quant;
+
+  if (qc)
+    {
+      ofree(qc->mid);
+      ofree(qc->scale);
+      ofree(qc->w);
+      ofree(qc->q);
+      free(qc);
+    }
+}
+
+/* get_quant - returns the quantized copy of the codebook, making it if
+   needed. Returns NULL if the codebook should be scanned. */
+
+static struct quant_codebook *get_quant(struct entries *codes)
+{
+  static int registered = 0;
+  struct quant_codebook *qc;
+  char *s;
+
+  if ((codes->block == NULL) || (codes->num_entries < QUANT_MIN_SIZE))
+    return NULL;
+
+  if (codes->index != NULL)
+    {
+      if (codes->free_index != free_quant_codebook)
+	return NULL; /* some other index is in use */
+
+      qc = codes->index;
+      if (qc->stamp == adapt_count)
+	return qc;
+
+      /* the codebook has changed */
+      free_quant_codebook(qc);
+      codes->index = NULL;
+      codes->free_index = NULL;
+    }
+
+  /* don't quantize while the codebook is being adapted */
+  if (last_count != adapt_count)
+    {
+      last_count = adapt_count;
+      return NULL;
+    }
+
+  if ((qc = quantize_codebook(codes)) == NULL)
+    return NULL;
+
+  codes->index = qc;
+  codes->free_index = free_quant_codebook;
+
+  if (!registered)
+    {
+      s = getenv("LVQSOM_QUANT_RERANK");
+      rerank = (s != NULL) ? atoi(s) : QUANT_RERANK;
+      if (rerank < 1)
+	rerank = 1;
+      s = getenv("LVQSOM_QUANT_CHECK");
+      check_every = (s != NULL) ? atoi(s) : QUANT_CHECK;
+      atexit(quant_report);
+      registered = 1;
+    }
+
+  return qc;
+}
+
+/* exact_dist - the distance as find_winner_euc computes it */
+
+static float exact_dist(float *c, float *x, int dim)
+{
+  float diff, difference = 0.0;
+
+  while (dim-- > 0)
+    {
+      diff = *c++ - *x++;
+      difference += diff * diff;
+    }
+  return difference;
+}
+
+/* find_winner_quant - find the knn nearest codebook vectors: the
+   quantized copy is scanned for the best rerank + knn - 1 candidates,
+   which are then ordered by their exact distances. Masked samples and
+   small codebooks are scanned with find_winner_euc and
+   find_winner_knn. */
+
+int find_winner_quant(struct entries *codes, struct data_entry *sample,
+		      struct winner_info *win, int knn)
+{
+  ROW_QDIST *qdist2 = current_kernels()->qdist2;
+  struct quant_codebook *qc;
+  struct winner_info *cand, exact;
+  int dim = codes->dimension, ncand, n, m, j, d;
+  long i, best;
+  float difference, bound, *y, *x = sample->points;
+
+  if (knn < 1)
+    knn = 1;
+
+  if ((sample->mask != NULL) || ((qc = get_quant(codes)) == NULL))
+    {
+      if (knn == 1)
+	return find_winner_euc(codes, sample, win, 1);
+      return find_winner_knn(codes, sample, win, knn);
+    }
+
+  ncand = rerank + knn - 1;
+  if (ncand > qc->noc)
+    ncand = qc->noc;
+  y = calloc(qc->qdim > 0 ? qc->qdim : 1, sizeof(float));
+  cand = malloc(ncand * sizeof(struct winner_info));
+  if ((y == NULL) || (cand == NULL))
+    {
+      fprintf(stderr, "find_winner_quant: can't allocate memory\n");
+      ofree(y);
+      ofree(cand);
+      ERROR(ERR_NOMEM);
+      return 0;
+    }
+
+  /* the sample in the scale of the quantized vectors */
+  for (d = 0; d < dim; d++)
+    y[d] = (x[d] - qc->mid[d]) / qc->scale[d];
+
+  for (n = 0, i = 0; i < qc->noc; i++)
+    {
+      difference = qdist2(qc->q + i * qc->qdim, y, qc->w, qc->qdim);
+      if ((n < ncand) || (difference <= cand[0].diff))
+	heap_winner(cand, &n, ncand, difference, i, NULL);
+    }
+
+  /* exact distances of the candidates */
+  if (knn == 1)
+    {
+      bound = FLT_MAX;
+      best = -1;
+      for (j = 0; j < n; j++)
+	{
+	  difference = exact_dist(block_row(codes, cand[j].index), x, dim);
+	  if ((difference < bound) ||
+	      ((difference == bound) && (cand[j].index < best)))
+	    {
+	      bound = difference;
+	      best = cand[j].index;
+	    }
+	}
+      win->index = best;
+      win->winner = &codes->units[best];
+      win->diff = bound;
+    }
+  else
+    {
+      for (m = 0, j = 0; j < n; j++)
+	heap_winner(win, &m, knn,
+		    exact_dist(block_row(codes, cand[j].index), x, dim),
+		    cand[j].index, &codes->units[cand[j].index]);
+      sort_winners(win, m, knn);
+    }
+  free(y);
+  free(cand);
+
+  /* compare now and then against the exact search */
+  if ((check_every > 0) && ((searches++ % check_every) == 0))
+    {
+      checked++;
+      if (find_winner_euc(codes, sample, &exact, 1) &&
+	  (exact.diff != win->diff))
+	differ++;
+    }
+
+  return (knn == 1) ? 1 : knn;
+}
+
+/* adapt_vector_quant - adapt_vector that lets the search know that the
+   codebook has changed */
+
+void adapt_vector_quant(struct data_entry *codetmp, struct data_entry *sample,
+			int dim, float alpha)
+{
+  adapt_count++;
+  adapt_vector(codetmp, sample, dim, alpha);
+}
@@ -0,0 +1,68 @@
+#ifndef QUANT_ROUT_H
+#define QUANT_ROUT_H
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  quant_rout.h                                                        *
+ *   - header file for quant_rout.c: search with a quantized codebook   *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include "lvq_pak.h"
+
+/* codebooks smaller than this are always scanned */
+
+#ifndef QUANT_MIN_SIZE
+#define QUANT_MIN_SIZE 64
+#endif /* QUANT_MIN_SIZE */
+
+/* default number of candidates compared with exact distances, can be
+   changed with the environment variable LVQSOM_QUANT_RERANK */
+
+#ifndef QUANT_RERANK
+#define QUANT_RERANK 4
+#endif /* QUANT_RERANK */
+
+/* by default every QUANT_CHECK'th winner is compared against the exact
+   one, can be changed with the environment variable LVQSOM_QUANT_CHECK
+   (0 turns the checking off) */
+
+#ifndef QUANT_CHECK
+#define QUANT_CHECK 16
+#endif /* QUANT_CHECK */
+
+/* codebook quantized to 8 bits per component. Component d of a vector
+   is mid[d] + scale[d] * q[d]. The vectors are padded with zeros to a
+   multiple of 16 components, w is zero for the padding. */
+
+struct quant_codebook {
+  int dim;
+  int qdim;               /* dim rounded up to a multiple of 16 */
+  long noc;
+  float *mid, *scale;
+  float *w;               /* scale^2 */
+  signed char *q;         /* the vectors, qdim bytes each */
+  long stamp;             /* adaptations done when the copy was made */
+};
+
+struct quant_codebook *quantize_codebook(struct entries *codes);
+void free_quant_codebook(void *quant);
+
+WINNER_FUNCTION find_winner_quant;
+VECTOR_ADAPT adapt_vector_quant;
+
+#endif /* QUANT_ROUT_H */
@@ -147,7 +147,7 @@ int main(int argc, char **argv)
 
   set_teach_params(&params, codes, data, 0, funcname); 
   params.knn = knn;
-  params.winner = find_winner_knn;
+  params.winner = params.knn_winner;
   codes = find_labels(&params);
 
   ifverbose(2)
@@ -28,6 +28,10 @@
 #include "lvq_pak.h"
 #include "som_rout.h"
 #include "datafile.h"
+#include "bmu_rout.h"
+#include "vec_rout.h"
+#include "thread_rout.h"
+#include "prune_rout.h"
 
 /*---------------------------------------------------------------------*/
 
@@ -60,30 +64,12 @@ struct entries *randinit_codes(struct entries *data, int topol, int neigh,
   codes->neigh = neigh;
 
   /* allocate codebook entries */
-  if ((entr = alloc_entry(codes)) == NULL)
-    {
-      fprintf(stderr, "randinit_codes: can't allocate memory for codebook vector\n");
-      close_entries(codes);
-      return NULL;
-    }
-  codes->entries = entr;
-
-  for (i = 1; i < noc; i++) 
-    {
-      entr->next = alloc_entry(codes);
-      entr = entr->next;
-      if (entr == NULL)
-	break;
-    }
-
-  if (entr == NULL)
+  if (alloc_block_entries(codes, noc) == NULL)
     {
       fprintf(stderr, "randinit_codes: can't allocate codebook\n");
       close_entries(codes);
       return NULL;
     }
-
-  codes->num_entries = noc;
   
   /* Find the maxim and minim values of data */
 
@@ -208,140 +194,448 @@ int gram_schmidt(float *v, int n, int e)
   return 0;
 }
 
-struct data_entry *find_eigenvectors(struct entries *data)
+/* Principal components for the linear initialization. The covariance
+   matrix of the data is never formed, it is only multiplied by a
+   block of PCA_BLOCK orthonormal vectors Q, one pass over the data for
+   each product:
+
+     C Q = 1/N sum (x - m) ((x - m)' Q)
+
+   Masked components count as no deviation from the mean, which gives
+   the same products as the covariance of the unmasked component
+   pairs. A pass is split between use_threads() threads, first by the
+   samples (the projections) and then by the components (the sums),
+   so every sum is taken in the order of the data and the result
+   doesn't depend on the number of threads. The block is iterated with
+   Rayleigh-Ritz steps until the two largest Ritz pairs converge.
+
+   The vectors are stored by the components: q[d * nvec + v] is
+   component d of vector v. */
+
+struct pca_state {
+  int dim, nvec;
+  double *mean;                 /* the mean of the data */
+  long *count;                  /* unmasked values per component */
+  double *q;                    /* the orthonormal block */
+  double *w;                    /* sums of the products with the block */
+  struct data_entry **samples;  /* the samples of the current chunk */
+  long n;
+  double *proj;                 /* projections of the chunk on the block */
+};
+
+/* pca_sums - add the chunk to the sums of a part of the components */
+
+static void pca_sums(void *arg, int thread, int nthreads)
 {
-  int n=data->dimension;
-  float *r=(float*)malloc(n*n*sizeof(float));
-  float *m=(float*)malloc(n*sizeof(float));
-  float *u=(float*)malloc(2*n*sizeof(float));
-  float *v=(float*)malloc(2*n*sizeof(float));
-  float mu[2];
-  struct data_entry *ptr, *tmp;
-  float sum;
-  long i, j;
-  long *k2, k;
-  eptr p;
-  char *mask;
+  struct pca_state *ps = arg;
+  struct data_entry *s;
+  long i, d, start, end;
+
+  thread_range(ps->dim, thread, nthreads, &start, &end);
+
+  for (i = 0; i < ps->n; i++)
+    {
+      s = ps->samples[i];
+      for (d = start; d < end; d++)
+	if ((s->mask == NULL) || (s->mask[d] == 0))
+	  {
+	    ps->mean[d] += s->points[d];
+	    ps->count[d]++;
+	  }
+    }
+}
 
-  if (r==NULL || m==NULL || u==NULL || v==NULL ) goto everror;
+/* pca_project - project a part of the chunk on the block */
 
-  for (i=0; i<n*n; i++) 
-    r[i]=0.0;
-  for (i=0; i<n; i++) 
-    m[i]=0.0;
+static void pca_project(void *arg, int thread, int nthreads)
+{
+  struct pca_state *ps = arg;
+  int nvec = ps->nvec, v;
+  struct data_entry *s;
+  long i, d, start, end;
+  double x, *proj, *q;
 
-  k2 = malloc(n *sizeof(long));
-  if (k2 == NULL)
-    goto everror;
-  memset(k2, 0, n * sizeof(long));
+  thread_range(ps->n, thread, nthreads, &start, &end);
 
-  if ((ptr=rewind_entries(data, &p)) == NULL)
+  for (i = start; i < end; i++)
     {
-      fprintf(stderr, "find_eigenvectors: can't get data\n");
-      goto everror;
+      s = ps->samples[i];
+      proj = ps->proj + i * nvec;
+      for (v = 0; v < nvec; v++)
+	proj[v] = 0.0;
+      for (d = 0; d < ps->dim; d++)
+	{
+	  if ((s->mask != NULL) && s->mask[d])
+	    continue;
+	  x = s->points[d] - ps->mean[d];
+	  q = ps->q + d * nvec;
+	  for (v = 0; v < nvec; v++)
+	    proj[v] += x * q[v];
+	}
     }
+}
+
+/* pca_product - add the chunk to a part of the components of the
+   product */
 
-  for (k=0; ptr != NULL; k++, ptr=next_entry(&p))
+static void pca_product(void *arg, int thread, int nthreads)
+{
+  struct pca_state *ps = arg;
+  int nvec = ps->nvec, v;
+  struct data_entry *s;
+  long i, d, start, end;
+  double x, *proj, *w;
+
+  thread_range(ps->dim, thread, nthreads, &start, &end);
+
+  for (i = 0; i < ps->n; i++)
     {
-      mask = ptr->mask;
-      for (i=0; i<n; i++)
-	if ((!mask) || (mask && (mask[i] == 0)))
-	  {
-	    m[i]+=ptr->points[i]; /* masked components have the value 0 so they
-				     don't affect the sum */
-	    k2[i]++;
-	  }
+      s = ps->samples[i];
+      proj = ps->proj + i * nvec;
+      for (d = start; d < end; d++)
+	{
+	  if ((s->mask != NULL) && s->mask[d])
+	    continue;
+	  x = s->points[d] - ps->mean[d];
+	  w = ps->w + d * nvec;
+	  for (v = 0; v < nvec; v++)
+	    w[v] += x * proj[v];
+	}
     }
+}
 
-  if (k<3) goto everror;
-
-  for (i=0; i<n; i++)
-    m[i]/=k2[i];
+/* pca_pass - go through the data once, summing up the data (product
+   = 0) or the product of the covariance and the block (product = 1).
+   Returns the number of samples or -1 on error. */
 
-  free(k2); k2 = NULL;
+static long pca_pass(struct entries *data, struct pca_state *ps,
+		     int product, int nthreads)
+{
+  struct data_entry *sample;
+  eptr p;
+  long k = 0;
 
-  if ((ptr=rewind_entries(data, &p)) == NULL)
+  if ((sample = rewind_entries(data, &p)) == NULL)
     {
       fprintf(stderr, "find_eigenvectors: can't get data\n");
-      goto everror;
+      return -1;
     }
 
-  for (; ptr != NULL; ptr=next_entry(&p))
+  /* In buffered mode the samples are valid only until the next part
+     of the file is read, so the chunks end there. */
+  for (ps->n = 0; sample != NULL; sample = next_entry(&p))
     {
-      mask = ptr->mask;
-      for (i=0; i<n; i++)
+      ps->samples[ps->n++] = sample;
+      if ((ps->n == BATCH_CHUNK) || (sample->next == NULL))
 	{
-	  /* the components that are masked off are ignored */
-	  if (mask && (mask[i] != 0))
-	    continue;
-	  for (j=i; j<n; j++)
-	    if (mask && (mask[j] != 0))
-	      continue;
-	    else
-	      r[i*n+j]+=(ptr->points[i]-m[i])*(ptr->points[j]-m[j]);
+	  if (product)
+	    {
+	      run_threads(pca_project, ps, nthreads);
+	      run_threads(pca_product, ps, nthreads);
+	    }
+	  else
+	    run_threads(pca_sums, ps, nthreads);
+	  k += ps->n;
+	  ps->n = 0;
 	}
     }
 
-  for (i=0; i<n; i++)
-    for (j=i; j<n; j++)
-      r[j*n+i]=r[i*n+j]/=k;
+  return k;
+}
 
-  for (i=0; i<2; i++) {
-    for (j=0; j<n; j++) u[i*n+j]=orand()/16384.0-1.0;
-    normalize(u+i*n, n);
-    mu[i]=1.0;
-  }
+/* pca_orthonormalize - make the vectors of the block orthonormal. A
+   vector that falls into the span of the earlier ones is replaced by
+   a random one. */
+
+static void pca_orthonormalize(double *q, int dim, int nvec)
+{
+  int v, u, tries;
+  long d;
+  double dot, norm, norm0;
+
+  for (v = 0; v < nvec; v++)
+    for (tries = 0; tries < 10; tries++)
+      {
+	norm0 = 0.0;
+	for (d = 0; d < dim; d++)
+	  norm0 += q[d * nvec + v] * q[d * nvec + v];
+
+	for (u = 0; u < v; u++)
+	  {
+	    dot = 0.0;
+	    for (d = 0; d < dim; d++)
+	      dot += q[d * nvec + u] * q[d * nvec + v];
+	    for (d = 0; d < dim; d++)
+	      q[d * nvec + v] -= dot * q[d * nvec + u];
+	  }
+
+	norm = 0.0;
+	for (d = 0; d < dim; d++)
+	  norm += q[d * nvec + v] * q[d * nvec + v];
+
+	if ((norm > 0.0) && (norm > 1e-20 * norm0))
+	  {
+	    norm = sqrt(norm);
+	    for (d = 0; d < dim; d++)
+	      q[d * nvec + v] /= norm;
+	    break;
+	  }
+
+	for (d = 0; d < dim; d++)
+	  q[d * nvec + v] = orand() / 16384.0 - 1.0;
+      }
+}
+
+/* pca_jacobi - eigenvalues and eigenvectors of the symmetric n x n
+   matrix a. The eigenvalues are left on the diagonal of a and the
+   eigenvectors in the columns of v. */
+
+static void pca_jacobi(double *a, double *v, int n)
+{
+  int i, j, k, sweep;
+  double off, diag, theta, t, c, s, x, y;
+
+  for (i = 0; i < n * n; i++)
+    v[i] = 0.0;
+  for (i = 0; i < n; i++)
+    v[i * n + i] = 1.0;
 
-  for (k=0; k<10; k++) {
-    for (i=0; i<2; i++)
-      for (j=0; j<n; j++)
-	v[i*n+j]=mu[i]*dotprod(r+j*n, u+i*n, n)+u[i*n+j];
+  for (sweep = 0; sweep < 50; sweep++)
+    {
+      off = diag = 0.0;
+      for (i = 0; i < n; i++)
+	{
+	  diag += a[i * n + i] * a[i * n + i];
+	  for (j = i + 1; j < n; j++)
+	    off += a[i * n + j] * a[i * n + j];
+	}
+      if (off <= 1e-30 * diag)
+	break;
 
-    gram_schmidt(v, n, 2);
+      for (i = 0; i < n; i++)
+	for (j = i + 1; j < n; j++)
+	  {
+	    if (a[i * n + j] == 0.0)
+	      continue;
+	    theta = (a[j * n + j] - a[i * n + i]) / (2.0 * a[i * n + j]);
+	    t = 1.0 / (fabs(theta) + sqrt(theta * theta + 1.0));
+	    if (theta < 0.0)
+	      t = -t;
+	    c = 1.0 / sqrt(t * t + 1.0);
+	    s = t * c;
+	    for (k = 0; k < n; k++)
+	      {
+		x = a[k * n + i];
+		y = a[k * n + j];
+		a[k * n + i] = c * x - s * y;
+		a[k * n + j] = s * x + c * y;
+	      }
+	    for (k = 0; k < n; k++)
+	      {
+		x = a[i * n + k];
+		y = a[j * n + k];
+		a[i * n + k] = c * x - s * y;
+		a[j * n + k] = s * x + c * y;
+	      }
+	    for (k = 0; k < n; k++)
+	      {
+		x = v[k * n + i];
+		y = v[k * n + j];
+		v[k * n + i] = c * x - s * y;
+		v[k * n + j] = s * x + c * y;
+	      }
+	  }
+    }
+}
 
-    sum=0.0;
-    for (i=0; i<2; i++) {
-      for (j=0; j<n; j++)
-	sum+=fabs(v[i*n+j]/dotprod(r+j*n, v+i*n, n));
+/* find_eigenvectors - the mean of the data and the two principal
+   directions, scaled by the standard deviations along them. Returns a
+   list of three entries or NULL. */
 
-      mu[i]=sum/n;
+struct data_entry *find_eigenvectors(struct entries *data)
+{
+  int n = data->dimension, nvec, nthreads, iter, i, j, b;
+  struct pca_state ps;
+  struct data_entry *ptr = NULL, *tmp;
+  double h[PCA_BLOCK * PCA_BLOCK], s[PCA_BLOCK * PCA_BLOCK];
+  double theta[PCA_BLOCK], res[2], row[PCA_BLOCK], cy, x;
+  double *y = NULL;
+  int order[PCA_BLOCK];
+  long k, d;
+
+  if (n < 2)
+    {
+      fprintf(stderr, "find_eigenvectors: data dimension must be at least 2\n");
+      return NULL;
     }
 
-    memcpy(u, v, 2*n*sizeof(float));
-  }
+  nvec = (n < PCA_BLOCK) ? n : PCA_BLOCK;
+  nthreads = use_threads(-1);
+
+  memset(&ps, 0, sizeof(ps));
+  ps.dim = n;
+  ps.nvec = nvec;
+  ps.mean = calloc(n, sizeof(double));
+  ps.count = calloc(n, sizeof(long));
+  ps.q = malloc(n * nvec * sizeof(double));
+  ps.w = malloc(n * nvec * sizeof(double));
+  ps.samples = malloc(BATCH_CHUNK * sizeof(struct data_entry *));
+  ps.proj = malloc(BATCH_CHUNK * nvec * sizeof(double));
+  y = malloc(2 * n * sizeof(double));
+  if ((ps.mean == NULL) || (ps.count == NULL) || (ps.q == NULL) ||
+      (ps.w == NULL) || (ps.samples == NULL) || (ps.proj == NULL) ||
+      (y == NULL))
+    {
+      fprintf(stderr, "find_eigenvectors: can't allocate memory\n");
+      ERROR(ERR_NOMEM);
+      goto everror;
+    }
+
+  /* the mean, masked components have the value 0 so they don't affect
+     the sums */
+  if ((k = pca_pass(data, &ps, 0, nthreads)) < 0)
+    goto everror;
+  if (k < 3)
+    goto everror;
+
+  for (d = 0; d < n; d++)
+    if (ps.count[d] > 0)
+      ps.mean[d] /= ps.count[d];
+
+  for (d = 0; d < n * nvec; d++)
+    ps.q[d] = orand() / 16384.0 - 1.0;
+  pca_orthonormalize(ps.q, n, nvec);
+
+  for (iter = 1; ; iter++)
+    {
+      memset(ps.w, 0, n * nvec * sizeof(double));
+      if (pca_pass(data, &ps, 1, nthreads) < 0)
+	goto everror;
+      for (d = 0; d < n * nvec; d++)
+	ps.w[d] /= k;
+
+      /* the block projected on itself */
+      for (i = 0; i < nvec; i++)
+	for (j = 0; j < nvec; j++)
+	  {
+	    x = 0.0;
+	    for (d = 0; d < n; d++)
+	      x += ps.q[d * nvec + i] * ps.w[d * nvec + j];
+	    h[i * nvec + j] = x;
+	  }
+      for (i = 0; i < nvec; i++)
+	for (j = i + 1; j < nvec; j++)
+	  h[i * nvec + j] = h[j * nvec + i] =
+	    0.5 * (h[i * nvec + j] + h[j * nvec + i]);
+
+      pca_jacobi(h, s, nvec);
+
+      /* the Ritz values from the largest down */
+      for (i = 0; i < nvec; i++)
+	{
+	  theta[i] = h[i * nvec + i];
+	  order[i] = i;
+	}
+      for (i = 1; i < nvec; i++)
+	for (j = i; (j > 0) && (theta[order[j]] > theta[order[j - 1]]); j--)
+	  {
+	    b = order[j];
+	    order[j] = order[j - 1];
+	    order[j - 1] = b;
+	  }
+
+      /* The two first Ritz vectors and their residuals, and the next
+	 block: the product with the Ritz vectors. */
+      res[0] = res[1] = 0.0;
+      for (d = 0; d < n; d++)
+	{
+	  for (i = 0; i < nvec; i++)
+	    {
+	      cy = x = 0.0;
+	      for (b = 0; b < nvec; b++)
+		{
+		  cy += ps.w[d * nvec + b] * s[b * nvec + order[i]];
+		  x += ps.q[d * nvec + b] * s[b * nvec + order[i]];
+		}
+	      if (i < 2)
+		{
+		  y[i * n + d] = x;
+		  x = cy - theta[order[i]] * x;
+		  res[i] += x * x;
+		}
+	      row[i] = cy;
+	    }
+	  memcpy(ps.q + d * nvec, row, nvec * sizeof(double));
+	}
+      res[0] = sqrt(res[0]);
+      res[1] = sqrt(res[1]);
+
+      ifverbose(3)
+	fprintf(stderr, "PCA iteration %d: eigenvalues %g %g, residuals %g %g\n",
+		iter, theta[order[0]], theta[order[1]], res[0], res[1]);
+
+      if ((res[0] <= PCA_TOL * theta[order[0]]) &&
+	  (res[1] <= PCA_TOL * theta[order[0]]))
+	{
+	  ifverbose(2)
+	    fprintf(stderr, "PCA converged in %d iterations\n", iter);
+	  break;
+	}
+      if (iter >= PCA_MAX_ITER)
+	{
+	  ifverbose(2)
+	    fprintf(stderr, "PCA not converged in %d iterations\n", iter);
+	  break;
+	}
+
+      pca_orthonormalize(ps.q, n, nvec);
+    }
+
+  if ((theta[order[0]] <= 0.0) || (theta[order[1]] <= 0.0))
+    goto everror;
 
-  if (mu[0]==0.0 || mu[1]==0.0) goto everror;
-  
   ptr = tmp = alloc_entry(data);
-  memcpy(tmp->points, m, n*sizeof(float));
+  if (ptr == NULL)
+    {
+      fprintf(stderr, "find_eigenvectors: can't allocate vector\n");
+      goto everror;
+    }
+  for (d = 0; d < n; d++)
+    tmp->points[d] = ps.mean[d];
 
-  for (i=0; i<2; i++) {
-    tmp->next=alloc_entry(data);
-    tmp=tmp->next;
+  for (i = 0; i < 2; i++) {
+    tmp->next = alloc_entry(data);
+    tmp = tmp->next;
     if (tmp == NULL)
       {
 	fprintf(stderr, "find_eigenvectors: can't allocate vector\n");
 	goto everror;
       }
-    memcpy(tmp->points, u+n*i, n*sizeof(float));
-    for (j=0; j<n; j++)
-      tmp->points[j]/=sqrt(mu[i]);
+    x = sqrt(theta[order[i]]);
+    for (d = 0; d < n; d++)
+      tmp->points[d] = y[i * n + d] * x;
   }
   tmp->next = NULL;
 
-  ofree(v);
-  ofree(u);
-  ofree(m);
-  ofree(r);
+  free(y);
+  free(ps.proj);
+  free(ps.samples);
+  free(ps.w);
+  free(ps.q);
+  free(ps.count);
+  free(ps.mean);
   return (ptr);
 
  everror:
-  if (v!=NULL) ofree(v);
-  if (u!=NULL) ofree(u);
-  if (m!=NULL) ofree(m);
-  if (r!=NULL) ofree(r);
+  if (ptr != NULL) free_entrys(ptr);
+  if (y != NULL) free(y);
+  if (ps.proj != NULL) free(ps.proj);
+  if (ps.samples != NULL) free(ps.samples);
+  if (ps.w != NULL) free(ps.w);
+  if (ps.q != NULL) free(ps.q);
+  if (ps.count != NULL) free(ps.count);
+  if (ps.mean != NULL) free(ps.mean);
   return (NULL);
-
 }
 
 struct entries *lininit_codes(struct entries *data, int topol, int neigh, 
@@ -369,7 +663,6 @@ struct entries *lininit_codes(struct entries *data, int topol, int neigh,
   codes->ydim = ydim;
   codes->topol = topol;
   codes->neigh = neigh;
-  codes->num_entries = number_of_codes;
 
   /* Find the middle point and two eigenvectors of the data */
   mean = find_eigenvectors(data);
@@ -382,23 +675,7 @@ struct entries *lininit_codes(struct entries *data, int topol, int neigh,
   eigen2 = eigen1->next;
 
   /* allocate codebook entries */
-  if ((entr = alloc_entry(codes)) == NULL)
-    {
-      fprintf(stderr, "lininit_codes: can't allocate memory for codebook vector\n");
-      close_entries(codes);
-      return NULL;
-    }
-  codes->entries = entr;
-
-  for (i = 1; i < number_of_codes; i++) 
-    {
-      entr->next = alloc_entry(codes);
-      entr = entr->next;
-      if (entr == NULL)
-	break;
-    }
-
-  if (entr == NULL)
+  if (alloc_block_entries(codes, number_of_codes) == NULL)
     {
       fprintf(stderr, "lininit_codes: can't allocate codebook\n");
       free_entrys(mean);
@@ -428,6 +705,107 @@ struct entries *lininit_codes(struct entries *data, int topol, int neigh,
   return(codes);
 }
 
+/* resample_row - interpolate linearly along row y of a map at the
+   place x of the row (in units, 0 ... xdim - 1) and add w times the
+   result to v */
+
+static void resample_row(struct entries *codes, int y, float x, float w,
+			 float *v)
+{
+  int x0, x1, i, dim = codes->dimension;
+  float t, *c0, *c1;
+
+  if (x < 0.0)
+    x = 0.0;
+  if (x > codes->xdim - 1)
+    x = codes->xdim - 1;
+  x0 = (int) x;
+  x1 = (x0 + 1 < codes->xdim) ? x0 + 1 : x0;
+  t = x - x0;
+
+  c0 = block_row(codes, x0 + y * codes->xdim);
+  c1 = block_row(codes, x1 + y * codes->xdim);
+  for (i = 0; i < dim; i++)
+    v[i] += w * ((1.0 - t) * c0[i] + t * c1[i]);
+}
+
+/* resample_codes - make a map of size xdim x ydim from a flat map of
+   another size by interpolating between its units. The maps are laid
+   over each other so that their corner units meet; on a hexagonal map
+   the odd rows are half a unit to the right. Returns NULL on error. */
+
+struct entries *resample_codes(struct entries *codes, int xdim, int ydim)
+{
+  struct entries *new;
+  long i, noc;
+  int dim = codes->dimension, x, y, y0;
+  float shift, from_w, to_w, px, py, t, *v;
+
+  noc = (long) xdim * ydim;
+
+  if (codes->block == NULL)
+    {
+      fprintf(stderr, "resample_codes: codebook is not flat\n");
+      return NULL;
+    }
+
+  if ((new = alloc_entries()) == NULL)
+    {
+      fprintf(stderr, "resample_codes: can't allocate memory for codes\n");
+      return NULL;
+    }
+
+  new->dimension = dim;
+  new->flags.loadmode = LOADMODE_ALL;
+  new->xdim = xdim;
+  new->ydim = ydim;
+  new->topol = codes->topol;
+  new->neigh = codes->neigh;
+
+  if (alloc_block_entries(new, noc) == NULL)
+    {
+      fprintf(stderr, "resample_codes: can't allocate codebook\n");
+      close_entries(new);
+      return NULL;
+    }
+
+  /* widths of the maps from the first unit of a row to the last unit
+     of the other rows */
+  shift = ((codes->topol == TOPOL_HEXA) && (ydim > 1)) ? 0.5 : 0.0;
+  to_w = xdim - 1 + shift;
+  shift = ((codes->topol == TOPOL_HEXA) && (codes->ydim > 1)) ? 0.5 : 0.0;
+  from_w = codes->xdim - 1 + shift;
+
+  for (i = 0; i < noc; i++)
+    {
+      x = i % xdim;
+      y = i / xdim;
+      v = block_row(new, i);
+      memset(v, 0, dim * sizeof(float));
+
+      /* place of the unit on the old map */
+      px = x;
+      if ((codes->topol == TOPOL_HEXA) && (y & 1))
+	px += 0.5;
+      px = (to_w > 0.0) ? px * from_w / to_w : 0.0;
+      py = (ydim > 1) ? (float) y * (codes->ydim - 1) / (ydim - 1) : 0.0;
+
+      y0 = (int) py;
+      if (y0 > codes->ydim - 1)
+	y0 = codes->ydim - 1;
+      t = py - y0;
+      shift = ((codes->topol == TOPOL_HEXA) && (y0 & 1)) ? 0.5 : 0.0;
+      resample_row(codes, y0, px - shift, 1.0 - t, v);
+      if ((t > 0.0) && (y0 + 1 < codes->ydim))
+	{
+	  shift = ((codes->topol == TOPOL_HEXA) && ((y0 + 1) & 1)) ? 0.5 : 0.0;
+	  resample_row(codes, y0 + 1, px - shift, t, v);
+	}
+    }
+
+  return new;
+}
+
 
 /*---------------------------------------------------------------------*/
 
@@ -467,123 +845,1814 @@ float rect_dist(int bx, int by, int tx, int ty)
   return(ret);
 }
 
-/* Adaptation function for bubble-neighborhood */
+/* Neighbourhoods as row spans. The units within radius of a winner at
+   (bx, by) are, on each row by + dy, the units bx + lo ... bx + hi.
+   The spans depend only on the radius and, on a hexagonal map, on the
+   parity of by, so they are computed with the map distance function
+   itself and reused for as long as the radius doesn't cross the
+   distance of any unit, i.e. while rmin <= radius < rmax. */
 
-void bubble_adapt(struct teach_params *teach, struct data_entry *sample,
-		  int bx, int by, float radius, float alpha)
+struct neigh_spans {
+  MAPDIST_FUNCTION *dist;
+  float rmin, rmax;       /* the radii giving the same spans */
+  int xdim, ydim;
+  int ry;                 /* rows by - ry ... by + ry */
+  int *lo, *hi;           /* [parity][dy + ry], lo > hi if the row is empty */
+};
+
+/* Gaussian neighbourhood as a table. The map distances of the units
+   around a winner at (bx, by) are tabulated by the offset (dx, dy) and
+   the parity of by; they don't depend on the radius, so the table is
+   only made larger when the window grows. For each radius the columns
+   where the kernel exp(-d^2 / 2r^2) can be at least the cutoff are
+   found, and units where it is smaller are left out. The kernel values
+   themselves are computed when a row is first visited with the radius,
+   so that online training, where the radius changes with every sample,
+   computes them only for the units it adapts. */
+
+struct gauss_table {
+  MAPDIST_FUNCTION *dist;
+  float radius, cutoff;
+  int xdim, ydim;
+  int rx, ry;             /* the offsets -rx ... rx, -ry ... ry */
+  int sx, sy;             /* the tables have offsets -sx ... sx, -sy ... sy */
+  int *lo, *hi;           /* [parity][dy + sy], the columns to visit */
+  float *d;               /* [parity][dy + sy][dx + sx], the map distances */
+  float *w;               /* the kernel values, like d */
+  int *wlo, *whi;         /* [parity][dy + sy], the columns of w computed */
+};
+
+/* The tables last used, kept in teach->tables or, if that is NULL, in
+   shared_tables. Threads that adapt at the same time have their own. */
+
+struct neigh_tables {
+  struct neigh_spans spans;
+  struct gauss_table gauss;
+};
+
+static struct neigh_tables shared_tables;
+
+static struct neigh_tables *tables_of(struct teach_params *teach)
 {
-  long index;
-  int tx, ty, xdim;
-  struct entries *codes = teach->codes;
-  MAPDIST_FUNCTION *dist = teach->mapdist;
-  struct data_entry *codetmp;
-  VECTOR_ADAPT *adapt = teach->vector_adapt;
-  eptr p;
+  return (teach->tables != NULL) ? teach->tables : &shared_tables;
+}
 
-  xdim = codes->xdim;
-  
-  ifverbose(10)
-    fprintf(stderr, "Best match in %d, %d\n", bx, by);
+/* new_neigh_tables - empty tables for teach->tables. Returns NULL if
+   there is no memory. */
 
-  codetmp = rewind_entries(codes, &p);
-  index = 0;
-  
-  while (codetmp != NULL)
-    {
-      tx = index % xdim;
-      ty = index / xdim;
-      
-      if (dist(bx, by, tx, ty) <= radius) {
-	ifverbose(11)
-	  fprintf(stderr, "Adapt unit %d, %d\n", tx, ty);
-	
-	adapt(codetmp, sample, codes->dimension, alpha);
+struct neigh_tables *new_neigh_tables(void)
+{
+  return calloc(1, sizeof(struct neigh_tables));
+}
 
-      }
-      codetmp = next_entry(&p);
-      index++;
+void free_neigh_tables(struct neigh_tables *nt)
+{
+  if (nt)
+    {
+      ofree(nt->spans.lo);
+      ofree(nt->spans.hi);
+      ofree(nt->gauss.lo);
+      ofree(nt->gauss.hi);
+      ofree(nt->gauss.d);
+      ofree(nt->gauss.w);
+      ofree(nt->gauss.wlo);
+      ofree(nt->gauss.whi);
+      free(nt);
     }
 }
 
+/* get_spans - the spans for the current radius. Returns NULL if the
+   codebook is not a flat map or there is no memory, in which case all
+   units are checked. */
 
-/* Adaptation function for gaussian neighbourhood */
-     
-void gaussian_adapt(struct teach_params *teach, struct data_entry *sample,
-		    int bx, int by, float radius, float alpha)
+static struct neigh_spans *get_spans(struct teach_params *teach, float radius)
 {
-  long index;
-  int tx, ty, xdim;
-  float dd;
-  float alp;
   struct entries *codes = teach->codes;
   MAPDIST_FUNCTION *dist = teach->mapdist;
-  VECTOR_ADAPT *adapt = teach->vector_adapt;
-  struct data_entry *codetmp;
-  eptr p;
+  int xdim = codes->xdim, ydim = codes->ydim;
+  int rx, ry, par, dx, dy, *lo, *hi;
+  float d, rmin, rmax;
+  struct neigh_spans *spans = &tables_of(teach)->spans;
 
-  xdim = codes->xdim;
+  if ((codes->block == NULL) || (dist == NULL) ||
+      (codes->num_entries != (long) xdim * ydim))
+    return NULL;
 
-  ifverbose(10)
-    fprintf(stderr, "Best match in %d, %d\n", bx, by);
+  if ((spans->lo != NULL) && (spans->dist == dist) &&
+      (spans->xdim == xdim) && (spans->ydim == ydim) &&
+      (spans->rmin <= radius) && (radius < spans->rmax))
+    return spans;
 
-  codetmp = rewind_entries(codes, &p);
-  index = 0;
+  /* the rows are at least sqrt(0.75) apart and the columns 1 apart,
+     less half a unit on odd rows; the window is also limited to the
+     size of the map */
+  rx = (radius + 1.0 < xdim) ? (int) radius + 1 : xdim;
+  ry = (radius / 0.866 + 1.0 < ydim) ? (int) (radius / 0.866) + 1 : ydim;
 
-  while (codetmp != NULL)
+  lo = malloc(2 * (2 * ry + 1) * sizeof(int));
+  hi = malloc(2 * (2 * ry + 1) * sizeof(int));
+  if ((lo == NULL) || (hi == NULL))
     {
-      tx = index % xdim;
-      ty = index / xdim;
+      ofree(lo);
+      ofree(hi);
+      return NULL;
+    }
 
-      ifverbose(11)
-	fprintf(stderr, "Adapt unit %d, %d\n", tx, ty);
-      dd = dist(bx, by, tx, ty);
+  /* the units outside the window are farther than these */
+  rmin = -1.0;
+  rmax = FLT_MAX;
+  if (rx < xdim)
+    rmax = rx + 0.5;
+  if ((ry < ydim) && ((ry + 1) * 0.866 < rmax))
+    rmax = (ry + 1) * 0.866;
 
-      alp = alpha *
-	(float) exp((double) (-dd * dd / (2.0 * radius * radius)));
-      
-      adapt(codetmp, sample, codes->dimension, alp);
+  for (par = 0; par < 2; par++)
+    for (dy = -ry; dy <= ry; dy++)
+      {
+	lo[par * (2 * ry + 1) + dy + ry] = rx + 1;
+	hi[par * (2 * ry + 1) + dy + ry] = -rx - 1;
+	for (dx = -rx; dx <= rx; dx++)
+	  if ((d = dist(0, par, dx, par + dy)) > radius)
+	    {
+	      if (d < rmax)
+		rmax = d;
+	    }
+	  else
+	    {
+	      if (d > rmin)
+		rmin = d;
+	      if (dx < lo[par * (2 * ry + 1) + dy + ry])
+		lo[par * (2 * ry + 1) + dy + ry] = dx;
+	      hi[par * (2 * ry + 1) + dy + ry] = dx;
+	    }
+      }
 
-      codetmp = next_entry(&p);
-      index++;
-    }
+  ofree(spans->lo);
+  ofree(spans->hi);
+  spans->dist = dist;
+  spans->rmin = rmin;
+  spans->rmax = rmax;
+  spans->xdim = xdim;
+  spans->ydim = ydim;
+  spans->ry = ry;
+  spans->lo = lo;
+  spans->hi = hi;
+
+  ifverbose(3)
+    fprintf(stderr, "neighbourhood spans for radius %f, %d rows\n",
+	    radius, 2 * ry + 1);
+
+  return spans;
 }
 
+/* span_row - the span of row by + dy clipped to the map. Returns zero
+   if no unit of the row is within the radius. */
 
-/* som_training - train a SOM. Radius of the neighborhood decreases 
-   linearly from the initial value to one and the learning parameter 
-   decreases linearly from its initial value to zero. */
-
-struct entries *som_training(struct teach_params *teach)
+static int span_row(struct neigh_spans *ns, int bx, int by, int dy,
+		    int *x0, int *x1)
 {
+  int i = (by & 1) * (2 * ns->ry + 1) + dy + ns->ry;
 
-  NEIGH_ADAPT *adapt;
-  WINNER_FUNCTION *find_winner = teach->winner;
-  ALPHA_FUNC *get_alpha = teach->alpha_func;
-  int dim;
-  int bxind, byind;
-  float weight;
-  float trad, talp;
-  struct data_entry *sample;
-  struct entries *data = teach->data;
-  struct entries *codes = teach->codes;
-  long le, length = teach->length;
-  float alpha = teach->alpha;
-  float radius = teach->radius;
-  struct snapshot_info *snap = teach->snapshot;
-  struct winner_info win_info;
-  eptr p;
+  if ((by + dy < 0) || (by + dy >= ns->ydim) || (ns->lo[i] > ns->hi[i]))
+    return 0;
+  *x0 = (bx + ns->lo[i] > 0) ? bx + ns->lo[i] : 0;
+  *x1 = (bx + ns->hi[i] < ns->xdim - 1) ? bx + ns->hi[i] : ns->xdim - 1;
+  return (*x0 <= *x1);
+}
 
-  if (set_som_params(teach))
+/* the kernel value at map distance dd */
+#define GAUSS_WEIGHT(dd, radius) \
+  ((float) exp((double) (-(dd) * (dd) / (2.0 * (radius) * (radius)))))
+
+/* gauss_distances - make the table of map distances for offsets up to
+   rx and ry. Returns non-zero if there is no memory, in which case the
+   old table is kept. */
+
+static int gauss_distances(struct gauss_table *gt, MAPDIST_FUNCTION *dist,
+			   int xdim, int ydim, int rx, int ry)
+{
+  int rows = 2 * (2 * ry + 1), par, dx, dy, *lo, *hi, *wlo, *whi;
+  float *d, *w;
+
+  lo = malloc(rows * sizeof(int));
+  hi = malloc(rows * sizeof(int));
+  wlo = malloc(rows * sizeof(int));
+  whi = malloc(rows * sizeof(int));
+  d = malloc(rows * (2 * rx + 1) * sizeof(float));
+  w = malloc(rows * (2 * rx + 1) * sizeof(float));
+  if ((lo == NULL) || (hi == NULL) || (wlo == NULL) || (whi == NULL) ||
+      (d == NULL) || (w == NULL))
     {
-      fprintf(stderr, "som_training: can't set SOM parameters\n");
-      return NULL;
+      ofree(lo);
+      ofree(hi);
+      ofree(wlo);
+      ofree(whi);
+      ofree(d);
+      ofree(w);
+      return 1;
     }
 
-  adapt = teach->neigh_adapt;
+  for (par = 0; par < 2; par++)
+    for (dy = -ry; dy <= ry; dy++)
+      for (dx = -rx; dx <= rx; dx++)
+	d[(par * (2 * ry + 1) + dy + ry) * (2 * rx + 1) + dx + rx] =
+	  dist(0, par, dx, par + dy);
+
+  ofree(gt->lo);
+  ofree(gt->hi);
+  ofree(gt->wlo);
+  ofree(gt->whi);
+  ofree(gt->d);
+  ofree(gt->w);
+  gt->dist = dist;
+  gt->xdim = xdim;
+  gt->ydim = ydim;
+  gt->sx = rx;
+  gt->sy = ry;
+  gt->lo = lo;
+  gt->hi = hi;
+  gt->wlo = wlo;
+  gt->whi = whi;
+  gt->d = d;
+  gt->w = w;
 
-  if ((sample = rewind_entries(data, &p)) == NULL)
+  return 0;
+}
+
+/* get_gauss - the kernel table for the current radius. Returns NULL if
+   the codebook is not a flat map or there is no memory. */
+
+static struct gauss_table *get_gauss(struct teach_params *teach,
+				     float radius)
+{
+  struct entries *codes = teach->codes;
+  MAPDIST_FUNCTION *dist = teach->mapdist;
+  int xdim = codes->xdim, ydim = codes->ydim;
+  int rx, ry, par, dy, row, lo, hi, same;
+  float cutoff = teach->cutoff, dd, *d;
+  double rc, near = FLT_MAX, far = FLT_MAX;
+  struct gauss_table *gauss = &tables_of(teach)->gauss;
+
+  if ((codes->block == NULL) || (dist == NULL) ||
+      (codes->num_entries != (long) xdim * ydim))
+    return NULL;
+
+  if ((gauss->d != NULL) && (gauss->dist == dist) && (gauss->xdim == xdim) &&
+      (gauss->ydim == ydim) && (gauss->radius == radius) &&
+      (gauss->cutoff == cutoff))
+    return gauss;
+
+  /* the window is limited by the distance where the kernel falls to
+     the cutoff, see get_spans */
+  rx = xdim;
+  ry = ydim;
+  if (cutoff > 0.0)
+    {
+      rc = (cutoff < 1.0) ? radius * sqrt(-2.0 * log((double) cutoff)) : 0.0;
+      if (rc + 1.0 < xdim)
+	rx = (int) rc + 1;
+      if (rc / 0.866 + 1.0 < ydim)
+	ry = (int) (rc / 0.866) + 1;
+      /* units nearer than near are in, farther than far out; the
+	 kernel is computed only for the ones in between */
+      near = rc * (1.0 - 1e-4);
+      far = rc * (1.0 + 1e-4) + 1e-3;
+    }
+
+  /* the distances are kept for smaller windows */
+  same = ((gauss->d != NULL) && (gauss->dist == dist) &&
+	  (gauss->xdim == xdim) && (gauss->ydim == ydim));
+  if ((!same || (rx > gauss->sx) || (ry > gauss->sy)) &&
+      gauss_distances(gauss, dist, xdim, ydim,
+		      (same && (gauss->sx > rx)) ? gauss->sx : rx,
+		      (same && (gauss->sy > ry)) ? gauss->sy : ry))
+    return NULL;
+
+  for (row = 0; row < 2 * (2 * gauss->sy + 1); row++)
+    {
+      gauss->lo[row] = gauss->wlo[row] = rx + 1;
+      gauss->hi[row] = gauss->whi[row] = -rx - 1;
+    }
+
+  /* the first and the last column of each row where the kernel is at
+     least the cutoff */
+  for (par = 0; par < 2; par++)
+    for (dy = -ry; dy <= ry; dy++)
+      {
+	row = par * (2 * gauss->sy + 1) + dy + gauss->sy;
+	d = gauss->d + row * (2 * gauss->sx + 1) + gauss->sx;
+	for (lo = -rx; lo <= rx; lo++)
+	  if (((dd = d[lo]) <= near) ||
+	      ((dd <= far) && (GAUSS_WEIGHT(dd, radius) >= cutoff)))
+	    break;
+	for (hi = rx; hi > lo; hi--)
+	  if (((dd = d[hi]) <= near) ||
+	      ((dd <= far) && (GAUSS_WEIGHT(dd, radius) >= cutoff)))
+	    break;
+	if (lo <= rx)
+	  {
+	    gauss->lo[row] = lo;
+	    gauss->hi[row] = hi;
+	  }
+      }
+
+  gauss->radius = radius;
+  gauss->cutoff = cutoff;
+  gauss->rx = rx;
+  gauss->ry = ry;
+
+  return gauss;
+}
+
+/* gauss_weights - compute the kernel values of the columns x0 ... x1
+   of a row if they aren't computed yet */
+
+static void gauss_weights(struct gauss_table *gt, int row, int x0, int x1)
+{
+  float *d = gt->d + row * (2 * gt->sx + 1) + gt->sx;
+  float *w = gt->w + row * (2 * gt->sx + 1) + gt->sx;
+  int dx;
+
+  if (gt->wlo[row] > gt->whi[row])
+    {
+      for (dx = x0; dx <= x1; dx++)
+	w[dx] = GAUSS_WEIGHT(d[dx], gt->radius);
+      gt->wlo[row] = x0;
+      gt->whi[row] = x1;
+      return;
+    }
+
+  for (dx = x0; dx < gt->wlo[row]; dx++)
+    w[dx] = GAUSS_WEIGHT(d[dx], gt->radius);
+  for (dx = gt->whi[row] + 1; dx <= x1; dx++)
+    w[dx] = GAUSS_WEIGHT(d[dx], gt->radius);
+  if (x0 < gt->wlo[row])
+    gt->wlo[row] = x0;
+  if (x1 > gt->whi[row])
+    gt->whi[row] = x1;
+}
+
+/* fill_gauss - compute all kernel values of the table, so that threads
+   can read it at the same time */
+
+static void fill_gauss(struct gauss_table *gt)
+{
+  int par, dy, row;
+
+  for (par = 0; par < 2; par++)
+    for (dy = -gt->ry; dy <= gt->ry; dy++)
+      {
+	row = par * (2 * gt->sy + 1) + dy + gt->sy;
+	if (gt->lo[row] <= gt->hi[row])
+	  gauss_weights(gt, row, gt->lo[row], gt->hi[row]);
+      }
+}
+
+/* gauss_row - the columns of row by + dy to visit, clipped to the map,
+   and the kernel values of the row. Returns NULL if there are none.
+   Threads may call this at the same time only for different rows or
+   after fill_gauss. */
+
+static float *gauss_row(struct gauss_table *gt, int bx, int by, int dy,
+			int *x0, int *x1)
+{
+  int row = (by & 1) * (2 * gt->sy + 1) + dy + gt->sy;
+
+  if ((by + dy < 0) || (by + dy >= gt->ydim) || (gt->lo[row] > gt->hi[row]))
+    return NULL;
+  *x0 = (bx + gt->lo[row] > 0) ? bx + gt->lo[row] : 0;
+  *x1 = (bx + gt->hi[row] < gt->xdim - 1) ? bx + gt->hi[row] : gt->xdim - 1;
+  if (*x0 > *x1)
+    return NULL;
+
+  gauss_weights(gt, row, *x0 - bx, *x1 - bx);
+
+  /* w[x - bx] is the kernel value of the unit at x */
+  return gt->w + row * (2 * gt->sx + 1) + gt->sx;
+}
+
+/* parallel_usable - the work can be split between threads with the
+   euclidean winner functions that keep no state of their own, on a
+   flat map */
+
+static int parallel_usable(struct teach_params *teach)
+{
+  WINNER_FUNCTION *winner = teach->winner;
+  struct entries *codes = teach->codes;
+
+  if ((codes->block == NULL) || (teach->mapdist == NULL) ||
+      (codes->num_entries != (long) codes->xdim * codes->ydim))
+    return 0;
+
+  return ((winner == find_winner_euc) || (winner == find_winner_euc2) ||
+	  (winner == find_winner_knn) || (winner == find_winner_knn2) ||
+	  (winner == find_winner_simd));
+}
+
+/* batch_usable - batch training can also use the pruned search, whose
+   bounds are updated after each epoch */
+
+static int batch_usable(struct teach_params *teach)
+{
+  struct entries *codes = teach->codes;
+
+  if ((teach->winner == find_winner_prune) && (codes->block != NULL) &&
+      (teach->mapdist != NULL) &&
+      (codes->num_entries == (long) codes->xdim * codes->ydim))
+    return 1;
+
+  return parallel_usable(teach);
+}
+
+/* The work of one sample split between teach->threads threads: the
+   winner search by parts of the codebook and the adaptation by rows of
+   the neighbourhood. Each unit is handled exactly as in one thread, so
+   the results are the same. */
+
+struct sample_job {
+  struct teach_params *teach;
+  struct data_entry *sample;
+  int bx, by, ry;
+  float radius, alpha;
+  struct neigh_spans *ns;       /* bubble neighbourhood */
+  struct gauss_table *gt;       /* gaussian neighbourhood */
+  struct winner_info win[MAX_THREADS];
+  int found[MAX_THREADS];
+};
+
+/* split_threads - the number of threads worth using for the given
+   number of vector components */
+
+static int split_threads(struct teach_params *teach, double work)
+{
+  int n = teach->threads;
+
+  if (n > work / SPLIT_MIN_WORK)
+    n = (int) (work / SPLIT_MIN_WORK);
+  return (n > 1) ? n : 1;
+}
+
+/* code_part - make part a flat codebook of its own of the units start
+   ... end - 1 of codes */
+
+static void code_part(struct entries *codes, struct entries *part,
+		      long start, long end)
+{
+  *part = *codes;
+  part->unit_of = NULL;
+  if (codes->slot != NULL)
+    part->slot = codes->slot + start;
+  else
+    part->block = block_row(codes, start);
+  part->units = codes->units + start;
+  part->entries = part->units;
+  part->num_entries = end - start;
+}
+
+static void split_search(void *arg, int thread, int nthreads)
+{
+  struct sample_job *job = arg;
+  struct entries *codes = job->teach->codes, part;
+  struct winner_info *win = &job->win[thread];
+  long start, end;
+
+  thread_range(codes->num_entries, thread, nthreads, &start, &end);
+  code_part(codes, &part, start, end);
+
+  job->found[thread] = job->teach->winner(&part, job->sample, win, 1);
+  if (win->index >= 0)
+    {
+      win->index += start;
+      win->winner = &codes->units[win->index];
+    }
+}
+
+/* split_winner - find the winner like teach->winner with knn == 1. The
+   best of the parts is the first of the equally distant ones, like in
+   find_winner_euc. */
+
+static int split_winner(struct teach_params *teach, struct data_entry *sample,
+			struct winner_info *win)
+{
+  struct entries *codes = teach->codes;
+  struct sample_job job;
+  int i, n;
+
+  n = split_threads(teach, (double) codes->num_entries * codes->dimension);
+  if (n < 2)
+    return teach->winner(codes, sample, win, 1);
+
+  job.teach = teach;
+  job.sample = sample;
+  run_threads(split_search, &job, n);
+
+  win->index = -1;
+  win->winner = NULL;
+  win->diff = -1.0;
+  for (i = 0; i < n; i++)
+    {
+      if (job.found[i] == 0)
+	return 0;
+      if ((job.win[i].index >= 0) &&
+	  ((win->index < 0) || (job.win[i].diff < win->diff)))
+	*win = job.win[i];
+    }
+  return 1;
+}
+
+static void split_rows(void *arg, int thread, int nthreads)
+{
+  struct sample_job *job = arg;
+  struct entries *codes = job->teach->codes;
+  VECTOR_ADAPT *adapt = job->teach->vector_adapt;
+  int xdim = codes->xdim, dy, tx, ty, x0, x1;
+  long start, end;
+  float *w;
+
+  thread_range(2 * job->ry + 1, thread, nthreads, &start, &end);
+
+  for (dy = -job->ry + start; dy < -job->ry + end; dy++)
+    if (job->gt != NULL)
+      {
+	if ((w = gauss_row(job->gt, job->bx, job->by, dy, &x0, &x1)) != NULL)
+	  for (ty = job->by + dy, tx = x0; tx <= x1; tx++)
+	    adapt(&codes->units[(long) ty * xdim + tx], job->sample,
+		  codes->dimension, job->alpha * w[tx - job->bx]);
+      }
+    else if (span_row(job->ns, job->bx, job->by, dy, &x0, &x1))
+      for (ty = job->by + dy, tx = x0; tx <= x1; tx++)
+	adapt(&codes->units[(long) ty * xdim + tx], job->sample,
+	      codes->dimension, job->alpha);
+}
+
+/* split_adapt - adapt the rows of the spans or of the gaussian table.
+   Returns zero if the neighbourhood is too small to be split. */
+
+static int split_adapt(struct teach_params *teach, struct data_entry *sample,
+		       int bx, int by, float alpha, struct neigh_spans *ns,
+		       struct gauss_table *gt)
+{
+  struct entries *codes = teach->codes;
+  struct sample_job job;
+  int ry = (gt != NULL) ? gt->ry : ns->ry, n, rows, cols;
+
+  if (teach->threads < 2)
+    return 0;
+
+  rows = (2 * ry + 1 < codes->ydim) ? 2 * ry + 1 : codes->ydim;
+  cols = (2 * ry + 1 < codes->xdim) ? 2 * ry + 1 : codes->xdim;
+  n = split_threads(teach, (double) rows * cols * codes->dimension);
+  if (n < 2)
+    return 0;
+
+  job.teach = teach;
+  job.sample = sample;
+  job.bx = bx;
+  job.by = by;
+  job.ry = ry;
+  job.alpha = alpha;
+  job.ns = ns;
+  job.gt = gt;
+  run_threads(split_rows, &job, n);
+  return 1;
+}
+
+static void split_gauss(void *arg, int thread, int nthreads)
+{
+  struct sample_job *job = arg;
+  struct entries *codes = job->teach->codes;
+  MAPDIST_FUNCTION *dist = job->teach->mapdist;
+  VECTOR_ADAPT *adapt = job->teach->vector_adapt;
+  float radius = job->radius, dd, alp;
+  long index, start, end;
+
+  thread_range(codes->num_entries, thread, nthreads, &start, &end);
+
+  for (index = start; index < end; index++)
+    {
+      dd = dist(job->bx, job->by, index % codes->xdim, index / codes->xdim);
+      alp = job->alpha *
+	(float) exp((double) (-dd * dd / (2.0 * radius * radius)));
+      adapt(&codes->units[index], job->sample, codes->dimension, alp);
+    }
+}
+
+/* Adaptation function for bubble-neighborhood */
+
+void bubble_adapt(struct teach_params *teach, struct data_entry *sample,
+		  int bx, int by, float radius, float alpha)
+{
+  long index;
+  int tx, ty, xdim, dy, x0, x1;
+  struct neigh_spans *ns;
+  struct entries *codes = teach->codes;
+  MAPDIST_FUNCTION *dist = teach->mapdist;
+  struct data_entry *codetmp;
+  VECTOR_ADAPT *adapt = teach->vector_adapt;
+  eptr p;
+
+  xdim = codes->xdim;
+  
+  ifverbose(10)
+    fprintf(stderr, "Best match in %d, %d\n", bx, by);
+
+  /* on a flat map only the units inside the radius are visited */
+  if ((ns = get_spans(teach, radius)) != NULL)
+    {
+      if (split_adapt(teach, sample, bx, by, alpha, ns, NULL))
+	return;
+      for (dy = -ns->ry; dy <= ns->ry; dy++)
+	if (span_row(ns, bx, by, dy, &x0, &x1))
+	  for (ty = by + dy, tx = x0; tx <= x1; tx++)
+	    {
+	      ifverbose(11)
+		fprintf(stderr, "Adapt unit %d, %d\n", tx, ty);
+	      adapt(&codes->units[(long) ty * xdim + tx], sample,
+		    codes->dimension, alpha);
+	    }
+      return;
+    }
+
+  codetmp = rewind_entries(codes, &p);
+  index = 0;
+  
+  while (codetmp != NULL)
+    {
+      tx = index % xdim;
+      ty = index / xdim;
+      
+      if (dist(bx, by, tx, ty) <= radius) {
+	ifverbose(11)
+	  fprintf(stderr, "Adapt unit %d, %d\n", tx, ty);
+	
+	adapt(codetmp, sample, codes->dimension, alpha);
+
+      }
+      codetmp = next_entry(&p);
+      index++;
+    }
+}
+
+
+/* Adaptation function for gaussian neighbourhood */
+     
+void gaussian_adapt(struct teach_params *teach, struct data_entry *sample,
+		    int bx, int by, float radius, float alpha)
+{
+  long index;
+  int tx, ty, xdim, dy, x0, x1;
+  float dd, *w;
+  float alp;
+  struct entries *codes = teach->codes;
+  MAPDIST_FUNCTION *dist = teach->mapdist;
+  VECTOR_ADAPT *adapt = teach->vector_adapt;
+  struct data_entry *codetmp;
+  struct gauss_table *gt;
+  struct sample_job job;
+  int n;
+  eptr p;
+
+  xdim = codes->xdim;
+
+  ifverbose(10)
+    fprintf(stderr, "Best match in %d, %d\n", bx, by);
+
+  /* Without a cutoff all units are adapted and the table would be
+     larger than the map, so it is only used with one. */
+  if ((teach->cutoff > 0.0) && ((gt = get_gauss(teach, radius)) != NULL))
+    {
+      if (split_adapt(teach, sample, bx, by, alpha, NULL, gt))
+	return;
+      for (dy = -gt->ry; dy <= gt->ry; dy++)
+	if ((w = gauss_row(gt, bx, by, dy, &x0, &x1)) != NULL)
+	  for (ty = by + dy, tx = x0; tx <= x1; tx++)
+	    {
+	      ifverbose(11)
+		fprintf(stderr, "Adapt unit %d, %d\n", tx, ty);
+	      adapt(&codes->units[(long) ty * xdim + tx], sample,
+		    codes->dimension, alpha * w[tx - bx]);
+	    }
+      return;
+    }
+
+  /* the whole map, split between threads */
+  if ((teach->threads > 1) && (codes->block != NULL) &&
+      (codes->num_entries == (long) xdim * codes->ydim) &&
+      ((n = split_threads(teach, (double) codes->num_entries *
+			  codes->dimension)) > 1))
+    {
+      job.teach = teach;
+      job.sample = sample;
+      job.bx = bx;
+      job.by = by;
+      job.radius = radius;
+      job.alpha = alpha;
+      run_threads(split_gauss, &job, n);
+      return;
+    }
+
+  codetmp = rewind_entries(codes, &p);
+  index = 0;
+
+  while (codetmp != NULL)
+    {
+      tx = index % xdim;
+      ty = index / xdim;
+
+      ifverbose(11)
+	fprintf(stderr, "Adapt unit %d, %d\n", tx, ty);
+      dd = dist(bx, by, tx, ty);
+
+      alp = alpha *
+	(float) exp((double) (-dd * dd / (2.0 * radius * radius)));
+      
+      adapt(codetmp, sample, codes->dimension, alp);
+
+      codetmp = next_entry(&p);
+      index++;
+    }
+}
+
+/* local winner search */
+
+struct typelist local_list[] = {
+  {LOCAL_EXACT, "exact", NULL},
+  {LOCAL_APPROX, "approx", NULL},
+  {LOCAL_OFF, NULL, NULL}};      /* default */
+
+/* local_usable - local search is used with the winner functions that
+   give the same results as find_winner_euc, on a flat map */
+
+static int local_usable(struct teach_params *teach)
+{
+  WINNER_FUNCTION *winner = teach->winner;
+  struct entries *codes = teach->codes;
+
+  if ((codes->block == NULL) || (teach->mapdist == NULL) ||
+      (codes->num_entries != (long) codes->xdim * codes->ydim))
+    return 0;
+
+  return ((winner == find_winner_euc) || (winner == find_winner_euc2) ||
+	  (winner == find_winner_knn) || (winner == find_winner_knn2));
+}
+
+/* unit_dist - squared distance, computed the same way as in
+   find_winner_euc. Stops when the distance is larger than bound. */
+
+static float unit_dist(float *c, float *x, int dim, float bound)
+{
+  float diff, difference = 0.0;
+  int i;
+
+  for (i = 0; i < dim; i++)
+    {
+      diff = c[i] - x[i];
+      difference += diff * diff;
+      if (difference > bound) break;
+    }
+  return difference;
+}
+
+/* local_winner - find the winner starting from the winner of the
+   previous round. The search goes from unit to unit on the map as long
+   as a neighbouring unit is closer to the sample. With LOCAL_EXACT the
+   distance found is then used as the bound for scanning the map, which
+   makes most of the distance computations stop early, and the winner
+   is the same as from find_winner_euc. With LOCAL_APPROX the local
+   minimum is returned. Returns 1 if the winner was found locally. */
+
+static int local_winner(struct teach_params *teach, struct data_entry *sample,
+			struct winner_info *win)
+{
+  struct entries *codes = teach->codes;
+  MAPDIST_FUNCTION *mapdist = teach->mapdist;
+  int xdim = codes->xdim, ydim = codes->ydim, dim = codes->dimension;
+  int bx, by, tx, ty, steps;
+  long best, cand, i, r, noc = codes->num_entries;
+  float dbest, dcand, d, *x = sample->points;
+
+  best = sample->bmu;
+  dbest = unit_dist(block_row(codes, best), x, dim, FLT_MAX);
+
+  for (steps = 0; steps < xdim + ydim; steps++)
+    {
+      bx = best % xdim;
+      by = best / xdim;
+      cand = best;
+      dcand = dbest;
+      for (ty = by - 1; ty <= by + 1; ty++)
+	for (tx = bx - 1; tx <= bx + 1; tx++)
+	  {
+	    if ((tx < 0) || (tx >= xdim) || (ty < 0) || (ty >= ydim) ||
+		((tx == bx) && (ty == by)) ||
+		(mapdist(bx, by, tx, ty) > 1.01))
+	      continue;
+	    i = tx + ty * xdim;
+	    d = unit_dist(block_row(codes, i), x, dim, dcand);
+	    if ((d < dcand) || ((d == dcand) && (i < cand)))
+	      {
+		cand = i;
+		dcand = d;
+	      }
+	  }
+      if (cand == best)
+	break;
+      best = cand;
+      dbest = dcand;
+    }
+
+  cand = best;
+  /* the map is scanned in the order the units are stored */
+  if (teach->local_search == LOCAL_EXACT)
+    for (r = 0; r < noc; r++)
+      {
+	i = (codes->unit_of != NULL) ? codes->unit_of[r] : r;
+	if (i == best)
+	  continue;
+	d = unit_dist(codes->block + r * codes->stride, x, dim, dbest);
+	if ((d < dbest) || ((d == dbest) && (i < best)))
+	  {
+	    best = i;
+	    dbest = d;
+	  }
+      }
+
+  win->index = best;
+  win->winner = &codes->units[best];
+  win->diff = dbest;
+  return (best == cand);
+}
+
+/* Fused winner search and adaptation. In som_training the codebook is
+   read once for the adaptation of a sample and once more for the
+   winner search of the next one. When fused, the adaptation is left
+   pending and done a tile of units at a time during the next search,
+   just before the tile is searched, so that the tile is read from
+   memory once and stays in the cache for both. The units get the same
+   updates in the same order as before, and each tile is adapted before
+   it is searched, so the results are the same. */
+
+struct pending_adapt {
+  struct data_entry *sample;    /* NULL if there is nothing pending */
+  int bx, by;
+  float radius, alpha;
+};
+
+/* adapt_range - do the pending adaptation for the units start ... end
+   - 1 */
+
+static void adapt_range(struct teach_params *teach, struct pending_adapt *pa,
+			long start, long end)
+{
+  struct entries *codes = teach->codes;
+  MAPDIST_FUNCTION *dist = teach->mapdist;
+  VECTOR_ADAPT *adapt = teach->vector_adapt;
+  struct data_entry *sample = pa->sample;
+  struct neigh_spans *ns = NULL;
+  struct gauss_table *gt = NULL;
+  int xdim = codes->xdim, bx = pa->bx, by = pa->by, ry, ty, x0, x1;
+  float radius = pa->radius, alpha = pa->alpha, dd, alp, *w = NULL;
+  long i, i0, i1;
+
+  if (sample == NULL)
+    return;
+
+  if (teach->neigh_adapt == bubble_adapt)
+    ns = get_spans(teach, radius);
+  else if (teach->cutoff > 0.0)
+    gt = get_gauss(teach, radius);
+
+  if ((ns == NULL) && (gt == NULL))
+    {
+      /* every unit is checked, like without the tables */
+      for (i = start; i < end; i++)
+	{
+	  dd = dist(bx, by, i % xdim, i / xdim);
+	  if (teach->neigh_adapt == bubble_adapt)
+	    {
+	      if (dd <= radius)
+		adapt(&codes->units[i], sample, codes->dimension, alpha);
+	    }
+	  else
+	    {
+	      alp = alpha *
+		(float) exp((double) (-dd * dd / (2.0 * radius * radius)));
+	      adapt(&codes->units[i], sample, codes->dimension, alp);
+	    }
+	}
+      return;
+    }
+
+  /* the rows of the neighbourhood that are in the range */
+  ry = (ns != NULL) ? ns->ry : gt->ry;
+  for (ty = (by - ry > start / xdim) ? by - ry : start / xdim;
+       (ty <= by + ry) && ((long) ty * xdim < end); ty++)
+    {
+      if (ns != NULL)
+	{
+	  if (!span_row(ns, bx, by, ty - by, &x0, &x1))
+	    continue;
+	}
+      else if ((w = gauss_row(gt, bx, by, ty - by, &x0, &x1)) == NULL)
+	continue;
+
+      i0 = (long) ty * xdim + x0;
+      i1 = (long) ty * xdim + x1;
+      if (i0 < start)
+	i0 = start;
+      if (i1 > end - 1)
+	i1 = end - 1;
+      for (i = i0; i <= i1; i++)
+	adapt(&codes->units[i], sample, codes->dimension,
+	      (w != NULL) ? alpha * w[i - (long) ty * xdim - bx] : alpha);
+    }
+}
+
+/* scan_euc - go through the units start ... end - 1 like
+   find_winner_euc, keeping the best one found so far in win. Returns
+   zero if the sample is empty. */
+
+static int scan_euc(struct entries *codes, struct data_entry *sample,
+		    long start, long end, struct winner_info *win)
+{
+  int dim = codes->dimension, i, masked;
+  float diffsf, diff, difference, *c;
+  long index;
+
+  diffsf = (win->index >= 0) ? win->diff : FLT_MAX;
+  for (index = start; index < end; index++)
+    {
+      c = block_row(codes, index);
+      difference = 0.0;
+      masked = 0;
+      for (i = 0; i < dim; i++)
+	{
+	  if ((sample->mask != NULL) && (sample->mask[i] != 0))
+	    {
+	      masked++;
+	      continue;
+	    }
+	  diff = c[i] - sample->points[i];
+	  difference += diff * diff;
+	  if (difference > diffsf) break;
+	}
+
+      if (masked == dim)
+	return 0;
+
+      if (difference < diffsf)
+	{
+	  win->index = index;
+	  win->diff = difference;
+	  diffsf = difference;
+	}
+    }
+  return 1;
+}
+
+/* fused_winner - do the pending adaptation and find the winner of the
+   sample, a tile of FUSE_TILE_BYTES of the codebook at a time. Returns
+   like teach->winner with knn == 1. */
+
+static int fused_winner(struct teach_params *teach, struct data_entry *sample,
+			struct winner_info *win, struct pending_adapt *pa)
+{
+  struct entries *codes = teach->codes, part;
+  struct winner_info w;
+  long start, end, tile, noc = codes->num_entries;
+  int found = 1;
+
+  tile = FUSE_TILE_BYTES / (codes->stride * sizeof(float) + 1);
+  if (tile < 1)
+    tile = 1;
+
+  win->index = -1;
+  win->winner = NULL;
+  win->diff = -1.0;
+
+  for (start = 0; start < noc; start = end)
+    {
+      end = (start + tile < noc) ? start + tile : noc;
+      adapt_range(teach, pa, start, end);
+
+      /* an empty sample has no winner in any tile */
+      if (!found)
+	continue;
+
+      /* find_winner_euc can go on with the best distance so far */
+      if (teach->winner == find_winner_euc)
+	{
+	  found = scan_euc(codes, sample, start, end, win);
+	  continue;
+	}
+
+      code_part(codes, &part, start, end);
+      if (teach->winner(&part, sample, &w, 1) == 0)
+	{
+	  found = 0;
+	  continue;
+	}
+      if ((w.index >= 0) && ((win->index < 0) || (w.diff < win->diff)))
+	{
+	  *win = w;
+	  win->index += start;
+	  win->winner = &codes->units[win->index];
+	}
+    }
+
+  if (win->index >= 0)
+    win->winner = &codes->units[win->index];
+  pa->sample = NULL;
+  return found;
+}
+
+/* som_training - train a SOM. Radius of the neighborhood decreases 
+   linearly from the initial value to one and the learning parameter 
+   decreases linearly from its initial value to zero. */
+
+struct entries *som_training(struct teach_params *teach)
+{
+
+  NEIGH_ADAPT *adapt;
+  ALPHA_FUNC *get_alpha = teach->alpha_func;
+  int dim;
+  int bxind, byind;
+  float weight;
+  float trad, talp;
+  struct data_entry *sample;
+  struct entries *data = teach->data;
+  struct entries *codes = teach->codes;
+  long le, length = teach->length;
+  float alpha = teach->alpha;
+  float radius = teach->radius;
+  struct snapshot_info *snap = teach->snapshot;
+  struct stop_info *stop = teach->stop;
+  struct checkpoint_info *ck = teach->checkpoint;
+  long end = length, t;
+  struct winner_info win_info;
+  int local, fuse;
+  long local_count = 0, local_hits = 0;
+  struct pending_adapt pending;
+  eptr p;
+
+  if (set_som_params(teach))
+    {
+      fprintf(stderr, "som_training: can't set SOM parameters\n");
+      return NULL;
+    }
+
+  adapt = teach->neigh_adapt;
+
+  local = (teach->local_search != LOCAL_OFF);
+  if (local && !local_usable(teach))
+    {
+      ifverbose(1)
+	fprintf(stderr, "som_training: local winner search needs a flat map and the default functions, not used\n");
+      local = 0;
+    }
+
+  /* the work of each sample is split between threads if there are
+     several */
+  teach->threads = parallel_usable(teach) ? use_threads(-1) : 1;
+
+  le = 0;
+  if (teach->resume)
+    sample = resume_data(teach, &p, &le, &end);
+  else
+    sample = rewind_entries(data, &p);
+  if (sample == NULL)
+    {
+      fprintf(stderr, "som_training: can't get data\n");
+      return NULL;
+    }
+
+  /* The adaptation is fused with the next winner search in one thread.
+     The pending sample must stay in memory until then, so the data
+     can't be buffered. The tiles are ranges of units in row order, so
+     a codebook stored in another layout is not fused. Setting the
+     environment variable LVQSOM_NOFUSE turns this off. */
+  fuse = !local && (teach->threads < 2) && parallel_usable(teach) &&
+    ((adapt == bubble_adapt) || (adapt == gaussian_adapt)) &&
+    (data->flags.loadmode == LOADMODE_ALL) && (codes->slot == NULL) &&
+    !getenv("LVQSOM_NOFUSE");
+  pending.sample = NULL;
+
+  dim = codes->dimension;
+  if (data->dimension != dim)
+    {
+      fprintf(stderr, "code dimension (%d) != data dimension (%d)\n",
+	      dim, data->dimension);
+      return NULL;
+    }
+
+  time(&teach->start_time);
+
+  for (; le < end; le++, sample = next_entry(&p)) {
+    /* if we are at the end of data file, go back to the start */
+    if (sample == NULL)
+      {
+	sample = rewind_entries(data, &p);
+	if (sample == NULL)
+	  {
+	    fprintf(stderr, "som_training: couldn't rewind data (%ld/%ld iterations done)\n", le, length);
+	    return NULL;
+	  }
+      }
+
+    weight = sample->weight;
+
+    /* Radius decreases linearly to one. After early stopping the rest
+       of the schedule is run faster. */
+    t = stop_time(stop, le, length);
+    trad = 1.0 + (radius - 1.0) * (float) (length - t) / (float) length;
+
+    talp = get_alpha(t, length, alpha);
+
+    /* If the sample is weighted, we
+       modify the training rate so that we achieve the same effect as
+       repeating the sample 'weight' times */
+    if ((weight > 0.0) && (use_weights(-1))) {
+      talp = 1.0 - (float) pow((double) (1.0 - talp), (double) weight);
+    }
+
+    /* Find the best match */
+    /* If fixed point and is allowed then use that value */
+    if ((sample->fixed != NULL) && (use_fixed(-1))) {
+      /* Get the values from fixed-structure */
+      bxind = sample->fixed->xfix;
+      byind = sample->fixed->yfix;
+      /* no winner is needed, only the pending adaptation */
+      if (fuse)
+	{
+	  adapt_range(teach, &pending, 0, codes->num_entries);
+	  pending.sample = NULL;
+	}
+    }
+    else {
+
+      if (local && (sample->bmu >= 0) && (sample->mask == NULL) &&
+	  (sample->bmu < codes->num_entries))
+	{
+	  local_count++;
+	  local_hits += local_winner(teach, sample, &win_info);
+	}
+      else if ((fuse ? fused_winner(teach, sample, &win_info, &pending)
+		: split_winner(teach, sample, &win_info)) == 0)
+	{
+	  ifverbose(3)
+	    fprintf(stderr, "ignoring empty sample %ld\n", le);
+	  goto skip_teach; /* ignore empty samples */
+	}
+      sample->bmu = win_info.index;
+      stop_sample(stop, sqrt((double) win_info.diff));
+      bxind = win_info.index % codes->xdim;
+      byind = win_info.index / codes->xdim;
+    }
+
+    /* Adapt the units */
+    if (fuse)
+      {
+	pending.sample = sample;
+	pending.bx = bxind;
+	pending.by = byind;
+	pending.radius = trad;
+	pending.alpha = talp;
+      }
+    else
+      adapt(teach, sample, bxind, byind, trad, talp);
+
+  skip_teach:
+    /* save snapshot when needed */
+    if ((snap) && ((le % snap->interval) == 0) && (le > 0))
+      {
+	adapt_range(teach, &pending, 0, codes->num_entries);
+	pending.sample = NULL;
+	ifverbose(2)
+	  fprintf(stderr, "Saving snapshot, %ld iterations\n", le);
+	if (save_snapshot(teach, le))
+	  {
+	    fprintf(stderr, "snapshot failed, continuing teaching\n");
+	  }
+      }
+
+    /* estimate the error for early stopping */
+    if (stop && stop->data && (((le + 1) % stop->interval) == 0))
+      {
+	adapt_range(teach, &pending, 0, codes->num_entries);
+	pending.sample = NULL;
+      }
+    check_stop(teach, le + 1, length, &end);
+
+    /* save the state of the training when needed */
+    if (ck && (((le + 1) % ck->interval) == 0))
+      {
+	adapt_range(teach, &pending, 0, codes->num_entries);
+	pending.sample = NULL;
+	if (save_checkpoint(teach, le + 1, &p, NULL, 0))
+	  fprintf(stderr, "checkpoint failed, continuing teaching\n");
+      }
+
+    ifverbose(1)
+      mprint((long) (length-le));
+  }
+  adapt_range(teach, &pending, 0, codes->num_entries);
+  time(&teach->end_time);
+
+  ifverbose(1)
+    {
+      mprint((long) 0);
+      fprintf(stderr, "\n");
+    }
+  if (local && (local_count > 0) && (teach->local_search == LOCAL_EXACT))
+    ifverbose(2)
+      fprintf(stderr, "local winner search: %ld of %ld winners found near the previous winner\n",
+	      local_hits, local_count);
+  return(codes);
+}
+
+/*---------------------------------------------------------------------*/
+
+/* Batch training. Each epoch the winners of all samples are found
+   against the same codebook, the samples are summed up unit by unit,
+   and each unit is then set to the neighbourhood weighted mean of the
+   sums around it. The radius is that of som_training at the start of
+   the epoch, and alpha is not used. The work is split between
+   use_threads() threads: the winner search by the samples, the rest
+   by the units. Every sum is taken in the order of the data, so the
+   results don't depend on the number of threads. */
+
+struct batch_state {
+  struct teach_params *teach;
+  struct code_panels *cp;       /* NULL if searched one sample at a time */
+  struct data_entry **samples;  /* the samples of the current chunk */
+  long n;
+  struct winner_info *win;
+  long *order, *first;          /* the samples sorted by the winner */
+  double *sum, *wsum;           /* weighted sums of the samples per unit */
+  double *msum;                 /* weights of masked components or NULL */
+  struct neigh_spans *ns;       /* bubble neighbourhood */
+  struct gauss_table *gt;       /* gaussian neighbourhood */
+  struct bound_state *prune;    /* state of the pruned search or NULL */
+  struct prune_count count[MAX_THREADS];
+  int failed;
+  /* mini-batch training */
+  float alpha;
+  long *winners, nwinners;      /* the units that won samples */
+  double *acc, *accw, *accm;    /* neighbourhood weighted sums per unit */
+};
+
+/* batch_prune - find the winners of a part of the chunk with the
+   pruned search. The samples whose bounds don't settle the winner are
+   searched together in the panels. */
+
+static void batch_prune(struct batch_state *bs, long start, long end,
+			struct prune_count *count)
+{
+  struct entries *codes = bs->teach->codes;
+  struct data_entry **samples;
+  struct winner_info *win;
+  double *lower;
+  long *at, i, m;
+
+  if (bs->cp == NULL)
+    {
+      for (i = start; i < end; i++)
+	if (prune_search(bs->prune, bs->samples[i], &bs->win[i], count) == 0)
+	  bs->win[i].index = -1;
+      return;
+    }
+
+  m = (end > start) ? end - start : 1;
+  samples = malloc(m * sizeof(struct data_entry *));
+  win = malloc(m * sizeof(struct winner_info));
+  lower = malloc(m * sizeof(double));
+  at = malloc(m * sizeof(long));
+  if ((samples == NULL) || (win == NULL) || (lower == NULL) || (at == NULL))
+    {
+      fprintf(stderr, "batch_som_training: can't allocate memory\n");
+      ERROR(ERR_NOMEM);
+      bs->failed = 1;
+      goto end;
+    }
+
+  for (m = 0, i = start; i < end; i++)
+    if (!prune_settled(bs->prune, bs->samples[i], &bs->win[i], count))
+      {
+	at[m] = i;
+	samples[m++] = bs->samples[i];
+      }
+
+  if (find_winners_block(bs->cp, codes, samples, m, win, lower,
+			 find_winner_euc))
+    {
+      bs->failed = 1;
+      goto end;
+    }
+
+  for (i = 0; i < m; i++)
+    {
+      bs->win[at[i]] = win[i];
+      prune_record(bs->prune, samples[i], &win[i], lower[i], count);
+    }
+
+ end:
+  ofree(samples);
+  ofree(win);
+  ofree(lower);
+  ofree(at);
+}
+
+/* batch_search - find the winners of a part of the chunk */
+
+static void batch_search(void *arg, int thread, int nthreads)
+{
+  struct batch_state *bs = arg;
+  struct teach_params *teach = bs->teach;
+  struct entries *codes = teach->codes;
+  struct data_entry *s;
+  long i, start, end;
+
+  thread_range(bs->n, thread, nthreads, &start, &end);
+
+  if (bs->prune != NULL)
+    batch_prune(bs, start, end, &bs->count[thread]);
+  else if (bs->cp != NULL)
+    {
+      if (find_winners_block(bs->cp, codes, bs->samples + start, end - start,
+			     bs->win + start, NULL, teach->winner))
+	bs->failed = 1;
+    }
+  else
+    for (i = start; i < end; i++)
+      if (teach->winner(codes, bs->samples[i], &bs->win[i], 1) == 0)
+	bs->win[i].index = -1;
+
+  /* fixed points */
+  if (use_fixed(-1))
+    for (i = start; i < end; i++)
+      {
+	s = bs->samples[i];
+	if (s->fixed != NULL)
+	  bs->win[i].index = s->fixed->yfix * codes->xdim + s->fixed->xfix;
+      }
+}
+
+/* batch_sums - add the samples of the chunk to the sums of a part of
+   the units */
+
+static void batch_sums(void *arg, int thread, int nthreads)
+{
+  struct batch_state *bs = arg;
+  struct entries *codes = bs->teach->codes;
+  int dim = codes->dimension, d;
+  long k, i, start, end;
+  struct data_entry *s;
+  double w, *sum;
+
+  thread_range(codes->num_entries, thread, nthreads, &start, &end);
+
+  for (k = start; k < end; k++)
+    for (i = bs->first[k]; i < bs->first[k + 1]; i++)
+      {
+	s = bs->samples[bs->order[i]];
+	w = ((s->weight > 0.0) && use_weights(-1)) ? s->weight : 1.0;
+	sum = bs->sum + k * dim;
+	for (d = 0; d < dim; d++)
+	  if ((s->mask != NULL) && s->mask[d])
+	    bs->msum[k * dim + d] += w;
+	  else
+	    sum[d] += w * s->points[d];
+	bs->wsum[k] += w;
+      }
+}
+
+/* batch_smooth - set a part of the units to the weighted means of the
+   sums in their neighbourhood. A component that has no samples in the
+   neighbourhood keeps its value. */
+
+static void batch_smooth(void *arg, int thread, int nthreads)
+{
+  struct batch_state *bs = arg;
+  struct entries *codes = bs->teach->codes;
+  int dim = codes->dimension, xdim = codes->xdim, d, dy, jx, jy, kx, x0, x1;
+  int ry = (bs->gt != NULL) ? bs->gt->ry : bs->ns->ry;
+  long j, k, start, end;
+  double *num, *mden, den, h;
+  float *c, *w = NULL;
+
+  num = malloc(2 * (dim > 0 ? dim : 1) * sizeof(double));
+  if (num == NULL)
+    {
+      bs->failed = 1;
+      return;
+    }
+  mden = num + dim;
+
+  thread_range(codes->num_entries, thread, nthreads, &start, &end);
+
+  for (j = start; j < end; j++)
+    {
+      jx = j % xdim;
+      jy = j / xdim;
+      den = 0.0;
+      for (d = 0; d < dim; d++)
+	num[d] = mden[d] = 0.0;
+
+      for (dy = -ry; dy <= ry; dy++)
+	{
+	  if (bs->gt != NULL)
+	    {
+	      if ((w = gauss_row(bs->gt, jx, jy, dy, &x0, &x1)) == NULL)
+		continue;
+	    }
+	  else if (!span_row(bs->ns, jx, jy, dy, &x0, &x1))
+	    continue;
+
+	  for (kx = x0; kx <= x1; kx++)
+	    {
+	      k = (long) (jy + dy) * xdim + kx;
+	      if (bs->wsum[k] == 0.0)
+		continue;
+	      h = (w != NULL) ? w[kx - jx] : 1.0;
+	      den += h * bs->wsum[k];
+	      for (d = 0; d < dim; d++)
+		num[d] += h * bs->sum[k * dim + d];
+	      if (bs->msum != NULL)
+		for (d = 0; d < dim; d++)
+		  mden[d] += h * bs->msum[k * dim + d];
+	    }
+	}
+
+      c = block_row(codes, j);
+      for (d = 0; d < dim; d++)
+	if (den - mden[d] > 0.0)
+	  c[d] = num[d] / (den - mden[d]);
+    }
+
+  free(num);
+}
+
+/* batch_chunk - find the winners of the samples in bs->samples and add
+   them to the sums. Returns non-zero on error. */
+
+static int batch_chunk(struct batch_state *bs, int nthreads)
+{
+  struct entries *codes = bs->teach->codes;
+  long i, k, noc = codes->num_entries;
+  int t;
+
+  /* the threads only read the state of the pruned search and write the
+     bounds of their own samples */
+  bs->prune = NULL;
+  if (bs->teach->winner == find_winner_prune)
+    {
+      bs->prune = prune_prepare(codes, bs->samples, bs->n);
+      if (bs->prune == NULL)
+	return 1;
+      memset(bs->count, 0, nthreads * sizeof(struct prune_count));
+    }
+
+  bs->failed = 0;
+  run_threads(batch_search, bs, nthreads);
+  if (bs->prune != NULL)
+    for (t = 0; t < nthreads; t++)
+      prune_finish(bs->prune, &bs->count[t]);
+  if (bs->failed)
+    return 1;
+
+  /* sort the samples by the winner */
+  for (k = 0; k <= noc; k++)
+    bs->first[k] = 0;
+  for (i = 0; i < bs->n; i++)
+    {
+      k = bs->win[i].index;
+      if ((k < 0) || (k >= noc))
+	continue;
+      bs->first[k + 1]++;
+      if ((bs->samples[i]->mask != NULL) && (bs->msum == NULL))
+	{
+	  bs->msum = calloc(noc * codes->dimension, sizeof(double));
+	  if (bs->msum == NULL)
+	    {
+	      fprintf(stderr, "batch_som_training: can't allocate memory\n");
+	      ERROR(ERR_NOMEM);
+	      return 1;
+	    }
+	}
+    }
+  for (k = 0; k < noc; k++)
+    bs->first[k + 1] += bs->first[k];
+  for (i = 0; i < bs->n; i++)
+    {
+      k = bs->win[i].index;
+      if ((k >= 0) && (k < noc))
+	bs->order[bs->first[k]++] = i;
+    }
+  for (k = noc; k > 0; k--)
+    bs->first[k] = bs->first[k - 1];
+  bs->first[0] = 0;
+
+  run_threads(batch_sums, bs, nthreads);
+  return 0;
+}
+
+/* batch_som_training - train a SOM with the batch algorithm, see above.
+   The training length is counted in samples and rounded up to whole
+   epochs. */
+
+struct entries *batch_som_training(struct teach_params *teach)
+{
+  struct data_entry *sample;
+  struct entries *data = teach->data;
+  struct entries *codes = teach->codes;
+  struct snapshot_info *snap = teach->snapshot;
+  struct batch_state bs;
+  long le, epoch_len, noc, length = teach->length;
+  float radius = teach->radius, trad;
+  int nthreads, dim, error = 0;
+  eptr p;
+
+  if (set_som_params(teach))
+    {
+      fprintf(stderr, "batch_som_training: can't set SOM parameters\n");
+      return NULL;
+    }
+
+  if (!batch_usable(teach))
+    {
+      fprintf(stderr, "batch_som_training: batch training needs a flat map and the default functions\n");
+      return NULL;
+    }
+
+  dim = codes->dimension;
+  if (data->dimension != dim)
     {
-      fprintf(stderr, "som_training: can't get data\n");
+      fprintf(stderr, "code dimension (%d) != data dimension (%d)\n",
+	      dim, data->dimension);
+      return NULL;
+    }
+
+  noc = codes->num_entries;
+  nthreads = use_threads(-1);
+  current_kernels();
+
+  memset(&bs, 0, sizeof(bs));
+  bs.teach = teach;
+  bs.samples = malloc(BATCH_CHUNK * sizeof(struct data_entry *));
+  bs.win = malloc(BATCH_CHUNK * sizeof(struct winner_info));
+  bs.order = malloc(BATCH_CHUNK * sizeof(long));
+  bs.first = malloc((noc + 1) * sizeof(long));
+  bs.sum = malloc(noc * dim * sizeof(double));
+  bs.wsum = malloc(noc * sizeof(double));
+  if ((bs.samples == NULL) || (bs.win == NULL) || (bs.order == NULL) ||
+      (bs.first == NULL) || (bs.sum == NULL) || (bs.wsum == NULL))
+    {
+      fprintf(stderr, "batch_som_training: can't allocate memory\n");
+      ERROR(ERR_NOMEM);
+      error = 1;
+      goto end;
+    }
+
+  ifverbose(2)
+    fprintf(stderr, "batch training with %d threads\n", nthreads);
+
+  time(&teach->start_time);
+
+  for (le = 0; le < length; le += epoch_len)
+    {
+      trad = 1.0 + (radius - 1.0) * (float) (length - le) / (float) length;
+
+      memset(bs.sum, 0, noc * dim * sizeof(double));
+      memset(bs.wsum, 0, noc * sizeof(double));
+      if (bs.msum)
+	memset(bs.msum, 0, noc * dim * sizeof(double));
+
+      /* the codebook stays the same during the epoch */
+      bs.cp = getenv("LVQSOM_NOBATCH") ? NULL : make_code_panels(codes);
+
+      if ((sample = rewind_entries(data, &p)) == NULL)
+	{
+	  fprintf(stderr, "batch_som_training: can't get data\n");
+	  error = 1;
+	  goto end;
+	}
+
+      /* In buffered mode the samples are valid only until the next
+	 part of the file is read, so the chunks end there. */
+      for (epoch_len = 0, bs.n = 0; sample != NULL; sample = next_entry(&p))
+	{
+	  bs.samples[bs.n++] = sample;
+	  if ((bs.n == BATCH_CHUNK) || (sample->next == NULL))
+	    {
+	      if (batch_chunk(&bs, nthreads))
+		{
+		  error = 1;
+		  goto end;
+		}
+	      epoch_len += bs.n;
+	      bs.n = 0;
+	    }
+	}
+
+      free_code_panels(bs.cp);
+      bs.cp = NULL;
+
+      if (epoch_len == 0)
+	{
+	  fprintf(stderr, "batch_som_training: no data\n");
+	  error = 1;
+	  goto end;
+	}
+
+      /* the neighbourhood tables are made here, the threads only read
+	 them */
+      bs.ns = NULL;
+      bs.gt = NULL;
+      if (teach->neigh == NEIGH_GAUSSIAN)
+	{
+	  if ((bs.gt = get_gauss(teach, trad)) != NULL)
+	    fill_gauss(bs.gt);
+	}
+      else
+	bs.ns = get_spans(teach, trad);
+      if ((bs.ns == NULL) && (bs.gt == NULL))
+	{
+	  fprintf(stderr, "batch_som_training: can't allocate memory\n");
+	  ERROR(ERR_NOMEM);
+	  error = 1;
+	  goto end;
+	}
+
+      bs.failed = 0;
+      run_threads(batch_smooth, &bs, nthreads);
+      if (bs.failed)
+	{
+	  fprintf(stderr, "batch_som_training: can't allocate memory\n");
+	  ERROR(ERR_NOMEM);
+	  error = 1;
+	  goto end;
+	}
+
+      /* the pruning bounds must know how far the units moved */
+      if ((teach->winner == find_winner_prune) && prune_moved(codes))
+	{
+	  error = 1;
+	  goto end;
+	}
+
+      ifverbose(3)
+	fprintf(stderr, "epoch of %ld samples, radius %f\n", epoch_len, trad);
+
+      /* save snapshot when needed */
+      if (snap && (le + epoch_len < length) &&
+	  ((le + epoch_len) / snap->interval > le / snap->interval))
+	{
+	  ifverbose(2)
+	    fprintf(stderr, "Saving snapshot, %ld iterations\n",
+		    le + epoch_len);
+	  if (save_snapshot(teach, le + epoch_len))
+	    fprintf(stderr, "snapshot failed, continuing teaching\n");
+	}
+
+      ifverbose(1)
+	mprint((long) (length - le - epoch_len > 0 ? length - le - epoch_len
+		       : 0));
+    }
+  time(&teach->end_time);
+
+  ifverbose(1)
+    {
+      mprint((long) 0);
+      fprintf(stderr, "\n");
+    }
+
+ end:
+  free_code_panels(bs.cp);
+  ofree(bs.samples);
+  ofree(bs.win);
+  ofree(bs.order);
+  ofree(bs.first);
+  ofree(bs.sum);
+  ofree(bs.wsum);
+  ofree(bs.msum);
+
+  return error ? NULL : codes;
+}
+
+/*---------------------------------------------------------------------*/
+
+/* Mini-batch training. The winners of 'size' samples are found at once
+   against the same codebook and the samples are summed up unit by unit
+   as in batch training. The units in the neighbourhoods of the winners
+   are then moved towards the weighted means of the samples around
+   them, with alpha and radius of som_training at the first sample of
+   the mini-batch. */
+
+/* minibatch_adapt - adapt the units in a part of the rows of the map.
+   The rate of a unit is alpha times the sum of the neighbourhood
+   weights of the samples, but at most one, so that the unit moves
+   about as far as it would with the samples one at a time when the
+   rate is small. The sums of a unit are taken in the order of the
+   winners, so the results don't depend on the number of threads. */
+
+static void minibatch_adapt(void *arg, int thread, int nthreads)
+{
+  struct batch_state *bs = arg;
+  struct entries *codes = bs->teach->codes;
+  int dim = codes->dimension, xdim = codes->xdim, d, dy, jx, jy, kx, ky;
+  int x0, x1, ry = (bs->gt != NULL) ? bs->gt->ry : bs->ns->ry;
+  long i, j, k, r0, r1;
+  double h, den, rate, *num, *mnum, *knum, *kmsum;
+  float *c, *w = NULL;
+
+  thread_range(codes->ydim, thread, nthreads, &r0, &r1);
+
+  for (i = 0; i < bs->nwinners; i++)
+    {
+      k = bs->winners[i];
+      kx = k % xdim;
+      ky = k / xdim;
+      knum = bs->sum + k * dim;
+      kmsum = (bs->msum != NULL) ? bs->msum + k * dim : NULL;
+
+      for (dy = -ry; dy <= ry; dy++)
+	{
+	  jy = ky + dy;
+	  if ((jy < r0) || (jy >= r1))
+	    continue;
+	  if (bs->gt != NULL)
+	    {
+	      if ((w = gauss_row(bs->gt, kx, ky, dy, &x0, &x1)) == NULL)
+		continue;
+	    }
+	  else if (!span_row(bs->ns, kx, ky, dy, &x0, &x1))
+	    continue;
+
+	  for (jx = x0; jx <= x1; jx++)
+	    {
+	      j = (long) jy * xdim + jx;
+	      h = (w != NULL) ? w[jx - kx] : 1.0;
+	      bs->accw[j] += h * bs->wsum[k];
+	      num = bs->acc + j * dim;
+	      for (d = 0; d < dim; d++)
+		num[d] += h * knum[d];
+	      if (kmsum != NULL)
+		for (mnum = bs->accm + j * dim, d = 0; d < dim; d++)
+		  mnum[d] += h * kmsum[d];
+	    }
+	}
+    }
+
+  for (j = r0 * xdim; j < r1 * xdim; j++)
+    {
+      if (bs->accw[j] == 0.0)
+	continue;
+      c = block_row(codes, j);
+      num = bs->acc + j * dim;
+      mnum = (bs->accm != NULL) ? bs->accm + j * dim : NULL;
+      for (d = 0; d < dim; d++)
+	{
+	  den = bs->accw[j] - ((mnum != NULL) ? mnum[d] : 0.0);
+	  if (den > 0.0)
+	    {
+	      rate = bs->alpha * den;
+	      if (rate > 1.0)
+		rate = 1.0;
+	      c[d] += rate * (num[d] / den - c[d]);
+	    }
+	  num[d] = 0.0;
+	  if (mnum != NULL)
+	    mnum[d] = 0.0;
+	}
+      bs->accw[j] = 0.0;
+    }
+}
+
+/* minibatch_som_training - train a SOM with mini-batches of 'size'
+   samples, see above */
+
+struct entries *minibatch_som_training(struct teach_params *teach, long size)
+{
+  ALPHA_FUNC *get_alpha = teach->alpha_func;
+  struct data_entry *sample;
+  struct entries *data = teach->data;
+  struct entries *codes = teach->codes;
+  struct snapshot_info *snap = teach->snapshot;
+  struct batch_state bs;
+  long le, i, k, noc, length = teach->length;
+  float radius = teach->radius, alpha = teach->alpha, trad;
+  int nthreads, dim, advance = 0, error = 0;
+  eptr p;
+
+  if (set_som_params(teach))
+    {
+      fprintf(stderr, "minibatch_som_training: can't set SOM parameters\n");
+      return NULL;
+    }
+
+  if (!parallel_usable(teach))
+    {
+      fprintf(stderr, "minibatch_som_training: mini-batch training needs a flat map and the default functions\n");
       return NULL;
     }
 
@@ -595,71 +2664,375 @@ struct entries *som_training(struct teach_params *teach)
       return NULL;
     }
 
+  if (size < 1)
+    size = 1;
+  if (size > BATCH_CHUNK)
+    size = BATCH_CHUNK;
+
+  noc = codes->num_entries;
+  nthreads = use_threads(-1);
+  current_kernels();
+
+  memset(&bs, 0, sizeof(bs));
+  bs.teach = teach;
+  bs.samples = malloc(size * sizeof(struct data_entry *));
+  bs.win = malloc(size * sizeof(struct winner_info));
+  bs.order = malloc(size * sizeof(long));
+  bs.winners = malloc(size * sizeof(long));
+  bs.first = malloc((noc + 1) * sizeof(long));
+  bs.sum = calloc(noc * dim, sizeof(double));
+  bs.wsum = calloc(noc, sizeof(double));
+  bs.acc = calloc(noc * dim, sizeof(double));
+  bs.accw = calloc(noc, sizeof(double));
+  if ((bs.samples == NULL) || (bs.win == NULL) || (bs.order == NULL) ||
+      (bs.winners == NULL) || (bs.first == NULL) || (bs.sum == NULL) ||
+      (bs.wsum == NULL) || (bs.acc == NULL) || (bs.accw == NULL))
+    {
+      fprintf(stderr, "minibatch_som_training: can't allocate memory\n");
+      ERROR(ERR_NOMEM);
+      error = 1;
+      goto end;
+    }
+
+  if ((sample = rewind_entries(data, &p)) == NULL)
+    {
+      fprintf(stderr, "minibatch_som_training: can't get data\n");
+      error = 1;
+      goto end;
+    }
+
+  ifverbose(2)
+    fprintf(stderr, "mini-batch training, %ld samples at a time, %d threads\n",
+	    size, nthreads);
+
   time(&teach->start_time);
 
-  for (le = 0; le < length; le++, sample = next_entry(&p)) {
-    /* if we are at the end of data file, go back to the start */
-    if (sample == NULL)
-      {
-	sample = rewind_entries(data, &p);
-	if (sample == NULL)
+  for (le = 0; le < length; le += bs.n)
+    {
+      trad = 1.0 + (radius - 1.0) * (float) (length - le) / (float) length;
+      bs.alpha = get_alpha(le, length, alpha);
+
+      /* In buffered mode the samples are valid only until the next
+	 part of the file is read, so a mini-batch ends there. */
+      for (bs.n = 0; (bs.n < size) && (le + bs.n < length); )
+	{
+	  if (advance)
+	    sample = next_entry(&p);
+	  if (sample == NULL)
+	    if ((sample = rewind_entries(data, &p)) == NULL)
+	      {
+		fprintf(stderr, "minibatch_som_training: couldn't rewind data (%ld/%ld iterations done)\n", le, length);
+		error = 1;
+		goto end;
+	      }
+	  bs.samples[bs.n++] = sample;
+	  advance = 1;
+	  if (sample->next == NULL)
+	    break;
+	}
+
+      bs.cp = getenv("LVQSOM_NOBATCH") ? NULL : make_code_panels(codes);
+      if (batch_chunk(&bs, nthreads))
+	{
+	  error = 1;
+	  goto end;
+	}
+      free_code_panels(bs.cp);
+      bs.cp = NULL;
+
+      if ((bs.msum != NULL) && (bs.accm == NULL))
+	if ((bs.accm = calloc(noc * dim, sizeof(double))) == NULL)
 	  {
-	    fprintf(stderr, "som_training: couldn't rewind data (%ld/%ld iterations done)\n", le, length);
-	    return NULL;
+	    fprintf(stderr, "minibatch_som_training: can't allocate memory\n");
+	    ERROR(ERR_NOMEM);
+	    error = 1;
+	    goto end;
 	  }
-      }
 
-    weight = sample->weight;
+      for (bs.nwinners = 0, k = 0; k < noc; k++)
+	if (bs.first[k + 1] > bs.first[k])
+	  bs.winners[bs.nwinners++] = k;
 
-    /* Radius decreases linearly to one */
-    trad = 1.0 + (radius - 1.0) * (float) (length - le) / (float) length;
+      bs.ns = NULL;
+      bs.gt = NULL;
+      if (teach->neigh == NEIGH_GAUSSIAN)
+	{
+	  if ((bs.gt = get_gauss(teach, trad)) != NULL)
+	    fill_gauss(bs.gt);
+	}
+      else
+	bs.ns = get_spans(teach, trad);
+      if ((bs.ns == NULL) && (bs.gt == NULL))
+	{
+	  fprintf(stderr, "minibatch_som_training: can't allocate memory\n");
+	  ERROR(ERR_NOMEM);
+	  error = 1;
+	  goto end;
+	}
 
-    talp = get_alpha(le, length, alpha);
+      run_threads(minibatch_adapt, &bs, nthreads);
 
-    /* If the sample is weighted, we
-       modify the training rate so that we achieve the same effect as
-       repeating the sample 'weight' times */
-    if ((weight > 0.0) && (use_weights(-1))) {
-      talp = 1.0 - (float) pow((double) (1.0 - talp), (double) weight);
+      /* clear the sums for the next mini-batch */
+      for (i = 0; i < bs.nwinners; i++)
+	{
+	  k = bs.winners[i];
+	  memset(bs.sum + k * dim, 0, dim * sizeof(double));
+	  if (bs.msum)
+	    memset(bs.msum + k * dim, 0, dim * sizeof(double));
+	  bs.wsum[k] = 0.0;
+	}
+
+      /* save snapshot when needed */
+      if (snap && (le + bs.n < length) &&
+	  ((le + bs.n) / snap->interval > le / snap->interval))
+	{
+	  ifverbose(2)
+	    fprintf(stderr, "Saving snapshot, %ld iterations\n", le + bs.n);
+	  if (save_snapshot(teach, le + bs.n))
+	    fprintf(stderr, "snapshot failed, continuing teaching\n");
+	}
+
+      ifverbose(1)
+	mprint((long) (length - le - bs.n));
     }
+  time(&teach->end_time);
 
-    /* Find the best match */
-    /* If fixed point and is allowed then use that value */
-    if ((sample->fixed != NULL) && (use_fixed(-1))) {
-      /* Get the values from fixed-structure */
-      bxind = sample->fixed->xfix;
-      byind = sample->fixed->yfix;
+  ifverbose(1)
+    {
+      mprint((long) 0);
+      fprintf(stderr, "\n");
     }
-    else {
 
-      if (find_winner(codes, sample, &win_info, 1) == 0)
+ end:
+  free_code_panels(bs.cp);
+  ofree(bs.samples);
+  ofree(bs.win);
+  ofree(bs.order);
+  ofree(bs.winners);
+  ofree(bs.first);
+  ofree(bs.sum);
+  ofree(bs.wsum);
+  ofree(bs.msum);
+  ofree(bs.acc);
+  ofree(bs.accw);
+  ofree(bs.accm);
+
+  return error ? NULL : codes;
+}
+
+/*---------------------------------------------------------------------*/
+
+/* Parallel online training. The threads take the iterations of
+   som_training one at a time, with the same sample, radius and alpha
+   for each, and search the winners against the shared codebook at the
+   same time. In PARALLEL_LOCKED mode a thread locks the rows of the map
+   that its neighbourhood covers while it adapts them; in
+   PARALLEL_HOGWILD mode the threads write without locks. Either way a
+   winner may have been searched against a codebook that other threads
+   have changed since; the number of such updates is the staleness of
+   the update, and its mean and maximum are reported. With one thread
+   this is som_training. */
+
+struct typelist parallel_list[] = {
+  {PARALLEL_LOCKED, "locked", NULL},
+  {PARALLEL_HOGWILD, "hogwild", NULL},
+  {PARALLEL_OFF, NULL, NULL}};
+
+struct parallel_state {
+  struct teach_params *teach;
+  struct data_entry **samples;
+  long n;
+  int mode;
+  struct thread_locks *lock;    /* protects the fields below */
+  long next;                    /* the next iteration */
+  long done;                    /* updates done */
+  double stale_sum;
+  long stale_max;
+  struct thread_locks *rows;    /* one for each row of the map */
+  int failed;
+};
+
+/* neigh_rows - the number of rows above and below the winner that the
+   neighbourhood function adapts */
+
+static int neigh_rows(struct teach_params *teach, float radius)
+{
+  struct neigh_spans *ns;
+  struct gauss_table *gt;
+
+  if ((teach->neigh_adapt == bubble_adapt) &&
+      ((ns = get_spans(teach, radius)) != NULL))
+    return ns->ry;
+  if ((teach->neigh_adapt == gaussian_adapt) && (teach->cutoff > 0.0) &&
+      ((gt = get_gauss(teach, radius)) != NULL))
+    return gt->ry;
+  return teach->codes->ydim;
+}
+
+static void parallel_worker(void *arg, int thread, int nthreads)
+{
+  struct parallel_state *ps = arg;
+  struct teach_params teach = *ps->teach;
+  struct entries *codes = teach.codes;
+  struct snapshot_info *snap = teach.snapshot;
+  long le, length = teach.length, s0, stale;
+  float radius = teach.radius, alpha = teach.alpha;
+  float weight, trad, talp;
+  int bxind, byind, ry;
+  struct data_entry *sample;
+  struct winner_info win_info;
+
+  /* the tables of the neighbourhood change with the radius, so each
+     thread has its own */
+  teach.threads = 1;
+  if ((teach.tables = new_neigh_tables()) == NULL)
+    {
+      ps->failed = 1;
+      return;
+    }
+
+  for (;;)
+    {
+      lock_range(ps->lock, 0, 0);
+      le = ps->next++;
+      s0 = ps->done;
+      if (le < length)
+	ifverbose(1)
+	  mprint((long) (length - le));
+      unlock_range(ps->lock, 0, 0);
+      if (le >= length)
+	break;
+
+      sample = ps->samples[le % ps->n];
+      weight = sample->weight;
+      trad = 1.0 + (radius - 1.0) * (float) (length - le) / (float) length;
+      talp = teach.alpha_func(le, length, alpha);
+      if ((weight > 0.0) && (use_weights(-1)))
+	talp = 1.0 - (float) pow((double) (1.0 - talp), (double) weight);
+
+      if ((sample->fixed != NULL) && (use_fixed(-1)))
 	{
-	  ifverbose(3)
-	    fprintf(stderr, "ignoring empty sample %ld\n", le);
-	  goto skip_teach; /* ignore empty samples */
+	  bxind = sample->fixed->xfix;
+	  byind = sample->fixed->yfix;
+	}
+      else
+	{
+	  if (teach.winner(codes, sample, &win_info, 1) == 0)
+	    continue; /* ignore empty samples */
+	  sample->bmu = win_info.index;
+	  bxind = win_info.index % codes->xdim;
+	  byind = win_info.index / codes->xdim;
+	}
+
+      ry = neigh_rows(&teach, trad);
+      if (ps->mode == PARALLEL_LOCKED)
+	lock_range(ps->rows, byind - ry, byind + ry);
+      teach.neigh_adapt(&teach, sample, bxind, byind, trad, talp);
+      if (ps->mode == PARALLEL_LOCKED)
+	unlock_range(ps->rows, byind - ry, byind + ry);
+
+      lock_range(ps->lock, 0, 0);
+      stale = ps->done - s0;
+      ps->done++;
+      ps->stale_sum += stale;
+      if (stale > ps->stale_max)
+	ps->stale_max = stale;
+      unlock_range(ps->lock, 0, 0);
+
+      /* save snapshot when needed, with the whole map locked */
+      if ((snap) && ((le % snap->interval) == 0) && (le > 0))
+	{
+	  lock_range(ps->rows, 0, codes->ydim - 1);
+	  ifverbose(2)
+	    fprintf(stderr, "Saving snapshot, %ld iterations\n", le);
+	  if (save_snapshot(&teach, le))
+	    fprintf(stderr, "snapshot failed, continuing teaching\n");
+	  unlock_range(ps->rows, 0, codes->ydim - 1);
 	}
-      bxind = win_info.index % codes->xdim;
-      byind = win_info.index / codes->xdim;
     }
 
-    /* Adapt the units */
-    adapt(teach, sample, bxind, byind, trad, talp);
+  free_neigh_tables(teach.tables);
+}
 
-  skip_teach:
-    /* save snapshot when needed */
-    if ((snap) && ((le % snap->interval) == 0) && (le > 0))
-      {
-	ifverbose(2)
-	  fprintf(stderr, "Saving snapshot, %ld iterations\n", le);
-	if (save_snapshot(teach, le))
-	  {
-	    fprintf(stderr, "snapshot failed, continuing teaching\n");
-	  }
-      }
+/* parallel_som_training - train a SOM online with use_threads()
+   threads, see above. mode is PARALLEL_LOCKED or PARALLEL_HOGWILD. */
+
+struct entries *parallel_som_training(struct teach_params *teach, int mode)
+{
+  struct parallel_state ps;
+  struct data_entry *sample;
+  struct entries *data = teach->data;
+  struct entries *codes = teach->codes;
+  int nthreads = use_threads(-1);
+  long n;
+  eptr p;
+
+  if (nthreads < 2)
+    return som_training(teach);
+
+  if (set_som_params(teach))
+    {
+      fprintf(stderr, "parallel_som_training: can't set SOM parameters\n");
+      return NULL;
+    }
+
+  if (!parallel_usable(teach))
+    {
+      fprintf(stderr, "parallel_som_training: parallel training needs a flat map and the default functions\n");
+      return NULL;
+    }
+
+  if (data->dimension != codes->dimension)
+    {
+      fprintf(stderr, "code dimension (%d) != data dimension (%d)\n",
+	      codes->dimension, data->dimension);
+      return NULL;
+    }
+
+  if ((sample = rewind_entries(data, &p)) == NULL)
+    {
+      fprintf(stderr, "parallel_som_training: can't get data\n");
+      return NULL;
+    }
 
+  /* the threads need all samples in memory */
+  if (data->flags.loadmode != LOADMODE_ALL)
+    {
+      ifverbose(1)
+	fprintf(stderr, "parallel_som_training: buffered data, training in one thread\n");
+      return som_training(teach);
+    }
+
+  if (teach->local_search != LOCAL_OFF)
     ifverbose(1)
-      mprint((long) (length-le));
-  }
+      fprintf(stderr, "parallel_som_training: local winner search not used\n");
+
+  memset(&ps, 0, sizeof(ps));
+  for (n = 0; sample != NULL; sample = next_entry(&p))
+    n++;
+  ps.teach = teach;
+  ps.mode = mode;
+  ps.n = n;
+  ps.samples = malloc(n * sizeof(struct data_entry *));
+  ps.lock = new_locks(1);
+  ps.rows = new_locks(codes->ydim);
+  if ((ps.samples == NULL) || (ps.lock == NULL) || (ps.rows == NULL))
+    {
+      fprintf(stderr, "parallel_som_training: can't allocate memory\n");
+      ERROR(ERR_NOMEM);
+      codes = NULL;
+      goto end;
+    }
+  for (n = 0, sample = rewind_entries(data, &p); sample != NULL;
+       sample = next_entry(&p))
+    ps.samples[n++] = sample;
+
+  ifverbose(2)
+    fprintf(stderr, "parallel training with %d threads\n", nthreads);
+
+  current_kernels();
+  time(&teach->start_time);
+  run_threads(parallel_worker, &ps, nthreads);
   time(&teach->end_time);
 
   ifverbose(1)
@@ -667,7 +3040,24 @@ struct entries *som_training(struct teach_params *teach)
       mprint((long) 0);
       fprintf(stderr, "\n");
     }
-  return(codes);
+
+  if (ps.failed)
+    {
+      fprintf(stderr, "parallel_som_training: can't allocate memory\n");
+      ERROR(ERR_NOMEM);
+      codes = NULL;
+      goto end;
+    }
+
+  ifverbose(1)
+    fprintf(stderr, "parallel training: staleness %.2f updates on average, at most %ld\n",
+	    (ps.done > 0) ? ps.stale_sum / ps.done : 0.0, ps.stale_max);
+
+ end:
+  ofree(ps.samples);
+  free_locks(ps.lock);
+  free_locks(ps.rows);
+  return codes;
 }
 
 
@@ -683,6 +3073,7 @@ float find_qerror(struct teach_params *teach)
   WINNER_FUNCTION *find_winner = teach->winner;
   struct data_entry *dtmp;
   struct winner_info win_info;
+  struct winner_batch *batch;
   eptr p;
   int length_known;
   long nod;
@@ -707,9 +3098,12 @@ float find_qerror(struct teach_params *teach)
   else
     nod = 0;
 
+  /* find the winners all at once if the data is in memory */
+  batch = batch_winners(codes, data, find_winner);
+
   for (; dtmp != NULL; dtmp = next_entry(&p)) 
     {
-      if (find_winner(codes, dtmp, &win_info, 1) == 0)
+      if (batch_winner(batch, codes, dtmp, &win_info, find_winner) == 0)
 	continue; /* ignore empty vectors */
       
       qerror += sqrt((double) win_info.diff);
@@ -719,6 +3113,7 @@ float find_qerror(struct teach_params *teach)
 	  mprint((long) nod--);
 
     }
+  free_winner_batch(batch);
 
   if (length_known)
     ifverbose(1)
@@ -735,7 +3130,8 @@ float bubble_qerror(struct teach_params *teach, struct data_entry *sample,
 		   int bx, int by, float radius)
 {
   long index;
-  int tx, ty, xdim;
+  int tx, ty, xdim, dy, x0, x1;
+  struct neigh_spans *ns;
   struct entries *codes = teach->codes;
   MAPDIST_FUNCTION *mdist = teach->mapdist;
   DIST_FUNCTION *distance = teach->dist;
@@ -748,9 +3144,23 @@ float bubble_qerror(struct teach_params *teach, struct data_entry *sample,
   ifverbose(10)
     fprintf(stderr, "Best match in %d, %d\n", bx, by);
 
+  qerror = 0;
+
+  if ((ns = get_spans(teach, radius)) != NULL)
+    {
+      for (dy = -ns->ry; dy <= ns->ry; dy++)
+	if (span_row(ns, bx, by, dy, &x0, &x1))
+	  for (ty = by + dy, tx = x0; tx <= x1; tx++)
+	    {
+	      d = distance(&codes->units[(long) ty * xdim + tx], sample,
+			   codes->dimension);
+	      qerror += d*d;
+	    }
+      return (qerror);
+    }
+
   codetmp = rewind_entries(codes, &p);
   index = 0;
-  qerror = 0;
 
   while (codetmp != NULL)
     {
@@ -777,13 +3187,14 @@ float gaussian_qerror(struct teach_params *teach, struct data_entry *sample,
 		     int bx, int by, float radius)
 {
   long index;
-  int tx, ty, xdim;
-  float dd;
+  int tx, ty, xdim, dy, x0, x1;
+  float dd, *w;
   float alp;
   struct entries *codes = teach->codes;
   MAPDIST_FUNCTION *mdist = teach->mapdist;
   DIST_FUNCTION *distance = teach->dist;
   struct data_entry *codetmp;
+  struct gauss_table *gt;
   eptr p;
   float d, qerror;
 
@@ -792,9 +3203,24 @@ float gaussian_qerror(struct teach_params *teach, struct data_entry *sample,
   ifverbose(10)
     fprintf(stderr, "Best match in %d, %d\n", bx, by);
 
+  qerror = 0.0;
+
+  /* the radius stays the same here, so the table is built only once */
+  if ((gt = get_gauss(teach, radius)) != NULL)
+    {
+      for (dy = -gt->ry; dy <= gt->ry; dy++)
+	if ((w = gauss_row(gt, bx, by, dy, &x0, &x1)) != NULL)
+	  for (ty = by + dy, tx = x0; tx <= x1; tx++)
+	    {
+	      d = distance(&codes->units[(long) ty * xdim + tx], sample,
+			   codes->dimension);
+	      qerror += w[tx - bx] * d * d;
+	    }
+      return (qerror);
+    }
+
   codetmp = rewind_entries(codes, &p);
   index = 0;
-  qerror = 0.0;
 
   while (codetmp != NULL)
     {
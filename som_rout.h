@@ -24,6 +24,47 @@
 
 #include "lvq_pak.h"
 
+/* number of samples whose winners are searched together in batch
+   training */
+
+#ifndef BATCH_CHUNK
+#define BATCH_CHUNK 65536
+#endif /* BATCH_CHUNK */
+
+/* principal components for the linear initialization: size of the
+   iterated block, relative accuracy and the most iterations */
+
+#ifndef PCA_BLOCK
+#define PCA_BLOCK 32
+#endif /* PCA_BLOCK */
+
+#ifndef PCA_TOL
+#define PCA_TOL 1e-4
+#endif /* PCA_TOL */
+
+#ifndef PCA_MAX_ITER
+#define PCA_MAX_ITER 100
+#endif /* PCA_MAX_ITER */
+
+/* the work of one sample in som_training is split between threads
+   only if each gets at least this many vector components */
+
+#ifndef SPLIT_MIN_WORK
+#define SPLIT_MIN_WORK 16384
+#endif /* SPLIT_MIN_WORK */
+
+/* size of the tiles of the codebook in the fused winner search and
+   adaptation */
+
+#ifndef FUSE_TILE_BYTES
+#define FUSE_TILE_BYTES (128 * 1024)
+#endif /* FUSE_TILE_BYTES */
+
+/* parallel online training */
+#define PARALLEL_OFF     0
+#define PARALLEL_LOCKED  1   /* lock the rows of the map being adapted */
+#define PARALLEL_HOGWILD 2   /* adapt without locks */
+
 typedef float NEIGH_QERROR(struct teach_params *teach,
 			   struct data_entry *sample,
 			   int bx, int by,
@@ -31,15 +72,23 @@ typedef float NEIGH_QERROR(struct teach_params *teach,
 
 struct entries *randinit_codes(struct entries *data, int topol, int neigh, int xdim, int ydim);
 struct entries *lininit_codes(struct entries *data, int topol, int neigh, int xdim, int ydim);
+struct entries *resample_codes(struct entries *codes, int xdim, int ydim);
 void normalize(float *v, int n);
 float dotprod(float *v, float *w, int n);
 int gram_schmidt(float *v, int n, int e);
 MAPDIST_FUNCTION hexa_dist, rect_dist, *get_mapdistf(int);
 NEIGH_ADAPT bubble_adapt, gaussian_adapt, *get_nadaptf(int);
 struct entries *som_training(struct teach_params *teach);
+struct entries *batch_som_training(struct teach_params *teach);
+struct entries *minibatch_som_training(struct teach_params *teach, long size);
+struct entries *parallel_som_training(struct teach_params *teach, int mode);
+struct neigh_tables *new_neigh_tables(void);
+void free_neigh_tables(struct neigh_tables *nt);
 float find_qerror(struct teach_params *teach);
 float find_qerror2(struct teach_params *teach);
 NEIGH_QERROR bubble_qerror, gaussian_qerror;
 int set_som_params(struct teach_params *params);
 
+extern struct typelist local_list[], parallel_list[];
+
 #endif /* SOM_ROUT_H */
@@ -0,0 +1,276 @@
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  thread_rout.c                                                       *
+ *   - running work in parallel in a pool of POSIX threads. Without     *
+ *     threads (NO_THREADS defined) all work is done in the calling     *
+ *     thread.                                                          *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef NO_THREADS
+#include <unistd.h>
+#include <pthread.h>
+#endif /* NO_THREADS */
+#include "lvq_pak.h"
+#include "thread_rout.h"
+
+/* use_threads - set the number of threads used if n > 0. With n == 0
+   one thread per processor is used. Returns the number of threads. */
+
+int use_threads(int n)
+{
+  static int threads = 1;
+
+#ifndef NO_THREADS
+  if (n == 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+      n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+      if (n < 1)
+	n = 1;
+    }
+
+  if (n > 0)
+    threads = (n < MAX_THREADS) ? n : MAX_THREADS;
+#endif /* NO_THREADS */
+
+  return threads;
+}
+
+#ifndef NO_THREADS
+
+/* The threads are kept in a pool and wait in pool_main for the parts of
+   the next job. A job is published by increasing gen under the mutex.
+   After a job the workers, and the caller waiting for them, first
+   watch gen or pending for POOL_SPIN rounds before they sleep on the
+   condition variables, so that a series of short jobs (such as the
+   work of one training sample) doesn't put them to sleep and wake them
+   up each time. */
+
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t start, done;
+  volatile long gen;            /* number of jobs started */
+  volatile int pending;         /* parts of the job still running */
+  THREAD_FUNC *func;
+  void *arg;
+  int nthreads;                 /* parts of the job */
+  int size;                     /* worker threads in the pool */
+  int busy;                     /* a job is running */
+  long seen[MAX_THREADS];       /* gen when the worker was started */
+  pthread_t tid[MAX_THREADS];
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	  PTHREAD_COND_INITIALIZER};
+
+static void *pool_main(void *p)
+{
+  int id = (int) (long) p, i, n;
+  long seen = pool.seen[id];
+  THREAD_FUNC *func;
+  void *arg;
+
+  for (;;)
+    {
+      for (i = 0; (i < POOL_SPIN) && (pool.gen == seen); i++)
+	;
+
+      pthread_mutex_lock(&pool.mutex);
+      while (pool.gen == seen)
+	pthread_cond_wait(&pool.start, &pool.mutex);
+      seen = pool.gen;
+      func = pool.func;
+      arg = pool.arg;
+      n = pool.nthreads;
+      pthread_mutex_unlock(&pool.mutex);
+
+      if (id >= n)
+	continue;   /* not needed this time */
+
+      func(arg, id, n);
+
+      pthread_mutex_lock(&pool.mutex);
+      if (--pool.pending == 0)
+	pthread_cond_signal(&pool.done);
+      pthread_mutex_unlock(&pool.mutex);
+    }
+
+  return NULL;
+}
+
+#endif /* NO_THREADS */
+
+/* run_threads - call func for each of the nthreads parts of the work
+   and wait until all are done. The first part is done in the calling
+   thread and the others by the threads of the pool, which is grown
+   when needed. Parts for which there are no threads (the pool couldn't
+   be grown, or run_threads was called again while a job is running)
+   are done in the calling thread too, so the results are the same in
+   any case. Returns the number of threads that were running. */
+
+int run_threads(THREAD_FUNC *func, void *arg, int nthreads)
+{
+  int i, workers = 0;
+
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > MAX_THREADS)
+    nthreads = MAX_THREADS;
+
+#ifndef NO_THREADS
+  if (nthreads > 1)
+    {
+      pthread_mutex_lock(&pool.mutex);
+      if (pool.busy)
+	pthread_mutex_unlock(&pool.mutex);
+      else
+	{
+	  while (pool.size < nthreads - 1)
+	    {
+	      pool.seen[pool.size + 1] = pool.gen;
+	      if (pthread_create(&pool.tid[pool.size + 1], NULL, pool_main,
+				 (void *) (long) (pool.size + 1)) != 0)
+		break;
+	      pool.size++;
+	    }
+	  workers = (pool.size < nthreads - 1) ? pool.size : nthreads - 1;
+	  pool.busy = 1;
+	  pool.func = func;
+	  pool.arg = arg;
+	  pool.nthreads = nthreads;
+	  pool.pending = workers;
+	  pool.gen++;
+	  pthread_cond_broadcast(&pool.start);
+	  pthread_mutex_unlock(&pool.mutex);
+	}
+    }
+#endif /* NO_THREADS */
+
+  func(arg, 0, nthreads);
+  for (i = workers + 1; i < nthreads; i++)
+    func(arg, i, nthreads);
+
+#ifndef NO_THREADS
+  if (workers > 0)
+    {
+      for (i = 0; (i < POOL_SPIN) && (pool.pending > 0); i++)
+	;
+      pthread_mutex_lock(&pool.mutex);
+      while (pool.pending > 0)
+	pthread_cond_wait(&pool.done, &pool.mutex);
+      pool.busy = 0;
+      pthread_mutex_unlock(&pool.mutex);
+    }
+#endif /* NO_THREADS */
+
+  return workers + 1;
+}
+
+/* thread_range - the part start ... end - 1 of n items that belongs to
+   a thread */
+
+void thread_range(long n, int thread, int nthreads, long *start, long *end)
+{
+  *start = (long) ((double) n * thread / nthreads);
+  *end = (long) ((double) n * (thread + 1) / nthreads);
+}
+
+struct thread_locks {
+  int n;
+#ifndef NO_THREADS
+  pthread_mutex_t *mutex;
+#endif /* NO_THREADS */
+};
+
+/* new_locks - make n locks. Returns NULL on error. */
+
+struct thread_locks *new_locks(int n)
+{
+  struct thread_locks *locks;
+#ifndef NO_THREADS
+  int i;
+#endif /* NO_THREADS */
+
+  if ((locks = malloc(sizeof(struct thread_locks))) == NULL)
+    return NULL;
+  locks->n = n;
+
+#ifndef NO_THREADS
+  locks->mutex = malloc((n > 0 ? n : 1) * sizeof(pthread_mutex_t));
+  if (locks->mutex == NULL)
+    {
+      free(locks);
+      return NULL;
+    }
+  for (i = 0; i < n; i++)
+    pthread_mutex_init(&locks->mutex[i], NULL);
+#endif /* NO_THREADS */
+
+  return locks;
+}
+
+void free_locks(struct thread_locks *locks)
+{
+#ifndef NO_THREADS
+  int i;
+#endif /* NO_THREADS */
+
+  if (locks == NULL)
+    return;
+
+#ifndef NO_THREADS
+  for (i = 0; i < locks->n; i++)
+    pthread_mutex_destroy(&locks->mutex[i]);
+  free(locks->mutex);
+#endif /* NO_THREADS */
+  free(locks);
+}
+
+/* lock_range - take the locks first ... last, limited to the existing
+   ones. The locks are always taken in increasing order, so threads
+   taking overlapping ranges can't deadlock. */
+
+void lock_range(struct thread_locks *locks, int first, int last)
+{
+#ifndef NO_THREADS
+  int i;
+
+  if (first < 0)
+    first = 0;
+  if (last >= locks->n)
+    last = locks->n - 1;
+  for (i = first; i <= last; i++)
+    pthread_mutex_lock(&locks->mutex[i]);
+#endif /* NO_THREADS */
+}
+
+void unlock_range(struct thread_locks *locks, int first, int last)
+{
+#ifndef NO_THREADS
+  int i;
+
+  if (first < 0)
+    first = 0;
+  if (last >= locks->n)
+    last = locks->n - 1;
+  for (i = last; i >= first; i--)
+    pthread_mutex_unlock(&locks->mutex[i]);
+#endif /* NO_THREADS */
+}
@@ -0,0 +1,55 @@
+#ifndef THREAD_ROUT_H
+#define THREAD_ROUT_H
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  thread_rout.h                                                       *
+ *   - header file for thread_rout.c: running work in parallel          *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include "lvq_pak.h"
+
+/* upper limit for the number of threads */
+
+#ifndef MAX_THREADS
+#define MAX_THREADS 256
+#endif /* MAX_THREADS */
+
+/* rounds a waiting thread checks for new work before it sleeps */
+
+#ifndef POOL_SPIN
+#define POOL_SPIN 20000
+#endif /* POOL_SPIN */
+
+/* a part of the work, called for thread = 0 ... nthreads - 1 */
+
+typedef void THREAD_FUNC(void *arg, int thread, int nthreads);
+
+/* a set of locks, numbered from 0 */
+
+struct thread_locks;
+
+int use_threads(int n);
+int run_threads(THREAD_FUNC *func, void *arg, int nthreads);
+void thread_range(long n, int thread, int nthreads, long *start, long *end);
+struct thread_locks *new_locks(int n);
+void free_locks(struct thread_locks *locks);
+void lock_range(struct thread_locks *locks, int first, int last);
+void unlock_range(struct thread_locks *locks, int first, int last);
+
+#endif /* THREAD_ROUT_H */
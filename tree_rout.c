@@ -0,0 +1,478 @@
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  tree_rout.c                                                         *
+ *   - exact nearest neighbour search with a kd-tree or a ball tree     *
+ *     built over a flat codebook                                       *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include "lvq_pak.h"
+#include "datafile.h"
+#include "tree_rout.h"
+
+/* The tree is built when it is first needed and kept with the codebook
+   (see the index field of struct entries). The vectors adapted through
+   adapt_vector_tree are counted: when the count has changed since the
+   tree was built, the tree is thrown away. A new one is built only when
+   the codebook has stayed unchanged between two searches, so during
+   training the codebook is simply scanned. */
+
+static long adapt_count = 0, last_count = 0;
+
+#define node_bounds(t, n) ((t)->bounds + (t)->nodes[n].bounds)
+#define coord(codes, t, i, d) (block_row((codes), (t)->perm[i])[d])
+
+/* new_node - add a node to the tree. Returns its index or -1. */
+
+static long new_node(struct code_tree *t, long start, long count)
+{
+  struct tree_node *n;
+  long nb = (t->type == TREE_KD) ? 2 * t->dim : t->dim;
+
+  if (t->num_nodes >= t->max_nodes)
+    {
+      t->max_nodes = 2 * t->max_nodes + 16;
+      t->nodes = realloc(t->nodes, t->max_nodes * sizeof(struct tree_node));
+    }
+  if (t->num_bounds + nb > t->max_bounds)
+    {
+      t->max_bounds = 2 * t->max_bounds + 16 * nb;
+      t->bounds = realloc(t->bounds, t->max_bounds * sizeof(float));
+    }
+  if ((t->nodes == NULL) || (t->bounds == NULL))
+    {
+      fprintf(stderr, "build_code_tree: can't allocate memory\n");
+      ERROR(ERR_NOMEM);
+      return -1;
+    }
+
+  n = &t->nodes[t->num_nodes];
+  n->start = start;
+  n->count = count;
+  n->left = n->right = -1;
+  n->bounds = t->num_bounds;
+  n->radius = 0.0;
+  t->num_bounds += nb;
+
+  return t->num_nodes++;
+}
+
+/* select_median - reorder perm[start ... start + count - 1] so that the
+   element at mid is the one that would be there if the range was sorted
+   by component d, smaller ones before and larger ones after it. */
+
+static void select_median(struct entries *codes, struct code_tree *t,
+			  long start, long count, long mid, int d)
+{
+  long lo = start, hi = start + count - 1, i, j, tmp;
+  float pivot;
+
+  while (lo < hi)
+    {
+      pivot = coord(codes, t, (lo + hi) / 2, d);
+      i = lo;
+      j = hi;
+      while (i <= j)
+	{
+	  while (coord(codes, t, i, d) < pivot)
+	    i++;
+	  while (coord(codes, t, j, d) > pivot)
+	    j--;
+	  if (i <= j)
+	    {
+	      tmp = t->perm[i];
+	      t->perm[i] = t->perm[j];
+	      t->perm[j] = tmp;
+	      i++;
+	      j--;
+	    }
+	}
+      if (mid <= j)
+	hi = j;
+      else if (mid >= i)
+	lo = i;
+      else
+	break;
+    }
+}
+
+/* build_node - build the subtree of the given vectors. lo and hi are
+   work space of dim floats. Returns the index of the node or -1. */
+
+static long build_node(struct entries *codes, struct code_tree *t,
+		       long start, long count, float *lo, float *hi)
+{
+  long node, i, left, right, mid;
+  int dim = t->dim, d, sd;
+  float *b, *c, x;
+  double sum, r, rmax;
+
+  if ((node = new_node(t, start, count)) < 0)
+    return -1;
+  b = node_bounds(t, node);
+
+  for (d = 0; d < dim; d++)
+    {
+      lo[d] = FLT_MAX;
+      hi[d] = -FLT_MAX;
+    }
+  for (i = start; i < start + count; i++)
+    for (c = block_row(codes, t->perm[i]), d = 0; d < dim; d++)
+      {
+	if (c[d] < lo[d])
+	  lo[d] = c[d];
+	if (c[d] > hi[d])
+	  hi[d] = c[d];
+      }
+
+  if (t->type == TREE_KD)
+    for (d = 0; d < dim; d++)
+      {
+	b[d] = lo[d];
+	b[dim + d] = hi[d];
+      }
+  else
+    {
+      /* center of the ball is the mean of the vectors */
+      for (d = 0; d < dim; d++)
+	{
+	  for (sum = 0.0, i = start; i < start + count; i++)
+	    sum += coord(codes, t, i, d);
+	  b[d] = sum / count;
+	}
+      for (rmax = 0.0, i = start; i < start + count; i++)
+	{
+	  for (r = 0.0, c = block_row(codes, t->perm[i]), d = 0; d < dim; d++)
+	    r += ((double) c[d] - b[d]) * ((double) c[d] - b[d]);
+	  if (r > rmax)
+	    rmax = r;
+	}
+      /* round up so that the ball surely contains all vectors */
+      t->nodes[node].radius = sqrt(rmax) * (1.0 + 4 * FLT_EPSILON);
+    }
+
+  if (count <= TREE_LEAF_SIZE)
+    return node;
+
+  /* split at the median of the component with the largest spread */
+  for (sd = 0, d = 1; d < dim; d++)
+    if (hi[d] - lo[d] > hi[sd] - lo[sd])
+      sd = d;
+  x = hi[sd] - lo[sd];
+  if (x <= 0.0)
+    return node; /* all vectors are equal */
+
+  mid = start + count / 2;
+  select_median(codes, t, start, count, mid, sd);
+
+  if ((left = build_node(codes, t, start, mid - start, lo, hi)) < 0)
+    return -1;
+  if ((right = build_node(codes, t, mid, start + count - mid, lo, hi)) < 0)
+    return -1;
+  t->nodes[node].left = left;
+  t->nodes[node].right = right;
+
+  return node;
+}
+
+/* build_code_tree - build a search tree of the given type over a flat
+   codebook. Returns NULL on error. */
+
+struct code_tree *build_code_tree(struct entries *codes, int type)
+{
+  struct code_tree *t;
+  float *lo, *hi;
+  long i, noc = codes->num_entries;
+  int dim = codes->dimension;
+
+  if (codes->block == NULL)
+    {
+      fprintf(stderr, "build_code_tree: codebook is not flat\n");
+      return NULL;
+    }
+
+  t = calloc(1, sizeof(struct code_tree));
+  lo = malloc(2 * dim * sizeof(float));
+  if ((t == NULL) || (lo == NULL) ||
+      ((t->perm = malloc((noc > 0 ? noc : 1) * sizeof(long))) == NULL))
+    {
+      fprintf(stderr, "build_code_tree: can't allocate memory\n");
+      ofree(lo);
+      ofree(t);
+      ERROR(ERR_NOMEM);
+      return NULL;
+    }
+  hi = lo + dim;
+
+  t->type = type;
+  t->dim = dim;
+  t->noc = noc;
+  t->stamp = adapt_count;
+  for (i = 0; i < noc; i++)
+    t->perm[i] = i;
+
+  if (build_node(codes, t, 0, noc, lo, hi) < 0)
+    {
+      free(lo);
+      free_code_tree(t);
+      return NULL;
+    }
+  free(lo);
+
+  ifverbose(2)
+    fprintf(stderr, "built %s tree of %ld vectors (%ld nodes)\n",
+	    (type == TREE_KD) ? "kd" : "ball", noc, t->num_nodes);
+
+  return t;
+}
+
+void free_code_tree(void *tree)
+{
+  struct code_tree *t = tree;
+
+  if (t)
+    {
+      ofree(t->perm);
+      ofree(t->nodes);
+      ofree(t->bounds);
+      free(t);
+    }
+}
+
+/* get_tree - returns the tree of the codebook, building it if needed.
+   Returns NULL if the codebook should be scanned. */
+
+static struct code_tree *get_tree(struct entries *codes)
+{
+  struct code_tree *t;
+
+  if ((codes->block == NULL) || (codes->num_entries < TREE_MIN_SIZE))
+    return NULL;
+
+  if (codes->index != NULL)
+    {
+      if (codes->free_index != free_code_tree)
+	return NULL; /* some other index is in use */
+
+      t = codes->index;
+      if (t->stamp == adapt_count)
+	return t;
+
+      /* the codebook has changed */
+      free_code_tree(t);
+      codes->index = NULL;
+      codes->free_index = NULL;
+    }
+
+  /* don't build while the codebook is being adapted */
+  if (last_count != adapt_count)
+    {
+      last_count = adapt_count;
+      return NULL;
+    }
+
+  t = build_code_tree(codes, (codes->dimension <= KD_MAX_DIM) ?
+		      TREE_KD : TREE_BALL);
+  if (t != NULL)
+    {
+      codes->index = t;
+      codes->free_index = free_code_tree;
+    }
+  return t;
+}
+
+struct tree_query {
+  struct code_tree *t;
+  struct entries *codes;
+  float *x;
+  int knn, n;
+  struct winner_info *win;
+  float bound;            /* distance of the k:th best so far */
+  long best;              /* the best one when knn == 1 */
+  double rel;             /* allowance for rounding errors */
+};
+
+/* lower_bound - smallest possible squared distance from the sample to
+   the vectors of a node */
+
+static double lower_bound(struct tree_query *q, long node)
+{
+  struct code_tree *t = q->t;
+  float *b = node_bounds(t, node), *x = q->x;
+  double diff, sum = 0.0;
+  int d, dim = t->dim;
+
+  if (t->type == TREE_KD)
+    {
+      for (d = 0; d < dim; d++)
+	{
+	  if (x[d] < b[d])
+	    diff = (double) b[d] - x[d];
+	  else if (x[d] > b[dim + d])
+	    diff = (double) x[d] - b[dim + d];
+	  else
+	    continue;
+	  sum += diff * diff;
+	}
+      return sum;
+    }
+
+  for (d = 0; d < dim; d++)
+    {
+      diff = (double) x[d] - b[d];
+      sum += diff * diff;
+    }
+  diff = sqrt(sum) - t->nodes[node].radius;
+  return (diff > 0.0) ? diff * diff : 0.0;
+}
+
+/* search_node - go through the vectors of a node that may be closer
+   than the current k:th best. The distances are summed exactly like in
+   find_winner_euc so that the results are the same as from a scan. */
+
+static void search_node(struct tree_query *q, long node)
+{
+  struct code_tree *t = q->t;
+  struct tree_node *n = &t->nodes[node];
+  float diff, difference, *c, *x = q->x;
+  double lb1, lb2, limit;
+  long i, index, first, second;
+  int d, dim = t->dim;
+
+  if (n->left < 0)
+    {
+      for (i = n->start; i < n->start + n->count; i++)
+	{
+	  index = t->perm[i];
+	  c = block_row(q->codes, index);
+	  difference = 0.0;
+	  for (d = 0; d < dim; d++)
+	    {
+	      diff = c[d] - x[d];
+	      difference += diff * diff;
+	      if (difference > q->bound)
+		break;
+	    }
+
+	  if (q->knn == 1)
+	    {
+	      /* of equal distances the first vector wins */
+	      if ((difference < q->bound) ||
+		  ((difference == q->bound) && (index < q->best)))
+		{
+		  q->bound = difference;
+		  q->best = index;
+		}
+	    }
+	  else if (difference <= q->bound)
+	    {
+	      heap_winner(q->win, &q->n, q->knn, difference, index,
+			  &q->codes->units[index]);
+	      if (q->n == q->knn)
+		q->bound = q->win[0].diff;
+	    }
+	}
+      return;
+    }
+
+  /* visit the closer child first */
+  lb1 = lower_bound(q, n->left);
+  lb2 = lower_bound(q, n->right);
+  first = n->left;
+  second = n->right;
+  if (lb2 < lb1)
+    {
+      first = n->right;
+      second = n->left;
+      limit = lb1;
+      lb1 = lb2;
+      lb2 = limit;
+    }
+
+  if (lb1 <= q->bound * q->rel)
+    search_node(q, first);
+  if (lb2 <= q->bound * q->rel)
+    search_node(q, second);
+}
+
+/* find_winner_tree - find the knn nearest codebook vectors with the
+   search tree. Returns the same winners as find_winner_euc (knn == 1)
+   and find_winner_knn. Masked samples, small codebooks and codebooks
+   that are being adapted are scanned with those functions. */
+
+int find_winner_tree(struct entries *codes, struct data_entry *sample,
+		     struct winner_info *win, int knn)
+{
+  struct tree_query q;
+  struct code_tree *t;
+
+  if (knn < 1)
+    knn = 1;
+
+  if ((sample->mask != NULL) || ((t = get_tree(codes)) == NULL))
+    {
+      if (knn == 1)
+	return find_winner_euc(codes, sample, win, 1);
+      return find_winner_knn(codes, sample, win, knn);
+    }
+
+  q.t = t;
+  q.codes = codes;
+  q.x = sample->points;
+  q.knn = knn;
+  q.n = 0;
+  q.win = win;
+  q.bound = FLT_MAX;
+  q.best = -1;
+  q.rel = 1.0 + 2 * (t->dim + 2) * FLT_EPSILON;
+
+  if (t->noc > 0)
+    search_node(&q, 0);
+
+  if (knn == 1)
+    {
+      win->index = q.best;
+      win->winner = (q.best >= 0) ? &codes->units[q.best] : NULL;
+      win->diff = (q.best >= 0) ? q.bound : -1.0;
+      if (q.best < 0)
+	ifverbose(3)
+	  fprintf(stderr, "find_winner_tree: can't find winner\n");
+      return 1;
+    }
+
+  sort_winners(win, q.n, knn);
+  if (win->index < 0)
+    ifverbose(3)
+      fprintf(stderr, "find_winner_tree: can't find winner\n");
+
+  return knn;
+}
+
+/* adapt_vector_tree - adapt_vector that lets the tree search know that
+   the codebook has changed */
+
+void adapt_vector_tree(struct data_entry *codetmp, struct data_entry *sample,
+		       int dim, float alpha)
+{
+  adapt_count++;
+  adapt_vector(codetmp, sample, dim, alpha);
+}
@@ -0,0 +1,77 @@
+#ifndef TREE_ROUT_H
+#define TREE_ROUT_H
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  tree_rout.h                                                         *
+ *   - header file for tree_rout.c: search trees for the codebook       *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include "lvq_pak.h"
+
+/* maximum number of vectors in a leaf of the tree */
+
+#ifndef TREE_LEAF_SIZE
+#define TREE_LEAF_SIZE 16
+#endif /* TREE_LEAF_SIZE */
+
+/* kd-trees are used up to this dimension, ball trees above it */
+
+#ifndef KD_MAX_DIM
+#define KD_MAX_DIM 16
+#endif /* KD_MAX_DIM */
+
+/* codebooks smaller than this are always scanned */
+
+#ifndef TREE_MIN_SIZE
+#define TREE_MIN_SIZE 64
+#endif /* TREE_MIN_SIZE */
+
+#define TREE_KD   0
+#define TREE_BALL 1
+
+struct tree_node {
+  long start, count;      /* the vectors perm[start ... start + count - 1] */
+  long left, right;       /* children, -1 in leaves */
+  long bounds;            /* offset of the bounds of the node */
+  float radius;           /* radius of a ball */
+};
+
+/* For kd-trees the bounds of a node are the lower and upper corners of
+   the bounding box (2 * dim floats), for ball trees the center of the
+   ball (dim floats). */
+
+struct code_tree {
+  int type;               /* TREE_KD or TREE_BALL */
+  int dim;
+  long noc;
+  long *perm;             /* codebook indices in the order of the leaves */
+  struct tree_node *nodes;
+  long num_nodes, max_nodes;
+  float *bounds;
+  long num_bounds, max_bounds;
+  long stamp;             /* adaptations done when the tree was built */
+};
+
+struct code_tree *build_code_tree(struct entries *codes, int type);
+void free_code_tree(void *tree);
+
+WINNER_FUNCTION find_winner_tree;
+VECTOR_ADAPT adapt_vector_tree;
+
+#endif /* TREE_ROUT_H */
@@ -24,6 +24,7 @@
 #include <float.h>
 #include "lvq_pak.h"
 #include "datafile.h"
+#include "bmu_rout.h"
 #include "som_rout.h"
 
 #define max(a,b) (((a) > (b)) ? (a) : (b))
@@ -53,6 +54,7 @@ struct entries *find_labels(struct teach_params *teach, int numlabs)
   struct entries *data = teach->data;
   struct entries *codes = teach->codes;
   struct winner_info win_info;
+  struct winner_batch *batch;
   struct hitlist **hits = NULL;
   struct hit_entry *hit;
   int showmeter = 0;
@@ -103,10 +105,13 @@ struct entries *find_labels(struct teach_params *teach, int numlabs)
     nol = 0;
   ind = 0;
 
+  /* find the winners all at once if the data is in memory */
+  batch = batch_winners(codes, data, winner);
+
   while (datatmp != NULL) {
     datalabel = get_entry_label(datatmp);
 
-    if (winner(codes, datatmp, &win_info, 1) == 0)
+    if (batch_winner(batch, codes, datatmp, &win_info, winner) == 0)
       goto skip_hit; /* winner not found -> assume that all components
 			of sample vector were masked off -> skip this
 			sample */
@@ -127,6 +132,7 @@ struct entries *find_labels(struct teach_params *teach, int numlabs)
       ifverbose(1)
 	mprint(nol--);
   }
+  free_winner_batch(batch);
 
   ifverbose(1)
     {
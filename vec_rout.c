@@ -0,0 +1,1071 @@
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  vec_rout.c                                                          *
+ *   - vectorized versions of the distance, winner search and           *
+ *     adaptation routines. The instruction set is selected at run      *
+ *     time according to what the processor supports.                  *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "lvq_pak.h"
+#include "datafile.h"
+#include "vec_rout.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif /* HAVE_X86_SIMD */
+
+/* the vectorized kernels handle whole blocks of 16 components */
+#if (DIST_BLOCK % 16) != 0
+#error DIST_BLOCK must be a multiple of 16
+#endif
+
+/*******************************************************************
+ * Kernels                                                         *
+ *******************************************************************/
+
+/* Portable versions */
+
+static float dist2_c(float *c, float *s, int dim)
+{
+  float diff, difference = 0.0;
+
+  while (dim-- > 0)
+    {
+      diff = *c++ - *s++;
+      difference += diff * diff;
+    }
+  return difference;
+}
+
+static void adapt_c(float *c, float *s, int dim, float a)
+{
+  int i;
+
+  for (i = 0; i < dim; i++)
+    c[i] += a * (s[i] - c[i]);
+}
+
+static float dist2b_c(float *c, float *s, int dim, float bound)
+{
+  float diff, difference = 0.0;
+  int i = 0, end;
+
+  while (i < dim)
+    {
+      end = (i + DIST_BLOCK < dim) ? i + DIST_BLOCK : dim;
+      for (; i < end; i++)
+	{
+	  diff = c[i] - s[i];
+	  difference += diff * diff;
+	}
+      if (difference > bound)
+	break;
+    }
+  return difference;
+}
+
+static float wdist2_c(float *c, float *s, float *w, int dim)
+{
+  float diff, difference = 0.0;
+
+  while (dim-- > 0)
+    {
+      diff = *c++ - *s++;
+      difference += *w++ * diff * diff;
+    }
+  return difference;
+}
+
+static void wadapt_c(float *c, float *s, float *w, int dim, float a)
+{
+  int i;
+
+  for (i = 0; i < dim; i++)
+    c[i] += a * w[i] * (s[i] - c[i]);
+}
+
+static void tile_c(float *x, long xstride, float *panel, int dim, float *out)
+{
+  float xd, *p, *o;
+  int r, d, j;
+
+  for (r = 0; r < TILE_ROWS; r++, x += xstride)
+    {
+      o = out + r * TILE_COLS;
+      for (j = 0; j < TILE_COLS; j++)
+	o[j] = 0.0;
+      for (d = 0, p = panel; d < dim; d++, p += TILE_COLS)
+	{
+	  xd = x[d];
+	  for (j = 0; j < TILE_COLS; j++)
+	    o[j] += xd * p[j];
+	}
+    }
+}
+
+static float qdist2_c(signed char *q, float *y, float *w, int dim)
+{
+  float diff, difference = 0.0;
+
+  while (dim-- > 0)
+    {
+      diff = *y++ - *q++;
+      difference += *w++ * diff * diff;
+    }
+  return difference;
+}
+
+static int always(void)
+{
+  return 1;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* SSE2 */
+
+__attribute__((target("sse2")))
+static float dist2_sse2(float *c, float *s, int dim)
+{
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), d0, d1;
+  float t[4], difference, diff;
+  int i = 0;
+
+  for (; i + 8 <= dim; i += 8)
+    {
+      d0 = _mm_sub_ps(_mm_loadu_ps(c + i), _mm_loadu_ps(s + i));
+      d1 = _mm_sub_ps(_mm_loadu_ps(c + i + 4), _mm_loadu_ps(s + i + 4));
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+    }
+  for (; i + 4 <= dim; i += 4)
+    {
+      d0 = _mm_sub_ps(_mm_loadu_ps(c + i), _mm_loadu_ps(s + i));
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+    }
+  _mm_storeu_ps(t, _mm_add_ps(acc0, acc1));
+  difference = (t[0] + t[1]) + (t[2] + t[3]);
+
+  for (; i < dim; i++)
+    {
+      diff = c[i] - s[i];
+      difference += diff * diff;
+    }
+  return difference;
+}
+
+__attribute__((target("sse2")))
+static void adapt_sse2(float *c, float *s, int dim, float a)
+{
+  __m128 va = _mm_set1_ps(a), vc;
+  int i = 0;
+
+  for (; i + 4 <= dim; i += 4)
+    {
+      vc = _mm_loadu_ps(c + i);
+      vc = _mm_add_ps(vc, _mm_mul_ps(va, _mm_sub_ps(_mm_loadu_ps(s + i), vc)));
+      _mm_storeu_ps(c + i, vc);
+    }
+  for (; i < dim; i++)
+    c[i] += a * (s[i] - c[i]);
+}
+
+__attribute__((target("sse2")))
+static float dist2b_sse2(float *c, float *s, int dim, float bound)
+{
+  __m128 acc = _mm_setzero_ps(), d;
+  float t[4], difference = 0.0, diff;
+  int i = 0, j;
+
+  while (i + DIST_BLOCK <= dim)
+    {
+      for (j = 0; j < DIST_BLOCK; j += 4, i += 4)
+	{
+	  d = _mm_sub_ps(_mm_loadu_ps(c + i), _mm_loadu_ps(s + i));
+	  acc = _mm_add_ps(acc, _mm_mul_ps(d, d));
+	}
+      _mm_storeu_ps(t, acc);
+      difference = (t[0] + t[1]) + (t[2] + t[3]);
+      if (difference > bound)
+	return difference;
+    }
+
+  for (; i < dim; i++)
+    {
+      diff = c[i] - s[i];
+      difference += diff * diff;
+    }
+  return difference;
+}
+
+__attribute__((target("sse2")))
+static float wdist2_sse2(float *c, float *s, float *w, int dim)
+{
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), d0, d1;
+  float t[4], difference, diff;
+  int i = 0;
+
+  for (; i + 8 <= dim; i += 8)
+    {
+      d0 = _mm_sub_ps(_mm_loadu_ps(c + i), _mm_loadu_ps(s + i));
+      d1 = _mm_sub_ps(_mm_loadu_ps(c + i + 4), _mm_loadu_ps(s + i + 4));
+      d0 = _mm_mul_ps(d0, d0);
+      d1 = _mm_mul_ps(d1, d1);
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, _mm_loadu_ps(w + i)));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, _mm_loadu_ps(w + i + 4)));
+    }
+  for (; i + 4 <= dim; i += 4)
+    {
+      d0 = _mm_sub_ps(_mm_loadu_ps(c + i), _mm_loadu_ps(s + i));
+      d0 = _mm_mul_ps(d0, d0);
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, _mm_loadu_ps(w + i)));
+    }
+  _mm_storeu_ps(t, _mm_add_ps(acc0, acc1));
+  difference = (t[0] + t[1]) + (t[2] + t[3]);
+
+  for (; i < dim; i++)
+    {
+      diff = c[i] - s[i];
+      difference += w[i] * diff * diff;
+    }
+  return difference;
+}
+
+__attribute__((target("sse2")))
+static void wadapt_sse2(float *c, float *s, float *w, int dim, float a)
+{
+  __m128 va = _mm_set1_ps(a), vc, vw;
+  int i = 0;
+
+  for (; i + 4 <= dim; i += 4)
+    {
+      vc = _mm_loadu_ps(c + i);
+      vw = _mm_mul_ps(va, _mm_loadu_ps(w + i));
+      vc = _mm_add_ps(vc, _mm_mul_ps(vw, _mm_sub_ps(_mm_loadu_ps(s + i), vc)));
+      _mm_storeu_ps(c + i, vc);
+    }
+  for (; i < dim; i++)
+    c[i] += a * w[i] * (s[i] - c[i]);
+}
+
+__attribute__((target("sse2")))
+static void tile_sse2(float *x, long xstride, float *panel, int dim,
+		      float *out)
+{
+  __m128 acc[TILE_ROWS][4], p0, p1, p2, p3, xd;
+  int r, d;
+
+  for (r = 0; r < TILE_ROWS; r++)
+    acc[r][0] = acc[r][1] = acc[r][2] = acc[r][3] = _mm_setzero_ps();
+
+  for (d = 0; d < dim; d++, panel += TILE_COLS)
+    {
+      p0 = _mm_load_ps(panel);
+      p1 = _mm_load_ps(panel + 4);
+      p2 = _mm_load_ps(panel + 8);
+      p3 = _mm_load_ps(panel + 12);
+      for (r = 0; r < TILE_ROWS; r++)
+	{
+	  xd = _mm_set1_ps(x[r * xstride + d]);
+	  acc[r][0] = _mm_add_ps(acc[r][0], _mm_mul_ps(xd, p0));
+	  acc[r][1] = _mm_add_ps(acc[r][1], _mm_mul_ps(xd, p1));
+	  acc[r][2] = _mm_add_ps(acc[r][2], _mm_mul_ps(xd, p2));
+	  acc[r][3] = _mm_add_ps(acc[r][3], _mm_mul_ps(xd, p3));
+	}
+    }
+
+  for (r = 0; r < TILE_ROWS; r++, out += TILE_COLS)
+    {
+      _mm_storeu_ps(out, acc[r][0]);
+      _mm_storeu_ps(out + 4, acc[r][1]);
+      _mm_storeu_ps(out + 8, acc[r][2]);
+      _mm_storeu_ps(out + 12, acc[r][3]);
+    }
+}
+
+__attribute__((target("sse2")))
+static float qdist2_sse2(signed char *q, float *y, float *w, int dim)
+{
+  __m128i b, h;
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), d0, d1;
+  float t[4], difference, diff;
+  int i = 0;
+
+  for (; i + 8 <= dim; i += 8)
+    {
+      /* sign extend eight bytes to 32 bits */
+      b = _mm_loadl_epi64((__m128i *) (q + i));
+      h = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+      d0 = _mm_sub_ps(_mm_loadu_ps(y + i),
+		      _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(h, h),
+						     16)));
+      d1 = _mm_sub_ps(_mm_loadu_ps(y + i + 4),
+		      _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(h, h),
+						     16)));
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_mul_ps(d0, _mm_loadu_ps(w + i)),
+					 d0));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_mul_ps(d1, _mm_loadu_ps(w + i + 4)),
+					 d1));
+    }
+  _mm_storeu_ps(t, _mm_add_ps(acc0, acc1));
+  difference = (t[0] + t[1]) + (t[2] + t[3]);
+
+  for (; i < dim; i++)
+    {
+      diff = y[i] - q[i];
+      difference += w[i] * diff * diff;
+    }
+  return difference;
+}
+
+static int has_sse2(void)
+{
+  return __builtin_cpu_supports("sse2");
+}
+
+/* AVX2 with fused multiply-add */
+
+__attribute__((target("avx2,fma")))
+static float dist2_avx2(float *c, float *s, int dim)
+{
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), d0, d1;
+  __m128 h;
+  float difference, diff;
+  int i = 0;
+
+  for (; i + 16 <= dim; i += 16)
+    {
+      d0 = _mm256_sub_ps(_mm256_loadu_ps(c + i), _mm256_loadu_ps(s + i));
+      d1 = _mm256_sub_ps(_mm256_loadu_ps(c + i + 8), _mm256_loadu_ps(s + i + 8));
+      acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+      acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+  for (; i + 8 <= dim; i += 8)
+    {
+      d0 = _mm256_sub_ps(_mm256_loadu_ps(c + i), _mm256_loadu_ps(s + i));
+      acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  h = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+  difference = _mm_cvtss_f32(h);
+
+  for (; i < dim; i++)
+    {
+      diff = c[i] - s[i];
+      difference += diff * diff;
+    }
+  return difference;
+}
+
+__attribute__((target("avx2,fma")))
+static void adapt_avx2(float *c, float *s, int dim, float a)
+{
+  __m256 va = _mm256_set1_ps(a), vc;
+  int i = 0;
+
+  for (; i + 8 <= dim; i += 8)
+    {
+      vc = _mm256_loadu_ps(c + i);
+      vc = _mm256_fmadd_ps(va, _mm256_sub_ps(_mm256_loadu_ps(s + i), vc), vc);
+      _mm256_storeu_ps(c + i, vc);
+    }
+  for (; i < dim; i++)
+    c[i] += a * (s[i] - c[i]);
+}
+
+__attribute__((target("avx2,fma")))
+static float dist2b_avx2(float *c, float *s, int dim, float bound)
+{
+  __m256 acc = _mm256_setzero_ps(), d;
+  __m128 h;
+  float difference = 0.0, diff;
+  int i = 0, j;
+
+  while (i + DIST_BLOCK <= dim)
+    {
+      for (j = 0; j < DIST_BLOCK; j += 8, i += 8)
+	{
+	  d = _mm256_sub_ps(_mm256_loadu_ps(c + i), _mm256_loadu_ps(s + i));
+	  acc = _mm256_fmadd_ps(d, d, acc);
+	}
+      h = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+      h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+      h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+      difference = _mm_cvtss_f32(h);
+      if (difference > bound)
+	return difference;
+    }
+
+  for (; i < dim; i++)
+    {
+      diff = c[i] - s[i];
+      difference += diff * diff;
+    }
+  return difference;
+}
+
+__attribute__((target("avx2,fma")))
+static float wdist2_avx2(float *c, float *s, float *w, int dim)
+{
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), d0, d1;
+  __m128 h;
+  float difference, diff;
+  int i = 0;
+
+  for (; i + 16 <= dim; i += 16)
+    {
+      d0 = _mm256_sub_ps(_mm256_loadu_ps(c + i), _mm256_loadu_ps(s + i));
+      d1 = _mm256_sub_ps(_mm256_loadu_ps(c + i + 8), _mm256_loadu_ps(s + i + 8));
+      acc0 = _mm256_fmadd_ps(_mm256_mul_ps(d0, _mm256_loadu_ps(w + i)), d0, acc0);
+      acc1 = _mm256_fmadd_ps(_mm256_mul_ps(d1, _mm256_loadu_ps(w + i + 8)), d1,
+			     acc1);
+    }
+  for (; i + 8 <= dim; i += 8)
+    {
+      d0 = _mm256_sub_ps(_mm256_loadu_ps(c + i), _mm256_loadu_ps(s + i));
+      acc0 = _mm256_fmadd_ps(_mm256_mul_ps(d0, _mm256_loadu_ps(w + i)), d0, acc0);
+    }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  h = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+  difference = _mm_cvtss_f32(h);
+
+  for (; i < dim; i++)
+    {
+      diff = c[i] - s[i];
+      difference += w[i] * diff * diff;
+    }
+  return difference;
+}
+
+__attribute__((target("avx2,fma")))
+static void wadapt_avx2(float *c, float *s, float *w, int dim, float a)
+{
+  __m256 va = _mm256_set1_ps(a), vc, vw;
+  int i = 0;
+
+  for (; i + 8 <= dim; i += 8)
+    {
+      vc = _mm256_loadu_ps(c + i);
+      vw = _mm256_mul_ps(va, _mm256_loadu_ps(w + i));
+      vc = _mm256_fmadd_ps(vw, _mm256_sub_ps(_mm256_loadu_ps(s + i), vc), vc);
+      _mm256_storeu_ps(c + i, vc);
+    }
+  for (; i < dim; i++)
+    c[i] += a * w[i] * (s[i] - c[i]);
+}
+
+__attribute__((target("avx2,fma")))
+static void tile_avx2(float *x, long xstride, float *panel, int dim,
+		      float *out)
+{
+  __m256 a00, a01, a10, a11, a20, a21, a30, a31, p0, p1, xd;
+  float *x0 = x, *x1 = x + xstride, *x2 = x + 2 * xstride, *x3 = x + 3 * xstride;
+  int d;
+
+  a00 = a01 = a10 = a11 = a20 = a21 = a30 = a31 = _mm256_setzero_ps();
+  for (d = 0; d < dim; d++, panel += TILE_COLS)
+    {
+      p0 = _mm256_load_ps(panel);
+      p1 = _mm256_load_ps(panel + 8);
+      xd = _mm256_broadcast_ss(x0 + d);
+      a00 = _mm256_fmadd_ps(xd, p0, a00);
+      a01 = _mm256_fmadd_ps(xd, p1, a01);
+      xd = _mm256_broadcast_ss(x1 + d);
+      a10 = _mm256_fmadd_ps(xd, p0, a10);
+      a11 = _mm256_fmadd_ps(xd, p1, a11);
+      xd = _mm256_broadcast_ss(x2 + d);
+      a20 = _mm256_fmadd_ps(xd, p0, a20);
+      a21 = _mm256_fmadd_ps(xd, p1, a21);
+      xd = _mm256_broadcast_ss(x3 + d);
+      a30 = _mm256_fmadd_ps(xd, p0, a30);
+      a31 = _mm256_fmadd_ps(xd, p1, a31);
+    }
+  _mm256_storeu_ps(out, a00);
+  _mm256_storeu_ps(out + 8, a01);
+  _mm256_storeu_ps(out + 16, a10);
+  _mm256_storeu_ps(out + 24, a11);
+  _mm256_storeu_ps(out + 32, a20);
+  _mm256_storeu_ps(out + 40, a21);
+  _mm256_storeu_ps(out + 48, a30);
+  _mm256_storeu_ps(out + 56, a31);
+}
+
+__attribute__((target("avx2,fma")))
+static float qdist2_avx2(signed char *q, float *y, float *w, int dim)
+{
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), d0, d1;
+  __m128 h;
+  float difference, diff;
+  int i = 0;
+
+  for (; i + 16 <= dim; i += 16)
+    {
+      d0 = _mm256_sub_ps(_mm256_loadu_ps(y + i), _mm256_cvtepi32_ps(
+	     _mm256_cvtepi8_epi32(_mm_loadl_epi64((__m128i *) (q + i)))));
+      d1 = _mm256_sub_ps(_mm256_loadu_ps(y + i + 8), _mm256_cvtepi32_ps(
+	     _mm256_cvtepi8_epi32(_mm_loadl_epi64((__m128i *) (q + i + 8)))));
+      acc0 = _mm256_fmadd_ps(_mm256_mul_ps(d0, _mm256_loadu_ps(w + i)), d0, acc0);
+      acc1 = _mm256_fmadd_ps(_mm256_mul_ps(d1, _mm256_loadu_ps(w + i + 8)), d1,
+			     acc1);
+    }
+  for (; i + 8 <= dim; i += 8)
+    {
+      d0 = _mm256_sub_ps(_mm256_loadu_ps(y + i), _mm256_cvtepi32_ps(
+	     _mm256_cvtepi8_epi32(_mm_loadl_epi64((__m128i *) (q + i)))));
+      acc0 = _mm256_fmadd_ps(_mm256_mul_ps(d0, _mm256_loadu_ps(w + i)), d0, acc0);
+    }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  h = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+  difference = _mm_cvtss_f32(h);
+
+  for (; i < dim; i++)
+    {
+      diff = y[i] - q[i];
+      difference += w[i] * diff * diff;
+    }
+  return difference;
+}
+
+static int has_avx2(void)
+{
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+/* AVX-512. The tail is handled with masked loads and stores. */
+
+__attribute__((target("avx512f")))
+static float dist2_avx512(float *c, float *s, int dim)
+{
+  __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), d0, d1;
+  __mmask16 m;
+  int i = 0;
+
+  for (; i + 32 <= dim; i += 32)
+    {
+      d0 = _mm512_sub_ps(_mm512_loadu_ps(c + i), _mm512_loadu_ps(s + i));
+      d1 = _mm512_sub_ps(_mm512_loadu_ps(c + i + 16), _mm512_loadu_ps(s + i + 16));
+      acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+      acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+  for (; i + 16 <= dim; i += 16)
+    {
+      d0 = _mm512_sub_ps(_mm512_loadu_ps(c + i), _mm512_loadu_ps(s + i));
+      acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    }
+  if (i < dim)
+    {
+      m = (__mmask16) ((1u << (dim - i)) - 1);
+      d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, c + i),
+			 _mm512_maskz_loadu_ps(m, s + i));
+      acc1 = _mm512_fmadd_ps(d0, d0, acc1);
+    }
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+static void adapt_avx512(float *c, float *s, int dim, float a)
+{
+  __m512 va = _mm512_set1_ps(a), vc;
+  __mmask16 m;
+  int i = 0;
+
+  for (; i + 16 <= dim; i += 16)
+    {
+      vc = _mm512_loadu_ps(c + i);
+      vc = _mm512_fmadd_ps(va, _mm512_sub_ps(_mm512_loadu_ps(s + i), vc), vc);
+      _mm512_storeu_ps(c + i, vc);
+    }
+  if (i < dim)
+    {
+      m = (__mmask16) ((1u << (dim - i)) - 1);
+      vc = _mm512_maskz_loadu_ps(m, c + i);
+      vc = _mm512_fmadd_ps(va, _mm512_sub_ps(_mm512_maskz_loadu_ps(m, s + i),
+					     vc), vc);
+      _mm512_mask_storeu_ps(c + i, m, vc);
+    }
+}
+
+__attribute__((target("avx512f")))
+static float dist2b_avx512(float *c, float *s, int dim, float bound)
+{
+  __m512 acc = _mm512_setzero_ps(), d;
+  __mmask16 m;
+  float difference;
+  int i = 0, j;
+
+  while (i + DIST_BLOCK <= dim)
+    {
+      for (j = 0; j < DIST_BLOCK; j += 16, i += 16)
+	{
+	  d = _mm512_sub_ps(_mm512_loadu_ps(c + i), _mm512_loadu_ps(s + i));
+	  acc = _mm512_fmadd_ps(d, d, acc);
+	}
+      difference = _mm512_reduce_add_ps(acc);
+      if (difference > bound)
+	return difference;
+    }
+
+  for (; i < dim; i += 16)
+    {
+      m = (dim - i < 16) ? (__mmask16) ((1u << (dim - i)) - 1) : 0xffff;
+      d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, c + i),
+			_mm512_maskz_loadu_ps(m, s + i));
+      acc = _mm512_fmadd_ps(d, d, acc);
+    }
+  return _mm512_reduce_add_ps(acc);
+}
+
+__attribute__((target("avx512f")))
+static float wdist2_avx512(float *c, float *s, float *w, int dim)
+{
+  __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), d0, d1;
+  __mmask16 m;
+  int i = 0;
+
+  for (; i + 32 <= dim; i += 32)
+    {
+      d0 = _mm512_sub_ps(_mm512_loadu_ps(c + i), _mm512_loadu_ps(s + i));
+      d1 = _mm512_sub_ps(_mm512_loadu_ps(c + i + 16), _mm512_loadu_ps(s + i + 16));
+      acc0 = _mm512_fmadd_ps(_mm512_mul_ps(d0, _mm512_loadu_ps(w + i)), d0, acc0);
+      acc1 = _mm512_fmadd_ps(_mm512_mul_ps(d1, _mm512_loadu_ps(w + i + 16)), d1,
+			     acc1);
+    }
+  for (; i + 16 <= dim; i += 16)
+    {
+      d0 = _mm512_sub_ps(_mm512_loadu_ps(c + i), _mm512_loadu_ps(s + i));
+      acc0 = _mm512_fmadd_ps(_mm512_mul_ps(d0, _mm512_loadu_ps(w + i)), d0, acc0);
+    }
+  if (i < dim)
+    {
+      m = (__mmask16) ((1u << (dim - i)) - 1);
+      d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, c + i),
+			 _mm512_maskz_loadu_ps(m, s + i));
+      acc1 = _mm512_fmadd_ps(_mm512_mul_ps(d0, _mm512_maskz_loadu_ps(m, w + i)),
+			     d0, acc1);
+    }
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+static void wadapt_avx512(float *c, float *s, float *w, int dim, float a)
+{
+  __m512 va = _mm512_set1_ps(a), vc, vw;
+  __mmask16 m;
+  int i = 0;
+
+  for (; i + 16 <= dim; i += 16)
+    {
+      vc = _mm512_loadu_ps(c + i);
+      vw = _mm512_mul_ps(va, _mm512_loadu_ps(w + i));
+      vc = _mm512_fmadd_ps(vw, _mm512_sub_ps(_mm512_loadu_ps(s + i), vc), vc);
+      _mm512_storeu_ps(c + i, vc);
+    }
+  if (i < dim)
+    {
+      m = (__mmask16) ((1u << (dim - i)) - 1);
+      vc = _mm512_maskz_loadu_ps(m, c + i);
+      vw = _mm512_mul_ps(va, _mm512_maskz_loadu_ps(m, w + i));
+      vc = _mm512_fmadd_ps(vw, _mm512_sub_ps(_mm512_maskz_loadu_ps(m, s + i),
+					     vc), vc);
+      _mm512_mask_storeu_ps(c + i, m, vc);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void tile_avx512(float *x, long xstride, float *panel, int dim,
+			float *out)
+{
+  __m512 a0, a1, a2, a3, p;
+  float *x0 = x, *x1 = x + xstride, *x2 = x + 2 * xstride, *x3 = x + 3 * xstride;
+  int d;
+
+  a0 = a1 = a2 = a3 = _mm512_setzero_ps();
+  for (d = 0; d < dim; d++, panel += TILE_COLS)
+    {
+      p = _mm512_load_ps(panel);
+      a0 = _mm512_fmadd_ps(_mm512_set1_ps(x0[d]), p, a0);
+      a1 = _mm512_fmadd_ps(_mm512_set1_ps(x1[d]), p, a1);
+      a2 = _mm512_fmadd_ps(_mm512_set1_ps(x2[d]), p, a2);
+      a3 = _mm512_fmadd_ps(_mm512_set1_ps(x3[d]), p, a3);
+    }
+  _mm512_storeu_ps(out, a0);
+  _mm512_storeu_ps(out + 16, a1);
+  _mm512_storeu_ps(out + 32, a2);
+  _mm512_storeu_ps(out + 48, a3);
+}
+
+__attribute__((target("avx512f")))
+static float qdist2_avx512(signed char *q, float *y, float *w, int dim)
+{
+  __m512 acc = _mm512_setzero_ps(), d;
+  float difference, diff;
+  int i = 0;
+
+  for (; i + 16 <= dim; i += 16)
+    {
+      d = _mm512_sub_ps(_mm512_loadu_ps(y + i), _mm512_cvtepi32_ps(
+	    _mm512_cvtepi8_epi32(_mm_loadu_si128((__m128i *) (q + i)))));
+      acc = _mm512_fmadd_ps(_mm512_mul_ps(d, _mm512_loadu_ps(w + i)), d, acc);
+    }
+  difference = _mm512_reduce_add_ps(acc);
+
+  for (; i < dim; i++)
+    {
+      diff = y[i] - q[i];
+      difference += w[i] * diff * diff;
+    }
+  return difference;
+}
+
+static int has_avx512(void)
+{
+  return __builtin_cpu_supports("avx512f");
+}
+
+#endif /* HAVE_X86_SIMD */
+
+/* Available kernels, best first. "c" must be the last one. */
+
+static struct vec_kernels kernel_list[] = {
+#ifdef HAVE_X86_SIMD
+  { "avx512", dist2_avx512, dist2b_avx512, adapt_avx512, wdist2_avx512,
+    wadapt_avx512, tile_avx512, qdist2_avx512, has_avx512 },
+  { "avx2", dist2_avx2, dist2b_avx2, adapt_avx2, wdist2_avx2, wadapt_avx2,
+    tile_avx2, qdist2_avx2, has_avx2 },
+  { "sse2", dist2_sse2, dist2b_sse2, adapt_sse2, wdist2_sse2, wadapt_sse2,
+    tile_sse2, qdist2_sse2, has_sse2 },
+#endif /* HAVE_X86_SIMD */
+  { "c", dist2_c, dist2b_c, adapt_c, wdist2_c, wadapt_c, tile_c, qdist2_c,
+    always },
+  { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }};
+
+struct vec_kernels *vec_kernel = NULL;
+
+/* select_vec_kernels - select the kernels used by the SIMD function
+   set. "auto" or NULL selects the best one the processor supports. If
+   the named kernels can't be run on this processor, the best
+   supported ones are used instead. */
+
+struct vec_kernels *select_vec_kernels(char *name)
+{
+  struct vec_kernels *k, *best = NULL;
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+#endif /* HAVE_X86_SIMD */
+
+  for (k = kernel_list; k->name != NULL; k++)
+    if (k->supported())
+      {
+	best = k;
+	break;
+      }
+
+  k = best;
+  if (name && strcasecmp(name, "auto"))
+    {
+      for (k = kernel_list; k->name != NULL; k++)
+	if (strcasecmp(k->name, name) == 0)
+	  break;
+
+      if (k->name == NULL)
+	{
+	  fprintf(stderr, "select_vec_kernels: unknown kernels '%s', using '%s'\n",
+		  name, best->name);
+	  k = best;
+	}
+      else if (!k->supported())
+	{
+	  fprintf(stderr, "select_vec_kernels: processor does not support '%s', using '%s'\n",
+		  name, best->name);
+	  k = best;
+	}
+    }
+
+  ifverbose(2)
+    fprintf(stderr, "using '%s' vector kernels\n", k->name);
+
+  vec_kernel = k;
+  return k;
+}
+
+
+/*******************************************************************
+ * Function set "simd"                                             *
+ *******************************************************************/
+
+/* masked_off - returns non-zero if all components have zero weight */
+
+static int masked_off(float *w, int dim)
+{
+  while (dim-- > 0)
+    if (*w++ != 0.0)
+      return 0;
+  return 1;
+}
+
+/* find_winner_simd - find the knn nearest codebook vectors using the
+   selected kernels. Works like find_winner_euc (knn == 1) and
+   find_winner_knn (knn > 1). Masked samples use the weight vectors
+   made when the mask was loaded, so they stay on the vectorized path. */
+
+int find_winner_simd(struct entries *codes, struct data_entry *sample,
+		     struct winner_info *win, int knn)
+{
+  struct vec_kernels *k = current_kernels();
+  struct data_entry *codetmp;
+  float difference, bound, *s = sample->points, *w = NULL, *c;
+  long index, noc;
+  int dim = codes->dimension, n = 0;
+  eptr p;
+
+  if (sample->mask != NULL)
+    {
+      /* masks made elsewhere than in load_entry may lack the weights */
+      if (sample->maskw == NULL)
+	return find_winner_knn(codes, sample, win, knn);
+      w = sample->maskw;
+    }
+
+  if (knn < 1)
+    knn = 1;
+
+  if ((w != NULL) && masked_off(w, dim))
+    {
+      sort_winners(win, 0, knn);
+      win->diff = -1.0;
+      return 0;
+    }
+
+  /* With knn == 1 the first of equally distant vectors wins, as in
+     find_winner_euc. Otherwise the k best are kept in a heap like in
+     find_winner_knn and the distances are cut off at the k:th best. */
+
+  /* go through either the rows of a flat codebook or the list */
+  bound = FLT_MAX;
+  noc = (codes->block != NULL) ? codes->num_entries : 0;
+  codetmp = (codes->block != NULL) ? NULL : rewind_entries(codes, &p);
+  for (index = 0; (index < noc) || (codetmp != NULL); index++)
+    {
+      c = (codetmp != NULL) ? codetmp->points : block_row(codes, index);
+      if (w != NULL)
+	difference = k->wdist2(c, s, w, dim);
+      else if (knn == 1)
+	difference = k->dist2(c, s, dim);
+      else
+	difference = k->dist2b(c, s, dim, bound);
+
+      if ((knn == 1) ? (difference < bound) : (difference <= bound))
+	{
+	  heap_winner(win, &n, knn, difference, index,
+		      codetmp ? codetmp : &codes->units[index]);
+	  if (n == knn)
+	    bound = win[0].diff;
+	}
+
+      if (codetmp != NULL)
+	codetmp = next_entry(&p);
+    }
+
+  sort_winners(win, n, knn);
+
+  if (win->index < 0)
+    {
+      win->diff = -1.0;
+      ifverbose(3)
+	fprintf(stderr, "find_winner_simd: can't find winner\n");
+    }
+
+  return knn; /* number of neighbours */
+}
+
+/* vector_dist_simd - euclidean distance between two vectors. Returns
+   < 0 if all components were masked off. */
+
+float vector_dist_simd(struct data_entry *v1, struct data_entry *v2, int dim)
+{
+  struct data_entry *m;
+
+  if ((v1->mask == NULL) && (v2->mask == NULL))
+    return sqrt(current_kernels()->dist2(v1->points, v2->points, dim));
+
+  /* only one of the vectors may be masked */
+  m = v1->mask ? v1 : v2;
+  if ((v1->mask && v2->mask) || (m->maskw == NULL))
+    return vector_dist_euc(v1, v2, dim);
+
+  if (masked_off(m->maskw, dim))
+    return -1;
+
+  return sqrt(current_kernels()->wdist2(v1->points, v2->points, m->maskw,
+					 dim));
+}
+
+/* adapt_vector_simd - move a codebook vector towards another vector */
+
+void adapt_vector_simd(struct data_entry *codetmp, struct data_entry *sample,
+		       int dim, float alpha)
+{
+  if (sample->mask == NULL)
+    current_kernels()->adapt(codetmp->points, sample->points, dim, alpha);
+  else if (sample->maskw != NULL)
+    current_kernels()->wadapt(codetmp->points, sample->points, sample->maskw,
+			      dim, alpha);
+  else
+    adapt_vector(codetmp, sample, dim, alpha);
+}
+
+
+/*******************************************************************
+ * Function set "check": the SIMD results are compared against the *
+ * portable routines and the differences are reported             *
+ *******************************************************************/
+
+static float check_tol = CHECK_TOLERANCE;
+static long check_count = 0, check_errors = 0, check_mismatches = 0;
+
+#ifndef MAX_CHECK_MSGS
+#define MAX_CHECK_MSGS 10
+#endif
+
+static void check_report(void)
+{
+  fprintf(stderr, "vector check: %ld of %ld results differ more than %g (%s kernels)\n",
+	  check_errors, check_count, check_tol, current_kernels()->name);
+  if (check_mismatches)
+    fprintf(stderr, "vector check: %ld winners differ from reference\n",
+	    check_mismatches);
+}
+
+/* vec_check_mode - turn on the reporting of the check function set.
+   The tolerance can be changed with the environment variable
+   LVQSOM_CHECK_TOL. */
+
+void vec_check_mode(int on)
+{
+  static int registered = 0;
+  char *s;
+
+  if (!on || registered)
+    return;
+
+  s = getenv("LVQSOM_CHECK_TOL");
+  if (s)
+    check_tol = atof(s);
+
+  atexit(check_report);
+  registered = 1;
+}
+
+/* differs - compare a result against the reference value */
+
+static int differs(float val, float ref)
+{
+  float scale = fabs(ref) > 1.0 ? fabs(ref) : 1.0;
+
+  check_count++;
+  if (fabs(val - ref) <= check_tol * scale)
+    return 0;
+
+  if (check_errors++ < MAX_CHECK_MSGS)
+    fprintf(stderr, "vector check: %g differs from reference %g\n", val, ref);
+  return 1;
+}
+
+int find_winner_check(struct entries *codes, struct data_entry *sample,
+		      struct winner_info *win, int knn)
+{
+  static struct winner_info *ref = NULL;
+  static int refsize = 0;
+  int i, ret, bad;
+
+  if (knn < 1)
+    knn = 1;
+  if (knn > refsize)
+    {
+      ref = orealloc(ref, knn * sizeof(struct winner_info));
+      refsize = knn;
+    }
+
+  if (find_winner_knn(codes, sample, ref, knn) == 0)
+    return 0;
+  ret = find_winner_simd(codes, sample, win, knn);
+
+  /* the distances are always compared. The winners may be different
+     if the distances are nearly equal; different winners are counted
+     apart from the errors and reported when the distances differ. */
+  for (i = 0; i < knn; i++)
+    {
+      bad = differs(win[i].diff, ref[i].diff);
+      if (win[i].index == ref[i].index)
+	continue;
+
+      if (bad && (check_mismatches < MAX_CHECK_MSGS))
+	fprintf(stderr, "vector check: winner %ld differs from reference %ld\n",
+		win[i].index, ref[i].index);
+      check_mismatches++;
+    }
+
+  return ret;
+}
+
+float vector_dist_check(struct data_entry *v1, struct data_entry *v2, int dim)
+{
+  float d = vector_dist_simd(v1, v2, dim);
+
+  differs(d, vector_dist_euc(v1, v2, dim));
+  return d;
+}
+
+void adapt_vector_check(struct data_entry *codetmp, struct data_entry *sample,
+			int dim, float alpha)
+{
+  static float *ref = NULL;
+  static int refsize = 0;
+  struct data_entry tmp;
+  int i;
+
+  if (dim > refsize)
+    {
+      ref = orealloc(ref, dim * sizeof(float));
+      refsize = dim;
+    }
+
+  memcpy(ref, codetmp->points, dim * sizeof(float));
+  tmp = *codetmp;
+  tmp.points = ref;
+  adapt_vector(&tmp, sample, dim, alpha);
+
+  adapt_vector_simd(codetmp, sample, dim, alpha);
+
+  for (i = 0; i < dim; i++)
+    if (differs(codetmp->points[i], ref[i]))
+      break;
+}
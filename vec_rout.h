@@ -0,0 +1,95 @@
+#ifndef VEC_ROUT_H
+#define VEC_ROUT_H
+/************************************************************************
+ *                                                                      *
+ *  Program packages 'lvq_pak' and 'som_pak' :                          *
+ *                                                                      *
+ *  vec_rout.h                                                          *
+ *   - header file for vec_rout.c: vectorized distance and adaptation   *
+ *     routines                                                         *
+ *                                                                      *
+ *  Version 3.2                                                         *
+ *  Date: 21 Aug 1995                                                   *
+ *                                                                      *
+ *  NOTE: This program package is copyrighted in the sense that it      *
+ *  may be used for scientific purposes. The package as a whole, or     *
+ *  parts thereof, cannot be included or used in any commercial         *
+ *  application without written permission granted by its producents.   *
+ *  No programs contained in this package may be copied for commercial  *
+ *  distribution.                                                       *
+ *                                                                      *
+ *  All comments  concerning this program package may be sent to the    *
+ *  e-mail address 'lvq@cochlea.hut.fi'.                                *
+ *                                                                      *
+ ************************************************************************/
+
+#include "lvq_pak.h"
+
+/* The SIMD versions are compiled with gcc on x86 processors. Elsewhere,
+   or if NO_SIMD is defined, only the portable C versions are used. */
+
+#if !defined(NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#endif
+
+/* relative tolerance used when comparing the SIMD results against the
+   portable ones in the "check" function set */
+
+#ifndef CHECK_TOLERANCE
+#define CHECK_TOLERANCE 1e-4
+#endif /* CHECK_TOLERANCE */
+
+/* kernels working on plain float vectors */
+typedef float ROW_DIST(float *c, float *s, int dim);
+typedef float ROW_DISTB(float *c, float *s, int dim, float bound);
+typedef void ROW_ADAPT(float *c, float *s, int dim, float a);
+
+/* same with the component weights w of a masked sample */
+typedef float ROW_WDIST(float *c, float *s, float *w, int dim);
+typedef void ROW_WADAPT(float *c, float *s, float *w, int dim, float a);
+
+/* dot products of TILE_ROWS vectors x (xstride floats apart) with a
+   panel of TILE_COLS vectors stored component by component (panel[d *
+   TILE_COLS + j] is component d of vector j). The panel must be
+   aligned to BLOCK_ALIGN. out[r * TILE_COLS + j] is x_r . c_j */
+
+#define TILE_ROWS 4
+#define TILE_COLS 16
+
+typedef void ROW_TILE(float *x, long xstride, float *panel, int dim,
+		      float *out);
+
+/* sum of w * (y - q)^2 for a vector q of small integers */
+typedef float ROW_QDIST(signed char *q, float *y, float *w, int dim);
+
+struct vec_kernels {
+  char *name;
+  ROW_DIST *dist2;        /* squared euclidean distance */
+  ROW_DISTB *dist2b;      /* same, but may stop once above bound (checked
+			     every DIST_BLOCK components) */
+  ROW_ADAPT *adapt;       /* c += a * (s - c) */
+  ROW_WDIST *wdist2;      /* sum of w * (c - s)^2 */
+  ROW_WADAPT *wadapt;     /* c += a * w * (s - c) */
+  ROW_TILE *tile;         /* TILE_ROWS x TILE_COLS dot products */
+  ROW_QDIST *qdist2;      /* distance to a quantized vector */
+  int (*supported)(void); /* non-zero if the cpu can run these */
+};
+
+extern struct vec_kernels *vec_kernel;
+
+/* kernels in use, selected at the first call if needed */
+#define current_kernels() (vec_kernel ? vec_kernel : select_vec_kernels(NULL))
+
+struct vec_kernels *select_vec_kernels(char *name);
+void vec_check_mode(int on);
+
+WINNER_FUNCTION find_winner_simd;
+DIST_FUNCTION vector_dist_simd;
+VECTOR_ADAPT adapt_vector_simd;
+
+WINNER_FUNCTION find_winner_check;
+DIST_FUNCTION vector_dist_check;
+VECTOR_ADAPT adapt_vector_check;
+
+#endif /* VEC_ROUT_H */
@@ -29,6 +29,7 @@
 #include "lvq_pak.h"
 #include "som_rout.h"
 #include "datafile.h"
+#include "bmu_rout.h"
 
 static char *usage[] = {
   "visual - find best matching unit for each data sample\n", 
@@ -57,6 +58,7 @@ struct entries *compute_visual_data(struct teach_params *teach,
   struct file_info *fi;
   WINNER_FUNCTION *winner = teach->winner;
   struct winner_info win_info;
+  struct winner_batch *batch;
   int emptylab = LABEL_EMPTY;
   long nod, bpos;
   eptr p;
@@ -107,10 +109,13 @@ struct entries *compute_visual_data(struct teach_params *teach,
   else
     nod = 0;
 
+  /* find the winners all at once if the data is in memory */
+  batch = batch_winners(codes, data, winner);
+
   while (datatmp != NULL) {
 
     /* bpos = winner(codes, datatmp); */
-    if (winner(codes, datatmp, &win_info, 1) == 0)
+    if (batch_winner(batch, codes, datatmp, &win_info, winner) == 0)
       {
 	/* empty sample */
 	/* Save the classification and coordinates */
@@ -141,6 +146,7 @@ struct entries *compute_visual_data(struct teach_params *teach,
       ifverbose(1)
 	mprint((long) nod--);
   }
+  free_winner_batch(batch);
 
   if (length_known)
     ifverbose(1)
@@ -28,6 +28,10 @@
 #include "som_rout.h"
 #include "datafile.h"
 
+/* coarse training: at most MAX_LEVELS smaller maps, each at least
+   MIN_COARSE units wide and high */
+#define MAX_LEVELS 8
+#define MIN_COARSE 2
 
 static char *usage[] = {
   "vsom - teach self-organizing map\n",
@@ -47,9 +51,141 @@ static char *usage[] = {
   
   "  -snapfile filename    snapshot filename\n",
   "  -selfuncs name        select a set of functions\n",
+  "  -local type           start the winner search from the previous winner,\n",
+  "                        exact or approx (search only near it)\n",
+  "  -cutoff float         leave out the units where the gaussian neighborhood\n",
+  "                        is smaller than this (default 0)\n",
   "  -snapinterval integer interval between snapshots\n",
+  "  -batch                batch training, -rlen is counted in samples and\n",
+  "                        rounded up to whole passes through the data\n",
+  "  -parallel type        online training in several threads, locked (lock\n",
+  "                        the rows being adapted) or hogwild (no locks)\n",
+  "  -minibatch integer    train with mini-batches of this many samples\n",
+  "  -threads integer      number of threads in batch, mini-batch and parallel\n",
+  "                        training, 0 is one per processor\n",
+  "  -coarse integer       train first on maps halved in size this many times\n",
+  "                        and then on larger ones, from a smaller radius\n",
+  "  -layout type          order of the units in memory during training, rows\n",
+  "                        (default), morton or hilbert\n",
+  "  -stopinterval integer estimate the quantization error at this interval and\n",
+  "                        finish the training when it no longer improves\n",
+  "  -stopthreshold float  smallest relative improvement (default 0.001)\n",
+  "  -stopdata filename    held-out data for the estimate (default the samples\n",
+  "                        trained since the last estimate)\n",
+  "  -checkfile filename   checkpoint file, holds the whole state of training\n",
+  "  -checkinterval integer interval between checkpoints\n",
+  "  -resume filename      continue training from a checkpoint, with the same\n",
+  "                        parameters. -cin is not needed\n",
   NULL};
 
+/* train_map - train with the chosen training function */
+
+static struct entries *train_map(struct teach_params *params, int batch,
+				 long minibatch, int parallel)
+{
+  struct entries *codes;
+
+  /* the units are kept along a curve only during the training */
+  if ((params->layout != LAYOUT_ROWS) &&
+      set_layout(params->codes, params->layout))
+    return NULL;
+
+  if (batch)
+    codes = batch_som_training(params);
+  else if (minibatch > 0)
+    codes = minibatch_som_training(params, minibatch);
+  else if (parallel != PARALLEL_OFF)
+    codes = parallel_som_training(params, parallel);
+  else
+    codes = som_training(params);
+
+  if (codes != NULL)
+    set_layout(codes, LAYOUT_ROWS);
+  return codes;
+}
+
+/* coarse_training - train a map through smaller maps. The map is
+   halved in each direction 'levels' times (but not below MIN_COARSE
+   units) with resample_codes() and the smallest map is trained with
+   the radius scaled down to its size. Each map is then doubled in size
+   for the next stage, which starts from radius 2, twice the radius the
+   smaller map ended with. The last stage, on the full map, gets a
+   quarter of the running length and the others share the rest. The
+   codebook params->codes is freed. Returns the trained map or NULL on
+   error. */
+
+static struct entries *coarse_training(struct teach_params *params,
+				       int levels, int batch, long minibatch,
+				       int parallel)
+{
+  struct entries *codes = params->codes, *trained = NULL;
+  struct teach_params stage;
+  int xs[MAX_LEVELS + 1], ys[MAX_LEVELS + 1], s;
+
+  if (levels > MAX_LEVELS)
+    levels = MAX_LEVELS;
+
+  /* sizes of the maps, from the full one to the smallest */
+  xs[0] = codes->xdim;
+  ys[0] = codes->ydim;
+  for (s = 0; s < levels; s++)
+    {
+      xs[s + 1] = (xs[s] + 1) / 2;
+      ys[s + 1] = (ys[s] + 1) / 2;
+      if ((xs[s + 1] < MIN_COARSE) || (ys[s + 1] < MIN_COARSE))
+	break;
+    }
+  levels = s;
+
+  for (s = levels; s >= 0; s--)
+    {
+      stage = *params;
+      stage.codes = resample_codes((s == levels) ? codes : trained,
+				   xs[s], ys[s]);
+      if (s == levels)
+	close_entries(codes);
+      else
+	close_entries(trained);
+      if (stage.codes == NULL)
+	return NULL;
+
+      if (levels == 0)
+	stage.length = params->length;
+      else if (s == 0)
+	stage.length = params->length / 4;
+      else
+	stage.length = (params->length - params->length / 4) / levels;
+
+      if (s == levels)
+	{
+	  stage.radius = params->radius * xs[s] / xs[0];
+	  if (stage.radius < 1.0)
+	    stage.radius = 1.0;
+	}
+      else if (params->radius > 2.0)
+	stage.radius = 2.0;
+
+      /* snapshots and early stopping on the full map only */
+      if (s > 0)
+	{
+	  stage.snapshot = NULL;
+	  stage.stop = NULL;
+	}
+
+      ifverbose(2)
+	fprintf(stderr, "coarse training: %dx%d map, length %ld, radius %g\n",
+		xs[s], ys[s], stage.length, stage.radius);
+
+      if ((trained = train_map(&stage, batch, minibatch, parallel)) == NULL)
+	{
+	  close_entries(stage.codes);
+	  return NULL;
+	}
+    }
+
+  return trained;
+}
+
 int main(int argc, char **argv)
 {
   char *in_data_file;
@@ -69,6 +205,19 @@ int main(int argc, char **argv)
   struct typelist *type_tmp;
   int error = 0;
   char *funcname = NULL;
+  char *local_s, *layout_s;
+  float cutoff;
+  int batch, parallel = PARALLEL_OFF;
+  long minibatch;
+  char *parallel_s;
+  int levels;
+  long stop_interval;
+  float stop_threshold;
+  char *stop_file;
+  struct stop_info *stop = NULL;
+  long check_interval;
+  char *check_file, *resume_file;
+  struct checkpoint_info *ck = NULL, *resume = NULL;
 
   data = codes = NULL;
 
@@ -81,7 +230,9 @@ int main(int argc, char **argv)
 
   in_data_file = extract_parameter(argc, argv, IN_DATA_FILE, ALWAYS);
 
-  in_code_file = extract_parameter(argc, argv, IN_CODE_FILE, ALWAYS);
+  resume_file = extract_parameter(argc, argv, "-resume", OPTION);
+  in_code_file = extract_parameter(argc, argv, IN_CODE_FILE,
+				   resume_file ? OPTION : ALWAYS);
   out_code_file = extract_parameter(argc, argv, OUT_CODE_FILE, ALWAYS);
 
   params.length = oatoi(extract_parameter(argc, argv, RUNNING_LENGTH, ALWAYS),
@@ -101,6 +252,13 @@ int main(int argc, char **argv)
 
   alpha_s = extract_parameter(argc, argv, "-alpha_type", OPTION);
   funcname = extract_parameter(argc, argv, "-selfuncs", OPTION);
+  local_s = extract_parameter(argc, argv, "-local", OPTION);
+  batch = (extract_parameter(argc, argv, "-batch", OPTION2) != NULL);
+  minibatch = oatoi(extract_parameter(argc, argv, "-minibatch", OPTION), 0);
+  parallel_s = extract_parameter(argc, argv, "-parallel", OPTION);
+  cutoff = oatof(extract_parameter(argc, argv, "-cutoff", OPTION), 0.0);
+  levels = oatoi(extract_parameter(argc, argv, "-coarse", OPTION), 0);
+  layout_s = extract_parameter(argc, argv, "-layout", OPTION);
 
   /* snapshots */
   snapshot_file = extract_parameter(argc, argv, "-snapfile", OPTION);
@@ -111,6 +269,18 @@ int main(int argc, char **argv)
     get_id_by_str(snapshot_list, 
 		  extract_parameter(argc, argv, "-snaptype", OPTION));
 
+  /* early stopping */
+  stop_interval =
+    oatoi(extract_parameter(argc, argv, "-stopinterval", OPTION), 0);
+  stop_threshold =
+    oatof(extract_parameter(argc, argv, "-stopthreshold", OPTION), 0.001);
+  stop_file = extract_parameter(argc, argv, "-stopdata", OPTION);
+
+  /* checkpoints */
+  check_file = extract_parameter(argc, argv, "-checkfile", OPTION);
+  check_interval =
+    oatoi(extract_parameter(argc, argv, "-checkinterval", OPTION), 0);
+
   
   use_fixed(fixed);
   use_weights(weights);
@@ -129,6 +299,55 @@ int main(int argc, char **argv)
 	exit(1);
     }
 
+  if (stop_interval > 0)
+    {
+      if (batch || (minibatch > 0) || parallel_s)
+	fprintf(stderr, "early stopping works only in online training, not used\n");
+      else if ((stop = get_stop_info(stop_file, stop_interval, stop_threshold,
+				     STOP_QERROR)) == NULL)
+	{
+	  error = 1;
+	  goto end;
+	}
+    }
+
+  if (check_interval > 0)
+    {
+      if (batch || (minibatch > 0) || parallel_s || (levels > 0))
+	fprintf(stderr, "checkpoints work only in online training, not used\n");
+      else
+	{
+	  if (check_file == NULL)
+	    {
+	      check_file = out_code_file;
+	      fprintf(stderr, "checkpoint file not specified, using '%s'\n",
+		      check_file);
+	    }
+	  if ((ck = get_checkpoint(check_file, check_interval)) == NULL)
+	    {
+	      error = 1;
+	      goto end;
+	    }
+	}
+    }
+
+  /* the codebook is read from the checkpoint */
+  if (resume_file)
+    {
+      if (batch || (minibatch > 0) || parallel_s || (levels > 0))
+	{
+	  fprintf(stderr, "only online training can be resumed\n");
+	  error = 1;
+	  goto end;
+	}
+      if ((resume = read_checkpoint(resume_file)) == NULL)
+	{
+	  error = 1;
+	  goto end;
+	}
+      in_code_file = resume_file;
+    }
+
   ifverbose(2)
     fprintf(stderr, "Input entries are read from file %s\n", in_data_file);
   data = open_entries(in_data_file);
@@ -164,6 +383,10 @@ int main(int argc, char **argv)
   set_teach_params(&params, codes, data, buffer, funcname);
   set_som_params(&params);
   params.snapshot = snap;
+  params.stop = stop;
+  params.checkpoint = ck;
+  params.resume = resume;
+  params.cutoff = cutoff;
 
   init_random(randomize);
 
@@ -187,7 +410,57 @@ int main(int argc, char **argv)
   params.alpha_type = type_tmp->id;
   params.alpha_func = (ALPHA_FUNC *)type_tmp->data;
 
-  codes = som_training(&params);
+  if (local_s)
+    {
+      params.local_search = get_id_by_str(local_list, local_s);
+      if (params.local_search == LOCAL_OFF)
+	{
+	  fprintf(stderr, "Unknown local search type %s\n", local_s);
+	  error = 1;
+	  goto end;
+	}
+    }
+
+  if (layout_s)
+    {
+      type_tmp = get_type_by_str(layout_list, layout_s);
+      if (type_tmp->str == NULL)
+	{
+	  fprintf(stderr, "Unknown layout %s\n", layout_s);
+	  error = 1;
+	  goto end;
+	}
+      params.layout = type_tmp->id;
+    }
+
+  if (parallel_s)
+    {
+      parallel = get_id_by_str(parallel_list, parallel_s);
+      if (parallel == PARALLEL_OFF)
+	{
+	  fprintf(stderr, "Unknown parallel training type %s\n", parallel_s);
+	  error = 1;
+	  goto end;
+	}
+    }
+
+  /* the fixed points are places on the full map */
+  if (fixed && (levels > 0))
+    {
+      fprintf(stderr, "coarse training can't be used with fixed points, not used\n");
+      levels = 0;
+    }
+
+  if (levels > 0)
+    codes = coarse_training(&params, levels, batch, minibatch, parallel);
+  else
+    codes = train_map(&params, batch, minibatch, parallel);
+  if (codes == NULL)
+    {
+      fprintf(stderr, "training failed\n");
+      error = 1;
+      goto end;
+    }
 
   ifverbose(2)
     fprintf(stderr, "Codebook entries are saved to file %s\n", out_code_file);
@@ -201,6 +474,12 @@ int main(int argc, char **argv)
 
   if (snap)
     free_snapshot(snap);
+  if (stop)
+    free_stop_info(stop);
+  if (ck)
+    free_checkpoint(ck);
+  if (resume)
+    free_checkpoint(resume);
 
   return(error);
 }